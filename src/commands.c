@@ -15,6 +15,8 @@
  */
 
 #include "commands.h"
+#include "watch.h"
+#include "writer.h"
 
 bool sorts_need_saving = false;
 
@@ -293,12 +295,10 @@ cmd_write(int argc, char *argv[])
          return 3;
       }
 
-      /* do the save... */
-      playlist_save(viewing_playlist);
+      /* do the save... (reported once written) */
+      writer_save_playlist(viewing_playlist);
       viewing_playlist->needs_saving = false;
       paint_library();
-      paint_message("\"%s\" %d songs written",
-         viewing_playlist->filename, viewing_playlist->nfiles);
 
    } else { /* "save as" */
       int   i, clobber_index;
@@ -340,16 +340,14 @@ cmd_write(int argc, char *argv[])
        * and display here.
        */
 
-      /* do the save-as... */
-      playlist_save(dup);
+      /* do the save-as... (reported once written) */
+      writer_save_playlist(dup);
       medialib_playlist_add(dup);
 
       dup->needs_saving = false;
       viewing_playlist->needs_saving = false;
 
       paint_library();
-      paint_message("\"%s\" %d songs written",
-         filename, viewing_playlist->nfiles);
 
       free(filename);
    }
@@ -423,7 +421,7 @@ cmd_new(int argc, char *argv[])
    medialib_playlist_add(p);
    ui.library->nrows++;
    if (p->filename != NULL)
-      playlist_save(p);
+      writer_save_playlist(p);
 
    /* redraw */
    paint_library();
@@ -448,23 +446,23 @@ cmd_filter(int argc, char *argv[])
    /* determine what kind of filter we're doing */
    match = argv[0][strlen(argv[0]) - 1] != '!';
 
-   /* set the raw query */
-   search_phrase = argv2str(argc - 1, argv + 1);
-   mi_query_setraw(search_phrase);
-   free(search_phrase);
-
-   /* clear existing global query & set new one */
+   /* clear existing global query & set new one, and the raw query */
    mi_query_clear();
    for (i = 1; i < argc; i++)
       mi_query_add_token(argv[i]);
 
+   search_phrase = argv2str(argc - 1, argv + 1);
+   mi_query_setraw(search_phrase);
+   free(search_phrase);
+
    /* do actual filter */
-   results = playlist_filter(viewing_playlist, match);
+   results = filter_playlist(viewing_playlist, match);
 
    /* swap necessary bits of results with filter playlist */
    swap(meta_info **, results->files,    mdb.filter_results->files);
    swap(int, results->nfiles,   mdb.filter_results->nfiles);
    swap(int, results->capacity, mdb.filter_results->capacity);
+   playlist_changed(mdb.filter_results);
    playlist_free(results);
 
    /* redraw */
@@ -478,7 +476,8 @@ cmd_filter(int argc, char *argv[])
 int
 cmd_sort(int argc, char *argv[])
 {
-   const char *errmsg;
+   mi_sort_description desc;
+   const char         *errmsg;
 
    if (argc != 2) {
       paint_error("usage: sort <sort-description>");
@@ -491,9 +490,15 @@ cmd_sort(int argc, char *argv[])
       return 2;
    }
 
-   /* do the actual sort */
-   qsort(viewing_playlist->files, viewing_playlist->nfiles,
-      sizeof(meta_info*), mi_compare);
+   /* do the actual sort (the library's may be kept in the database) */
+   if (viewing_playlist == mdb.library)
+      medialib_sort_library();
+   else {
+      mi_sort_get(&desc);
+      medialib_decode_all();
+      mi_sort_files(viewing_playlist->files, viewing_playlist->nfiles, &desc);
+      playlist_changed(viewing_playlist);
+   }
 
    if (!ui_is_init())
       return 0;
@@ -705,9 +710,42 @@ cmd_set(int argc, char *argv[])
       else
          paint_message("changing sort will NOT be prompted for saving");
 
+   } else if (strcasecmp(property, "watch") == 0) {
+      if (str2bool(value, &tf) < 0) {
+         paint_error("%s %s: value must be boolean",
+            argv[0], property);
+         return 7;
+      }
+      if (!tf) {
+         watch_stop();
+         paint_message("library will NOT be watched for changes");
+      } else if (watch_start() == -1) {
+         paint_error("%s %s: %s", argv[0], property, strerror(errno));
+         return 8;
+      } else
+         paint_message("library will be watched for changes");
+
+   } else if (strcasecmp(property, "fuzzy") == 0) {
+      /* a boolean, or the most errors allowed */
+      if (str2bool(value, &tf) == 0)
+         mi_query_fuzzy = (tf ? MI_QUERY_FUZZY_ERRORS : 0);
+      else {
+         mi_query_fuzzy = (int)strtonum(value, 0, BITAP_MAX_ERRORS, &err);
+         if (err != NULL) {
+            paint_error("%s %s: bad value: '%s' %s",
+               argv[0], property, value, err);
+            return 9;
+         }
+      }
+      if (mi_query_fuzzy > 0)
+         paint_message("text will be matched with up to %d errors",
+            mi_query_fuzzy);
+      else
+         paint_message("text will be matched exactly");
+
    } else {
       paint_error("%s: unknown property '%s'", argv[0], property);
-      return 7;
+      return 10;
    }
 
    return 0;
@@ -716,6 +754,8 @@ cmd_set(int argc, char *argv[])
 int
 cmd_reload(int argc, char *argv[])
 {
+   bool watching;
+
    if (argc != 2) {
       paint_error("usage: %s [ db | conf ]", argv[0]);
       return 1;
@@ -732,12 +772,22 @@ cmd_reload(int argc, char *argv[])
       /* stop playback TODO investigate a nice way around this */
       player_stop();
 
-      /* reload db */
+      /* reload db (and re-watch it, which depends on what's in it) */
+      watching = watch_running();
+      watch_stop();
+      writer_wait();
+      filter_forget();
       medialib_destroy();
       medialib_load(db_file, playlist_dir);
+      if (watching && watch_start() == -1)
+         paint_error("failed to watch library: %s", strerror(errno));
 
       /* sort entries */
-      qsort(mdb.library->files, mdb.library->nfiles, sizeof(meta_info*), mi_compare);
+      medialib_sort_library();
+      if (medialib_sorts_stale()) {
+         mdb.db_needs_rewrite = true;
+         writer_save_db();
+      }
 
       free(db_file);
       free(playlist_dir);
@@ -965,9 +1015,28 @@ cmd_execute(char *cmd)
 
 int
 user_getstr(const char *prompt, char **response)
+{
+   return user_getstr_live(prompt, response, NULL, NULL);
+}
+
+/* redraw the command window with the input so far */
+static void
+user_getstr_redraw(const char *prompt, const char *input, int pos)
+{
+   werase(ui.command);
+   mvwprintw(ui.command, 0, 0, "%s%.*s", prompt, pos, input);
+   curs_set(1);
+   wmove(ui.command, 0, strlen(prompt) + pos);
+   wrefresh(ui.command);
+}
+
+int
+user_getstr_live(const char *prompt, char **response,
+   void (*changed)(const char *input), bool (*work)(void))
 {
    const int MAX_INPUT_SIZE = 1000; /* TODO remove this limit */
    char *input;
+   bool  busy;
    int  pos, ch, ret;
 
    /* display the prompt */
@@ -988,7 +1057,13 @@ user_getstr(const char *prompt, char **response)
    /* start getting input */
    ret = 0;
    pos = 0;
-   while ((ch = getch()) && !VSIG_QUIT) {
+   busy = false;
+   for (;;) {
+      /* while there's work to do, only look for input in between */
+      if (work != NULL)
+         timeout(busy ? 0 : -1);
+      if (!(ch = getch()) || VSIG_QUIT)
+         break;
 
       /*
        * Handle any signals.  Note that the use of curs_set, wmvoe, and
@@ -1001,8 +1076,11 @@ user_getstr(const char *prompt, char **response)
       wmove(ui.command, 0, strlen(prompt) + pos);
       wrefresh(ui.command);
 
-      if (ch == ERR)
+      if (ch == ERR) {
+         if (busy && !(busy = work()))
+            user_getstr_redraw(prompt, input, pos);
          continue;
+      }
 
       if (ch == '\n' || ch == 13)
          break;
@@ -1022,24 +1100,32 @@ user_getstr(const char *prompt, char **response)
                goto end;
             }
             beep();
-         } else {
-            mvwaddch(ui.command, 0, strlen(prompt) + pos - 1, ' ');
-            wmove(ui.command, 0, strlen(prompt) + pos - 1);
-            wrefresh(ui.command);
-            pos--;
+            continue;
          }
-         continue;
-      }
 
-      /* got regular input.  add to buffer. */
-      input[pos] = ch;
-      mvwaddch(ui.command, 0, strlen(prompt) + pos, ch);
-      wrefresh(ui.command);
-      pos++;
+         mvwaddch(ui.command, 0, strlen(prompt) + pos - 1, ' ');
+         wmove(ui.command, 0, strlen(prompt) + pos - 1);
+         wrefresh(ui.command);
+         pos--;
+         input[pos] = '\0';
+      } else {
+         /* got regular input.  add to buffer. */
+         input[pos] = ch;
+         mvwaddch(ui.command, 0, strlen(prompt) + pos, ch);
+         wrefresh(ui.command);
+         pos++;
+
+         /* see todo above - realloc input buffer if position reaches max */
+         if (pos >= MAX_INPUT_SIZE)
+            errx(1, "user_getstr: shamefull limit reached");
+      }
 
-      /* see todo above - realloc input buffer here if position reaches max */
-      if (pos >= MAX_INPUT_SIZE)
-         errx(1, "user_getstr: shamefull limit reached");
+      /* let the caller start over on the new input */
+      if (changed != NULL) {
+         changed(input);
+         busy = (work != NULL);
+         user_getstr_redraw(prompt, input, pos);
+      }
    }
 
    /* For lack of input, bail out */
@@ -1060,6 +1146,8 @@ user_getstr(const char *prompt, char **response)
    snprintf(*response, strlen(input) + 1, "%s", input);
 
 end:
+   if (work != NULL)
+      timeout(-1);
    free(input);
    curs_set(0);
    return ret;
@@ -20,6 +20,7 @@
 #include "compat/compat.h"
 
 #include "enums.h"
+#include "filter.h"
 #include "paint.h"
 #include "util/str2argv.h"
 #include "vitunes.h"
@@ -95,6 +96,14 @@ toggle_list* toggle_get(int registr);
 int user_getstr(const char *prompt, char **response);
 int user_get_yesno(const char *prompt, int *response);
 
+/*
+ * Like user_getstr(), but calling changed() with the input every time it's
+ * edited, and then work() whenever no key is waiting, until it returns
+ * false (so a slow response to the input never holds up typing).
+ */
+int user_getstr_live(const char *prompt, char **response,
+   void (*changed)(const char *input), bool (*work)(void));
+
 void setup_viewing_playlist(playlist *p);
 
 
@@ -73,6 +73,9 @@
 #  define COMPAT_NEED_STRLCAT
 #  define COMPAT_NEED_STRTONUM
 
+/* ...and has inotify(7) for watching the library */
+#  define COMPAT_HAVE_INOTIFY
+
 /* still unsure/curious about these last two */
 #  ifndef u_short
    typedef unsigned short u_short;
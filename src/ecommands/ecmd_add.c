@@ -15,12 +15,44 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <limits.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <unistd.h>
 
 #include "ecmd.h"
 #include "../medialib.h"
 #include "../vitunes.h"
 
+static bool forced;
+static int  njobs = 1;
+
+static int
+ecmd_add_parse(int argc, char **argv)
+{
+   const char *errstr;
+   int         ch;
+
+   while ((ch = getopt(argc, argv, "fj:")) != -1) {
+      switch (ch) {
+         case 'f':
+            forced = true;
+            break;
+         case 'j':
+            njobs = (int) strtonum(optarg, 1, MEDIALIB_MAX_JOBS, &errstr);
+            if (errstr != NULL)
+               errx(1, "invalid number of jobs '%s': %s", optarg, errstr);
+            break;
+         case 'h':
+         case '?':
+         default:
+            return -1;
+      }
+   }
+
+   return 0;
+}
+
 static void
 ecmd_add_exec(UNUSED int argc, char **argv)
 {
@@ -28,16 +60,16 @@ ecmd_add_exec(UNUSED int argc, char **argv)
    medialib_load(db_file, playlist_dir);
 
    printf("Scanning directories for files to add to database...\n");
-   medialib_db_scan_dirs(argv);
+   medialib_db_scan_dirs(argv, njobs, forced);
 
    medialib_destroy();
 }
 
 const struct ecmd ecmd_add = {
    "add", NULL,
-   "path [...]",
+   "[-f] [-j jobs] path [...]",
    1, -1,
-   NULL,
+   ecmd_add_parse,
    NULL,
    ecmd_add_exec
 };
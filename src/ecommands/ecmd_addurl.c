@@ -28,17 +28,16 @@
 static void
 ecmd_addurl_exec(UNUSED int argc, char **argv)
 {
+   mi_builder   b;
    meta_info   *m;
-   bool         found;
    int          found_idx;
    char         input[255];
-   int          field, i;
+   int          field;
 
    /* start new record, set filename */
-   m = mi_new();
-   m->is_url = true;
-   if ((m->filename = strdup(argv[0])) == NULL)
-      err(1, "%s: strdup failed (filename)", __FUNCTION__);
+   mi_builder_init(&b);
+   b.mi.is_url = true;
+   mi_builder_filename(&b, argv[0]);
 
    /* get fields from user */
    for (field = 0; field < MI_NUM_CINFO; field++) {
@@ -46,31 +45,25 @@ ecmd_addurl_exec(UNUSED int argc, char **argv)
       printf("%10.10s: ", MI_CINFO_NAMES[field]);
       if (fgets(input, sizeof(input), stdin) == NULL) {
          warnx("Operation canceled. Database unchanged.");
-         mi_free(m);
+         mi_builder_free(&b);
          return;
       }
 
       if (input[strlen(input) - 1] == '\n')
          input[strlen(input) - 1] = '\0';
 
-      if ((m->cinfo[field] = strdup(input)) == NULL)
-         err(1, "%s: strdup failed (field)", __FUNCTION__);
+      mi_builder_cinfo(&b, field, input);
    }
 
+   m = mi_builder_finish(&b);
+   mi_builder_free(&b);
+
    /* load existing database and see if file/URL already exists */
    medialib_load(db_file, playlist_dir);
 
    /* does the URL already exist in the database? */
-   found = false;
-   found_idx = -1;
-   for (i = 0; i < mdb.library->nfiles && !found; i++) {
-      if (strcmp(m->filename, mdb.library->files[i]->filename) == 0) {
-         found = true;
-         found_idx = i;
-      }
-   }
-
-   if (found) {
+   found_idx = medialib_file_find(m->filename);
+   if (found_idx != -1) {
       printf("Warning: file/URL '%s' already in the database.\n", argv[0]);
       printf("Do you want to replace the existing record? [y/n] ");
 
@@ -83,10 +76,10 @@ ecmd_addurl_exec(UNUSED int argc, char **argv)
       }
 
       mi_sanitize(m);
-      playlist_file_replace(mdb.library, found_idx, m);
+      medialib_file_replace(found_idx, m);
    } else {
       mi_sanitize(m);
-      playlist_files_append(mdb.library, &m, 1, false);
+      medialib_file_add(m);
    }
 
    medialib_db_save(db_file);
@@ -31,7 +31,6 @@ static bool show_database;
 static void
 ecmd_check_show_db(const char *path)
 {
-   bool       found;
    char       realfile[PATH_MAX];
    int        i;
    meta_info *mi;
@@ -45,18 +44,11 @@ ecmd_check_show_db(const char *path)
 
    /* check if file is in database */
    medialib_load(db_file, playlist_dir);
-   found = false;
-   mi = NULL;
-   for (i = 0; i < mdb.library->nfiles && !found; i++) {
-      if (strcmp(realfile, mdb.library->files[i]->filename) == 0) {
-         found = true;
-         mi = mdb.library->files[i];
-      }
-   }
-
-   if (!found)
+   if ((i = medialib_file_find(realfile)) == -1)
       warnx("File '%s' does NOT exist in the database", path);
    else {
+      mi = mdb.library->files[i];
+      mi_decode(mi);
       printf("\tThe meta-information in the DATABASE is:\n");
       for (i = 0; i < MI_NUM_CINFO; i++)
          printf("\t%10.10s: '%s'\n", MI_CINFO_NAMES[i], mi->cinfo[i]);
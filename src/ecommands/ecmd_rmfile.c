@@ -51,23 +51,15 @@ static void
 ecmd_rmfile_exec(UNUSED int argc, char **argv)
 {
    char  input[255];
-   bool  found;
    int   found_idx;
    int   i;
 
    /* load database and search for record */
    medialib_load(db_file, playlist_dir);
-   found = false;
-   found_idx = -1;
-   for (i = 0; i < mdb.library->nfiles && !found; i++) {
-      if (strcmp(argv[0], mdb.library->files[i]->filename) == 0) {
-         found = true;
-         found_idx = i;
-      }
-   }
+   found_idx = medialib_file_find(argv[0]);
 
    /* if not found then error */
-   if (!found) {
+   if (found_idx == -1) {
       i = (forced ? 0 : 1);
       errx(i, "%s: %s: No such file or URL", argv[0], argv[0]);
    }
@@ -80,7 +72,7 @@ ecmd_rmfile_exec(UNUSED int argc, char **argv)
          errx(1, "Operation canceled.  Database unchanged.");
    }
 
-   playlist_files_remove(mdb.library, found_idx, 1, false);
+   medialib_file_remove(found_idx);
    medialib_db_save(db_file);
    medialib_destroy();
 }
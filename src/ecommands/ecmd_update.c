@@ -15,6 +15,7 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -25,17 +26,24 @@
 
 static bool force_update;
 static bool show_skipped;
+static int  njobs = 1;
 
 static int
 ecmd_update_parse(int argc, char **argv)
 {
-   int ch;
+   const char *errstr;
+   int         ch;
 
-   while ((ch = getopt(argc, argv, "fs")) != -1) {
+   while ((ch = getopt(argc, argv, "fj:s")) != -1) {
       switch (ch) {
          case 'f':
             force_update = true;
             break;
+         case 'j':
+            njobs = (int) strtonum(optarg, 1, MEDIALIB_MAX_JOBS, &errstr);
+            if (errstr != NULL)
+               errx(1, "invalid number of jobs '%s': %s", optarg, errstr);
+            break;
          case 's':
             show_skipped = true;
             break;
@@ -56,14 +64,14 @@ ecmd_update_exec(UNUSED int argc, UNUSED char **argv)
    medialib_load(db_file, playlist_dir);
 
    printf("Updating existing database...\n");
-   medialib_db_update(show_skipped, force_update);
+   medialib_db_update(show_skipped, force_update, njobs);
 
    medialib_destroy();
 }
 
 const struct ecmd ecmd_update = {
    "update", NULL,
-   "[-fs]",
+   "[-fs] [-j jobs]",
    0, 0,
    ecmd_update_parse,
    NULL,
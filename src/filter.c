@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "filter.h"
+
+/* a token of the query of a filter, see mi_query_description */
+typedef struct {
+   char            *folded;
+   bool             positive;
+   int              field;
+   int              op;
+   int              value;
+} filter_token;
+
+/* the results of a filter, and what they depend on */
+typedef struct {
+   const playlist  *source;         /* NULL if the entry is free */
+   unsigned int     generation;     /* of source, see playlist_changed() */
+   unsigned int     mdb_generation; /* of the library, see medialib.h */
+   bool             match;          /* filter, or filter! */
+   bool             match_filename;
+   filter_token    *tokens;         /* the query */
+   int              ntokens;
+   bool             ranked;         /* files are by score, see playlist.h */
+   meta_info      **files;
+   int              nfiles;
+   unsigned long    used;           /* when last used, for the LRU */
+} filter_entry;
+
+static filter_entry  filter_cache[FILTER_CACHE_SIZE];
+static unsigned long filter_clock = 0;
+
+
+static void
+filter_entry_free(filter_entry *e)
+{
+   int i;
+
+   for (i = 0; i < e->ntokens; i++)
+      free(e->tokens[i].folded);
+   free(e->tokens);
+   free(e->files);
+   memset(e, 0, sizeof(filter_entry));
+}
+
+/* are the results of an entry from the same playlist, unchanged since? */
+static bool
+filter_same_source(const filter_entry *e, const playlist *p)
+{
+   return e->source == p
+       && e->generation == p->generation
+       && e->mdb_generation == mdb.generation
+       && e->match_filename == mi_query_match_filename;
+}
+
+static bool
+filter_same_query(const filter_entry *e, const mi_query_description *q)
+{
+   const filter_token *t;
+   int                 i;
+
+   if (e->ntokens != q->ntokens)
+      return false;
+
+   for (i = 0; i < q->ntokens; i++) {
+      t = &(e->tokens[i]);
+      if (t->positive != (bool) q->match[i]
+      ||  t->field != q->field[i] || t->op != q->op[i]
+      ||  t->value != q->value[i]
+      ||  strcmp(t->folded, q->folded[i]) != 0)
+         return false;
+   }
+
+   return true;
+}
+
+/*
+ * Is a token of an entry implied by token j of q?  Text is implied by a
+ * longer text of q, in the same field or one of those it covers, and
+ * negated text by a shorter negated text of q (what lacks "bea" lacks
+ * "beatles" too), covering its field.  Fuzzy text is the same, with as
+ * many errors allowed.  A number is only implied by the same number.
+ */
+static bool
+filter_implies(const filter_token *t, const mi_query_description *q, int j)
+{
+   if ((bool) q->match[j] != t->positive || q->op[j] != t->op)
+      return false;
+
+   if (t->op != MI_QUERY_CONTAINS && t->op != MI_QUERY_FUZZY)
+      return q->field[j] == t->field && q->value[j] == t->value;
+
+   if (q->value[j] != t->value)
+      return false;
+
+   if (t->positive)
+      return (q->field[j] == t->field
+          ||  (t->field == MI_QUERY_ANY && q->field[j] != MI_QUERY_FILENAME))
+          && strstr(q->folded[j], t->folded) != NULL;
+
+   return (q->field[j] == t->field
+       ||  (q->field[j] == MI_QUERY_ANY && t->field != MI_QUERY_FILENAME))
+       && strstr(t->folded, q->folded[j]) != NULL;
+}
+
+/*
+ * Can only records that match the query of an entry match q?  They can if
+ * every token of the entry is implied by one of q.
+ */
+static bool
+filter_refines(const filter_entry *e, const mi_query_description *q)
+{
+   bool implied;
+   int  i, j;
+
+   for (i = 0; i < e->ntokens; i++) {
+      implied = false;
+      for (j = 0; !implied && j < q->ntokens; j++)
+         implied = filter_implies(&(e->tokens[i]), q, j);
+
+      if (!implied)
+         return false;
+   }
+
+   return true;
+}
+
+/* remember the results of a filter, in place of the least recently used */
+static void
+filter_remember(const playlist *p, bool m,
+   const mi_query_description *q, const playlist *results)
+{
+   filter_entry *e;
+   int           i;
+
+   e = &(filter_cache[0]);
+   for (i = 1; i < FILTER_CACHE_SIZE && e->source != NULL; i++) {
+      if (filter_cache[i].source == NULL || filter_cache[i].used < e->used)
+         e = &(filter_cache[i]);
+   }
+   filter_entry_free(e);
+
+   e->source = p;
+   e->generation = p->generation;
+   e->mdb_generation = mdb.generation;
+   e->match = m;
+   e->match_filename = mi_query_match_filename;
+   e->ntokens = q->ntokens;
+   e->ranked = (m && q->nranked > 0);
+   e->tokens = calloc(q->ntokens, sizeof(filter_token));
+   e->files = calloc(results->nfiles + 1, sizeof(meta_info*));
+   if (e->tokens == NULL || e->files == NULL)
+      err(1, "filter_remember: calloc failed");
+
+   for (i = 0; i < q->ntokens; i++) {
+      if ((e->tokens[i].folded = strdup(q->folded[i])) == NULL)
+         err(1, "filter_remember: strdup failed");
+      e->tokens[i].positive = q->match[i];
+      e->tokens[i].field = q->field[i];
+      e->tokens[i].op = q->op[i];
+      e->tokens[i].value = q->value[i];
+   }
+
+   memcpy(e->files, results->files, results->nfiles * sizeof(meta_info*));
+   e->nfiles = results->nfiles;
+   e->used = ++filter_clock;
+}
+
+playlist *
+filter_playlist(const playlist *p, bool m)
+{
+   const mi_query_description *q;
+   filter_entry               *e, *best;
+   playlist                   *results, narrowed;
+   int                         i;
+
+   if (!mi_query_isset())
+      return NULL;
+
+   q = mi_query_get();
+   best = NULL;
+   for (i = 0; i < FILTER_CACHE_SIZE; i++) {
+      e = &(filter_cache[i]);
+      if (e->source == NULL || !filter_same_source(e, p))
+         continue;
+
+      /* the same filter again */
+      if (e->match == m && filter_same_query(e, q)) {
+         e->used = ++filter_clock;
+         results = playlist_new();
+         playlist_files_append(results, e->files, e->nfiles, false);
+         return results;
+      }
+
+      /* the smallest results the new ones are among, in playlist order */
+      if (m && e->match && !e->ranked && filter_refines(e, q)
+      &&  (best == NULL || e->nfiles < best->nfiles))
+         best = e;
+   }
+
+   if (best != NULL) {
+      best->used = ++filter_clock;
+      memset(&narrowed, 0, sizeof(playlist));
+      narrowed.files = best->files;
+      narrowed.nfiles = best->nfiles;
+      results = playlist_filter(&narrowed, m, medialib_query_candidates());
+   } else
+      results = playlist_filter(p, m, medialib_query_candidates());
+
+   filter_remember(p, m, q, results);
+   return results;
+}
+
+void
+filter_forget(void)
+{
+   int i;
+
+   for (i = 0; i < FILTER_CACHE_SIZE; i++)
+      filter_entry_free(&(filter_cache[i]));
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Filtering playlists by the global query (see cmd_filter()), remembering
+ * the results of the last FILTER_CACHE_SIZE filters.
+ *
+ * Filtering the same playlist by the same query again, with nothing changed
+ * in between, just copies the results remembered.  A query that refines one
+ * remembered (each of the old tokens is part of a new one: a longer token,
+ * or more of them) only goes through the results of the old one, as
+ * nothing else can match it (unless they were ranked by a fuzzy query,
+ * which lost the order of the playlist).  Anything else goes through the
+ * whole playlist, narrowed by the trigram index of the library (see
+ * medialib.h).
+ *
+ * A playlist is known to be unchanged by its generation (see
+ * playlist_changed()), and the records of the library by mdb.generation.
+ */
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include "compat/compat.h"
+
+#include <err.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "medialib.h"
+#include "meta_info.h"
+#include "playlist.h"
+
+#define FILTER_CACHE_SIZE  8
+
+/* filter a playlist to the records matching (or not) the global query */
+playlist *filter_playlist(const playlist *p, bool m);
+
+/* forget all results, when the records they refer to are gone */
+void filter_forget(void);
+
+#endif
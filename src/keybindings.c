@@ -802,16 +802,263 @@ kba_go(KbaArgs a UNUSED)
    kba_jumpto_file(args);
 }
 
+/* the row c rows away from start, in direction dir, wrapping around */
+static int
+search_row(int start, int dir, int c)
+{
+   int idx;
+
+   idx = (dir == FORWARDS ? start + c : start - c);
+   if (idx < 0)
+      idx = ui.active->nrows + idx;
+   else if (idx >= ui.active->nrows)
+      idx %= ui.active->nrows;
+
+   return idx;
+}
+
+/* does the row at idx of the active window match the global query? */
+static bool
+search_match(const trigram_set *candidates, int idx)
+{
+   if (ui.active == ui.library)
+      return str_match_query(mdb.playlists[idx]->name);
+
+   return mi_may_match(candidates, viewing_playlist->files[idx])
+       && mi_match(viewing_playlist->files[idx]);
+}
+
+/* move the cursor to the row at idx */
+static void
+search_jump(int idx)
+{
+   KbaArgs foo;
+
+   gnum_set(idx + 1);
+   foo = get_dummy_args();
+   foo.scale = NUMBER;
+   foo.num = 'G';
+   kba_jumpto_file(foo);
+}
+
+/*
+ * The rows of the viewing playlist that match the global query, in order,
+ * so that n/N are a binary search instead of checking each row after the
+ * cursor.  They're found once per query and playlist, and found again once
+ * either changes (or the records matched or match-fname do).  The library
+ * window only has a row per playlist, and is still searched row by row.
+ */
+static struct {
+   const playlist *playlist;        /* NULL if none were found yet */
+   unsigned int    generation;      /* of the playlist */
+   unsigned int    records;         /* generation of the library */
+   unsigned int    query;           /* generation of the query */
+   bool            match_filename;
+   int            *rows;
+   int             nrows;
+   int             capacity;
+} search_matches;
+
+static bool
+search_matches_current(void)
+{
+   return search_matches.playlist == viewing_playlist
+       && search_matches.generation == viewing_playlist->generation
+       && search_matches.records == mdb.generation
+       && search_matches.query == mi_query_generation()
+       && search_matches.match_filename == mi_query_match_filename;
+}
+
+/* find the matching rows of the viewing playlist, unless already found */
+static void
+search_matches_find(void)
+{
+   const trigram_set *candidates;
+   int *rows;
+   int  i;
+
+   if (search_matches_current())
+      return;
+
+   candidates = medialib_query_candidates();
+   search_matches.nrows = 0;
+   for (i = 0; i < viewing_playlist->nfiles; i++) {
+      if (!search_match(candidates, i))
+         continue;
+
+      if (search_matches.nrows == search_matches.capacity) {
+         search_matches.capacity = (search_matches.capacity == 0 ? 1024
+            : search_matches.capacity * 2);
+         rows = realloc(search_matches.rows,
+            search_matches.capacity * sizeof(int));
+         if (rows == NULL)
+            err(1, "search_matches_find: realloc failed");
+         search_matches.rows = rows;
+      }
+      search_matches.rows[search_matches.nrows++] = i;
+   }
+
+   search_matches.playlist = viewing_playlist;
+   search_matches.generation = viewing_playlist->generation;
+   search_matches.records = mdb.generation;
+   search_matches.query = mi_query_generation();
+   search_matches.match_filename = mi_query_match_filename;
+}
+
+/* index of the first matching row after row (the count of those up to it) */
+static int
+search_matches_after(int row)
+{
+   int lo, hi, mid;
+
+   lo = 0;
+   hi = search_matches.nrows;
+   while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      if (search_matches.rows[mid] <= row)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   return lo;
+}
+
+/*
+ * The incremental search: each time the phrase typed changes, the search
+ * starts over from where the cursor was, in slices (see incsearch_work()),
+ * and the cursor follows the first match.  Whatever was being searched for
+ * is dropped on the next keystroke.  The slices first build the trigram
+ * index of the library, if not done yet, and narrow its candidates down,
+ * before going through the rows.
+ */
+static struct {
+   int                  dir;
+   int                  start;      /* row the search started from */
+   int                  voffset;    /* of the window then */
+   int                  crow;
+   int                  next;       /* next row to check, as in search_row() */
+   bool                 active;     /* still looking */
+   bool                 narrowed;   /* candidates found, if needed */
+   const trigram_set   *candidates;
+} incsearch;
+
+/* put the window back where it was when the search started */
+static void
+incsearch_restore(void)
+{
+   ui.active->voffset = incsearch.voffset;
+   ui.active->crow = incsearch.crow;
+}
+
+static void
+incsearch_changed(const char *input)
+{
+   const char *errmsg = NULL;
+   char      **argv = NULL;
+   int         argc = 0;
+   int         i;
+
+   incsearch.active = false;
+   incsearch_restore();
+   redraw_active();
+
+   /* a phrase still being typed may not parse (an open quote, say) */
+   mi_query_clear();
+   if (str2argv(input, &argc, &argv, &errmsg) != 0)
+      return;
+   for (i = 0; i < argc; i++)
+      mi_query_add_token(argv[i]);
+   argv_free(&argc, &argv);
+
+   if (!mi_query_isset() || ui.active->nrows == 0)
+      return;
+
+   incsearch.candidates = NULL;
+   incsearch.narrowed = (ui.active == ui.library);
+   incsearch.next = 1;
+   incsearch.active = true;
+}
+
+/* search a slice of rows, returning true if there are more to search */
+static bool
+incsearch_work(void)
+{
+   struct timeval start, now;
+   int            c, end, idx;
+
+   if (!incsearch.active)
+      return false;
+
+   /* a longer phrase narrows down the candidates of the last one */
+   if (!incsearch.narrowed) {
+      if (medialib_index_work(INCSEARCH_SLICE_USEC))
+         return true;
+      incsearch.candidates = medialib_query_candidates();
+      incsearch.narrowed = true;
+      return true;
+   }
+
+   gettimeofday(&start, NULL);
+   do {
+      end = incsearch.next + INCSEARCH_SLICE_ROWS;
+      if (end > ui.active->nrows + 1)
+         end = ui.active->nrows + 1;
+
+      for (c = incsearch.next; c < end; c++) {
+         idx = search_row(incsearch.start, incsearch.dir, c);
+         if (search_match(incsearch.candidates, idx)) {
+            incsearch.active = false;
+            search_jump(idx);
+            return false;
+         }
+      }
+
+      incsearch.next = end;
+      if (end == ui.active->nrows + 1) {
+         incsearch.active = false;
+         return false;
+      }
+
+      gettimeofday(&now, NULL);
+   } while ((now.tv_sec - start.tv_sec) * 1000000
+          + (now.tv_usec - start.tv_usec) < INCSEARCH_SLICE_USEC);
+
+   return true;
+}
+
+/* set the global query from a search phrase, returning false if it's bad */
+static bool
+search_set_query(const char *search_phrase, bool report)
+{
+   const char *errmsg = NULL;
+   char **argv  = NULL;
+   int    argc = 0;
+   int    i;
+
+   if (str2argv(search_phrase, &argc, &argv, &errmsg) != 0) {
+      if (report)
+         paint_error("parse error: %s in '%s'", errmsg, search_phrase);
+      return false;
+   }
+
+   mi_query_clear();
+   mi_query_setraw(search_phrase);
+   for (i = 0; i < argc; i++)
+      mi_query_add_token(argv[i]);
+
+   argv_free(&argc, &argv);
+   return true;
+}
+
 void
 kba_search(KbaArgs a)
 {
-   const char *errmsg = NULL;
    KbaArgs   find_args;
    char  *search_phrase;
+   char  *previous;
    char  *prompt = NULL;
-   char **argv  = NULL;
-   int    argc = 0;
-   int    i;
+   int    ret;
 
    /* determine prompt to use */
    switch (a.direction) {
@@ -825,30 +1072,45 @@ kba_search(KbaArgs a)
          errx(1, "search: invalid direction");
    }
 
-   /* get search phrase from user */
-   if (user_getstr(prompt, &search_phrase) != 0) {
+   /* the last search, to go back to if this one is cancelled */
+   previous = NULL;
+   if (mi_query_getraw() != NULL
+   &&  (previous = strdup(mi_query_getraw())) == NULL)
+      err(1, "kba_search: strdup(3) failed");
+
+   /* get search phrase from user, searching as it's typed */
+   incsearch.dir = a.direction;
+   incsearch.start = ui.active->voffset + ui.active->crow;
+   incsearch.voffset = ui.active->voffset;
+   incsearch.crow = ui.active->crow;
+   incsearch.active = false;
+   ret = user_getstr_live(prompt, &search_phrase, incsearch_changed,
+      incsearch_work);
+
+   incsearch.active = false;
+   incsearch_restore();
+   if (ret != 0) {
+      mi_query_clear();
+      if (previous != NULL)
+         search_set_query(previous, false);
+      free(previous);
+      redraw_active();
       paint_status_bar();
       return;
    }
+   free(previous);
 
    /* set the global query description and the search direction */
-   if (str2argv(search_phrase, &argc, &argv, &errmsg) != 0) {
-      paint_error("parse error: %s in '%s'", errmsg, search_phrase);
+   if (!search_set_query(search_phrase, true)) {
       free(search_phrase);
+      redraw_active();
       return;
    }
 
-   /* setup query */
-   mi_query_clear();
-   mi_query_setraw(search_phrase);
-   for (i = 0; i < argc; i++)
-      mi_query_add_token(argv[i]);
-
    search_dir_set(a.direction);
-   argv_free(&argc, &argv);
    free(search_phrase);
 
-   /* do the search */
+   /* do the search (again, from the start, if it was typed too fast) */
    find_args = get_dummy_args();
    find_args.direction = SAME;
    kba_search_find(find_args);
@@ -857,13 +1119,11 @@ kba_search(KbaArgs a)
 void
 kba_search_find(KbaArgs a)
 {
-   KbaArgs  foo;
-   bool  matches;
    char *msg;
    int   dir = FORWARDS;
    int   start_idx;
    int   idx;
-   int   c;
+   int   c, i;
 
    /* determine direction to do the search */
    switch (a.direction) {
@@ -882,50 +1142,79 @@ kba_search_find(KbaArgs a)
          errx(1, "search_find: invalid direction");
    }
 
-   /* start looking from current row */
    start_idx = ui.active->voffset + ui.active->crow;
    msg = NULL;
-   for (c = 1; c < ui.active->nrows + 1; c++) {
-
-      /* get idx of record */
-      if (dir == FORWARDS)
-         idx = start_idx + c;
-      else
-         idx = start_idx - c;
 
-      /* normalize idx */
-      if (idx < 0) {
-         idx = ui.active->nrows + idx;
-         msg = "search hit TOP, continuing at BOTTOM";
+   if (ui.active == ui.library) {
+      /* start looking from current row */
+      for (c = 1; c < ui.active->nrows + 1; c++) {
+         idx = search_row(start_idx, dir, c);
+         if (search_match(NULL, idx))
+            break;
+      }
+      if (c == ui.active->nrows + 1)
+         goto not_found;
 
-      } else if (idx >= ui.active->nrows) {
-         idx %= ui.active->nrows;
+      if (dir == FORWARDS && start_idx + c >= ui.active->nrows)
          msg = "search hit BOTTOM, continuing at TOP";
-      }
+      else if (dir == BACKWARDS && start_idx - c < 0)
+         msg = "search hit TOP, continuing at BOTTOM";
 
-      /* check if record at idx matches */
-      if (ui.active == ui.library)
-         matches = str_match_query(mdb.playlists[idx]->name);
-      else
-         matches = mi_match(viewing_playlist->files[idx]);
-
-      /* found one, jump to it */
-      if (matches) {
-         if (msg != NULL)
-            paint_message(msg);
-
-         gnum_set(idx + 1);
-         foo = get_dummy_args();
-         foo.scale = NUMBER;
-         foo.num = 'G';
-         kba_jumpto_file(foo);
-         return;
+   } else {
+      /* the next of the matching rows, on either side of the current one */
+      search_matches_find();
+      if (search_matches.nrows == 0)
+         goto not_found;
+
+      if (dir == FORWARDS) {
+         i = search_matches_after(start_idx);
+         if (i == search_matches.nrows) {
+            i = 0;
+            msg = "search hit BOTTOM, continuing at TOP";
+         }
+      } else {
+         i = search_matches_after(start_idx - 1) - 1;
+         if (i < 0) {
+            i = search_matches.nrows - 1;
+            msg = "search hit TOP, continuing at BOTTOM";
+         }
       }
+      idx = search_matches.rows[i];
    }
 
+   /* found one, jump to it */
+   search_jump(idx);
+   if (msg != NULL)
+      paint_message(msg);
+   return;
+
+not_found:
    paint_error("Pattern not found: %s", mi_query_getraw());
 }
 
+bool
+search_position(int *i, int *n)
+{
+   int row;
+
+   if (ui.active == ui.library || search_matches.playlist == NULL
+   ||  !search_matches_current())
+      return false;
+
+   /* only when the cursor is on a match */
+   row = ui.active->voffset + ui.active->crow;
+   *i = search_matches_after(row);
+   *n = search_matches.nrows;
+   return *i > 0 && search_matches.rows[*i - 1] == row;
+}
+
+void
+search_forget(void)
+{
+   free(search_matches.rows);
+   memset(&search_matches, 0, sizeof(search_matches));
+}
+
 
 void
 kba_visual(KbaArgs a UNUSED)
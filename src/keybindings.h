@@ -173,6 +173,23 @@ int  gnum_retrieve();   /* Return current gnum and then clear it. */
 Direction search_dir_get();
 void  search_dir_set(Direction d);
 
+/*
+ * If the cursor is on the i'th of the n rows of the viewing playlist that
+ * match the last search, set i and n and return true.  The matching rows
+ * are only known once n/N (or a search) was used since the playlist or the
+ * query last changed.
+ */
+bool  search_position(int *i, int *n);
+void  search_forget(void);   /* free the matching rows */
+
+/*
+ * While a search phrase is typed, the search runs in slices of at most
+ * INCSEARCH_SLICE_USEC, looking at the time every INCSEARCH_SLICE_ROWS rows,
+ * in between keystrokes.
+ */
+#define INCSEARCH_SLICE_USEC  10000
+#define INCSEARCH_SLICE_ROWS  1024
+
 
 /* This is the copy/cut buffer and the routines used to manipulate it. */
 #define YANK_BUFFER_CHUNK_SIZE 100
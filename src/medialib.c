@@ -19,6 +19,13 @@
 /* The global media library struct */
 medialib mdb;
 
+static void  db_encode(bufio *out, meta_info **files, int nfiles,
+   medialib_dir *dirs, int ndirs, meta_info ***sortedp);
+static int   db_write_image(const char *db_file, const char *data, size_t len);
+static char *db_journal_name(const char *db_file);
+static void  medialib_query_forget(void);
+static int   mi_cmp_fn(const void *ai, const void *bi);
+
 /*
  * Load the global media library from disk. The location of the database file
  * and the directory containing all of the playlists must be specified.
@@ -49,6 +56,46 @@ medialib_load(const char *db_file, const char *playlist_dir)
    if (mdb.library->name == NULL || mdb.filter_results->name == NULL)
       err(1, "failed to strdup pseudo-names in medialib_load");
 
+   mdb.arena = arena_new();
+   mdb.retired = NULL;
+   mdb.nretired = 0;
+   mdb.retired_capacity = 0;
+   mdb.db_map = NULL;
+   mdb.db_map_size = 0;
+   mdb.db_records = NULL;
+   mdb.db_nrecords = 0;
+   mdb.db_heap = NULL;
+   mdb.db_heap_size = 0;
+   mdb.db_all_decoded = true;
+   mdb.nsorts = 0;
+   mdb.journal_map = NULL;
+   mdb.journal_map_size = 0;
+   mdb.journal_records = NULL;
+   mdb.changes = NULL;
+   mdb.nchanges = 0;
+   mdb.changes_capacity = 0;
+   mdb.db_needs_rewrite = false;
+   memset(&mdb.db_load_io, 0, sizeof(db_io_stats));
+   memset(&mdb.db_save_io, 0, sizeof(db_io_stats));
+   mdb.files_index = NULL;
+   mdb.files_index_stale = true;
+   mdb.files_index_shift = 0;
+   mdb.generation = 0;
+   mdb.trigrams = NULL;
+   mdb.trigram_ids = 0;
+   mdb.trigram_next = 0;
+   mdb.trigrams_done = false;
+   mdb.trigram_next = 0;
+   mdb.trigrams_done = false;
+   memset(&mdb.query_set, 0, sizeof(trigram_set));
+   mdb.query_ntokens = 0;
+   mdb.query_fuzzy = false;
+   mdb.dirs = NULL;
+   mdb.ndirs = 0;
+   mdb.dirs_capacity = 0;
+   mdb.dirs_index = strhash_new(0);
+   mdb.strings = strhash_new(0);
+
    /* load the actual database */
    medialib_db_load(db_file);
 
@@ -82,11 +129,77 @@ medialib_load(const char *db_file, const char *playlist_dir)
 void
 medialib_destroy()
 {
-   int i;
-
-   /* free the database */
-   for (i = 0; i < mdb.library->nfiles; i++)
-      mi_free(mdb.library->files[i]);
+   int i, j;
+
+   /*
+    * free the database: the records all live in the arena or mapped files,
+    * but not their folded text (those not in a playlist anymore have none)
+    */
+   for (i = 0; i < mdb.nplaylists; i++) {
+      for (j = 0; j < mdb.playlists[i]->nfiles; j++)
+         mi_unfold(mdb.playlists[i]->files[j]);
+   }
+   for (i = 0; i < mdb.nretired; i++)
+      mi_unfold(mdb.retired[i]);
+   for (i = 0; i < mdb.db_nrecords; i++)
+      mi_unfold(&(mdb.db_records[i]));
+
+   arena_free(mdb.arena);
+   free(mdb.retired);
+   mdb.arena = NULL;
+   mdb.retired = NULL;
+   mdb.nretired = 0;
+   mdb.retired_capacity = 0;
+
+   free(mdb.db_records);
+   if (mdb.db_map != NULL && munmap(mdb.db_map, mdb.db_map_size) == -1)
+      err(1, "medialib_destroy: munmap failed");
+
+   free(mdb.journal_records);
+   if (mdb.journal_map != NULL
+   &&  munmap(mdb.journal_map, mdb.journal_map_size) == -1)
+      err(1, "medialib_destroy: munmap failed");
+
+   free(mdb.changes);
+
+   if (mdb.files_index != NULL)
+      strhash_free(mdb.files_index);
+   mdb.files_index = NULL;
+   mdb.files_index_stale = true;
+
+   if (mdb.trigrams != NULL)
+      trigram_free(mdb.trigrams);
+   trigram_set_free(&mdb.query_set);
+   medialib_query_forget();
+   mdb.trigrams = NULL;
+   mdb.trigram_ids = 0;
+
+   for (i = 0; i < mdb.ndirs; i++)
+      free(mdb.dirs[i].path);
+   free(mdb.dirs);
+   strhash_free(mdb.dirs_index);
+   mdb.dirs = NULL;
+   mdb.ndirs = 0;
+   mdb.dirs_capacity = 0;
+   mdb.dirs_index = NULL;
+
+   strhash_free(mdb.strings);
+   mdb.strings = NULL;
+
+   mdb.db_records = NULL;
+   mdb.db_nrecords = 0;
+   mdb.db_heap = NULL;
+   mdb.db_heap_size = 0;
+   mdb.db_all_decoded = true;
+   mdb.nsorts = 0;
+   mdb.db_map = NULL;
+   mdb.db_map_size = 0;
+   mdb.journal_records = NULL;
+   mdb.journal_map = NULL;
+   mdb.journal_map_size = 0;
+   mdb.changes = NULL;
+   mdb.nchanges = 0;
+   mdb.changes_capacity = 0;
 
    /* free all the playlists */
    for (i = 0; i < mdb.nplaylists; i++)
@@ -102,6 +215,750 @@ medialib_destroy()
    mdb.playlists_capacity = 0;
 }
 
+/* record a change to the library, to be saved by medialib_db_save() */
+static void
+medialib_db_change(int op, meta_info *mi, int dir)
+{
+   db_change *new_changes;
+   size_t     size;
+
+   if (mdb.nchanges == mdb.changes_capacity) {
+      if (mdb.changes_capacity == 0)
+         mdb.changes_capacity = MEDIALIB_CHANGES_CHUNK_SIZE;
+      else
+         mdb.changes_capacity *= 2;
+
+      size = mdb.changes_capacity * sizeof(db_change);
+      if ((new_changes = realloc(mdb.changes, size)) == NULL)
+         err(1, "medialib_db_change: realloc failed");
+
+      mdb.changes = new_changes;
+   }
+
+   mdb.changes[mdb.nchanges].op = op;
+   mdb.changes[mdb.nchanges].mi = mi;
+   mdb.changes[mdb.nchanges].dir = dir;
+   mdb.nchanges++;
+}
+
+/*
+ * Return the one copy of a value of an MI_CINFO_INTERNED field, adding it if
+ * it's new.  The copies live as long as the library, either in its arena or
+ * in the mapped database.
+ */
+const char *
+medialib_intern(const char *s)
+{
+   strhash_entry *e;
+   char          *copy;
+   size_t         len;
+
+   if ((e = strhash_get(mdb.strings, s)) != NULL)
+      return e->key;
+
+   len = strlen(s) + 1;
+   copy = memcpy(arena_alloc(mdb.arena, len), s, len);
+   strhash_set(mdb.strings, copy, 0);
+   return copy;
+}
+
+/* point the MI_CINFO_INTERNED fields of a record at their one copy */
+static void
+medialib_intern_fields(meta_info *mi)
+{
+   int i;
+
+   for (i = 0; i < MI_NUM_CINFO; i++) {
+      if (MI_CINFO_INTERNED[i] && mi->cinfo[i] != NULL)
+         mi->cinfo[i] = (char *) medialib_intern(mi->cinfo[i]);
+   }
+}
+
+/* move a record about to be added to the library into its arena */
+static meta_info *
+medialib_adopt(meta_info *mi)
+{
+   meta_info *copy;
+
+   if (mi->storage != MI_STORAGE_HEAP)
+      return mi;
+
+   medialib_intern_fields(mi);
+   copy = mi_pack(mi, arena_alloc(mdb.arena, mi_size(mi, true)),
+      MI_STORAGE_ARENA, true);
+   mi_free(mi);
+   return copy;
+}
+
+/*
+ * Replace the record 'old' of the library with 'mi', returning the record
+ * that takes its place.  A record never changes once it's in the library,
+ * as other playlists, filter results, the yank buffer, and snapshots being
+ * saved (see writer.h) may all refer to it.  So the old one is retired,
+ * and references to it are moved to the new one later, see
+ * medialib_redirect() and medialib_reclaim().
+ */
+static meta_info *
+medialib_update_record(meta_info *old, meta_info *mi)
+{
+   meta_info **new_retired;
+   size_t      size;
+
+   if (mdb.nretired == mdb.retired_capacity) {
+      mdb.retired_capacity += MEDIALIB_RETIRED_CHUNK_SIZE;
+      size = mdb.retired_capacity * sizeof(meta_info*);
+      if ((new_retired = realloc(mdb.retired, size)) == NULL)
+         err(1, "medialib_update_record: realloc failed");
+
+      mdb.retired = new_retired;
+   }
+
+   old->retired = true;
+   mdb.retired[mdb.nretired++] = old;
+   return medialib_adopt(mi);
+}
+
+/* point a reference to a retired record at its replacement, if possible */
+static void
+medialib_reclaim_ref(meta_info **mip)
+{
+   int idx;
+
+   if (!(*mip)->retired)
+      return;
+
+   /* if the file is gone since, the old record is kept for good */
+   if ((idx = medialib_file_find((*mip)->filename)) == -1)
+      (*mip)->retired = false;
+   else
+      *mip = mdb.library->files[idx];
+}
+
+/*
+ * Point the playlists and unsaved changes that refer to retired records at
+ * their replacements.  The retired records themselves are left as they
+ * are, for anything else that may still refer to them.
+ */
+void
+medialib_redirect(void)
+{
+   playlist *p;
+   bool      changed;
+   int       i, j;
+
+   if (mdb.nretired == 0)
+      return;
+
+   for (i = 0; i < mdb.nplaylists; i++) {
+      p = mdb.playlists[i];
+      changed = false;
+      for (j = 0; j < p->nfiles; j++) {
+         if (p->files[j]->retired) {
+            medialib_reclaim_ref(&(p->files[j]));
+            changed = true;
+         }
+      }
+      if (changed)
+         playlist_changed(p);
+   }
+
+   for (i = 0; i < mdb.nchanges; i++) {
+      if (mdb.changes[i].mi != NULL)
+         medialib_reclaim_ref(&(mdb.changes[i].mi));
+   }
+}
+
+/*
+ * Give the memory of retired records back to the arena, after redirecting
+ * the references to them.  This must only be used when nothing else may
+ * refer to library records, such as the yank buffer of the user interface
+ * or a snapshot being saved, so it's left to the e-commands.
+ */
+void
+medialib_reclaim(void)
+{
+   meta_info *mi;
+   int        i;
+
+   medialib_redirect();
+
+   for (i = 0; i < mdb.nretired; i++) {
+      mi = mdb.retired[i];
+      if (mi->retired && mi->storage == MI_STORAGE_ARENA) {
+         mi_unfold(mi);
+         arena_release(mdb.arena, mi, mi_size(mi, true));
+      }
+   }
+
+   mdb.nretired = 0;
+}
+
+/*
+ * Add a record of the library to its trigram index, under a new id: each
+ * part of the folded text that mi_match() goes through.
+ */
+static void
+medialib_index_add(meta_info *mi)
+{
+   const mi_folded *f;
+   const char      *text;
+   size_t           pos;
+
+   f = mi_folded_get(mi);
+   text = MI_FOLDED_TEXT(f);
+   mi->index_id = ++mdb.trigram_ids;
+   for (pos = 0; pos < f->len; pos += strlen(text + pos) + 1)
+      trigram_add(mdb.trigrams, mi->index_id, text + pos);
+}
+
+/*
+ * Add, replace, and remove files in the library.  Anything that modifies the
+ * library, and saves it with medialib_db_save(), should use these and not the
+ * playlist_* routines directly, so that only the changes need to be saved.
+ */
+void
+medialib_file_add(meta_info *mi)
+{
+   mi = medialib_adopt(mi);
+   playlist_files_append(mdb.library, &mi, 1, false);
+   medialib_db_change(DB_JOURNAL_ADD, mi, -1);
+   mdb.generation++;
+
+   if (!mdb.files_index_stale)
+      strhash_set(mdb.files_index, mi->filename, mdb.library->nfiles - 1);
+   if (mdb.trigrams != NULL)
+      medialib_index_add(mi);
+}
+
+void
+medialib_file_replace(int idx, meta_info *mi)
+{
+   if (!mdb.files_index_stale)
+      strhash_remove(mdb.files_index, mdb.library->files[idx]->filename);
+
+   mi = medialib_update_record(mdb.library->files[idx], mi);
+   playlist_file_replace(mdb.library, idx, mi);
+   medialib_db_change(DB_JOURNAL_REPLACE, mi, -1);
+   mdb.generation++;
+
+   if (!mdb.files_index_stale)
+      strhash_set(mdb.files_index, mi->filename, idx);
+   if (mdb.trigrams != NULL)
+      medialib_index_add(mi);
+}
+
+void
+medialib_file_remove(int idx)
+{
+   meta_info *mi;
+
+   if (idx < 0 || idx >= mdb.library->nfiles)
+      errx(1, "medialib_file_remove: index %d out of range", idx);
+
+   /* the record itself is not free'd, other playlists may refer to it */
+   mi = mdb.library->files[idx];
+   playlist_files_remove(mdb.library, idx, 1, false);
+   medialib_db_change(DB_JOURNAL_REMOVE, mi, -1);
+   mdb.generation++;
+
+   /*
+    * Files after the removed one have moved up one, which lookups correct
+    * for (see medialib_file_find()), until so many have been removed that
+    * a rebuild is cheaper.
+    */
+   if (!mdb.files_index_stale) {
+      strhash_remove(mdb.files_index, mi->filename);
+      if (idx < mdb.library->nfiles
+      &&  ++mdb.files_index_shift > MEDIALIB_FILES_INDEX_MAX_SHIFT)
+         mdb.files_index_stale = true;
+   }
+}
+
+/* forget the tokens the candidates of the last query were narrowed by */
+static void
+medialib_query_forget(void)
+{
+   int i;
+
+   for (i = 0; i < mdb.query_ntokens; i++)
+      free(mdb.query_tokens[i]);
+   mdb.query_ntokens = 0;
+}
+
+/*
+ * Are the candidates of the last query still candidates of q?  They are if
+ * each token they were narrowed by is part of one of q (a longer one,
+ * typically, as a search phrase is typed).  Those narrowed by fuzzy text
+ * are never kept.
+ */
+static bool
+medialib_query_refines(const mi_query_description *q)
+{
+   bool found;
+   int  i, j;
+
+   if (mdb.query_fuzzy)
+      return false;
+
+   for (i = 0; i < mdb.query_ntokens; i++) {
+      found = false;
+      for (j = 0; !found && j < q->ntokens; j++) {
+         if (q->match[j] && q->op[j] == MI_QUERY_CONTAINS
+         &&  strstr(q->folded[j], mdb.query_tokens[i]) != NULL)
+            found = true;
+      }
+      if (!found)
+         return false;
+   }
+
+   return true;
+}
+
+/* narrow the candidates of the last query down by a token of a new one */
+static void
+medialib_query_narrow(const char *token)
+{
+   const char *old;
+   size_t      len;
+   int         i;
+
+   /*
+    * What was narrowed by a token already has all of its trigrams, so if
+    * the new one just adds to it, only the trigrams from its end on are new.
+    */
+   for (i = 0; i < mdb.query_ntokens; i++) {
+      old = mdb.query_tokens[i];
+      len = strlen(old);
+      if (strncmp(token, old, len) == 0) {
+         if (token[len] != '\0')
+            trigram_narrow(mdb.trigrams, token + len - 2, &mdb.query_set);
+         return;
+      }
+   }
+
+   trigram_narrow(mdb.trigrams, token, &mdb.query_set);
+}
+
+/*
+ * The trigram index is only built once a search needs it, so starting
+ * vitunes doesn't have to decode every record (see mi_decode()).  It's
+ * built by passes over the library, adding the records not in it yet, which
+ * can stop after any record and carry on later.  A pass the library changed
+ * during (a sort, or a file removed, may move a record before it) is
+ * followed by another.
+ */
+bool
+medialib_index_work(long usec)
+{
+   struct timeval start, now;
+   meta_info     *mi;
+   int            i;
+
+   if (mdb.trigrams_done)
+      return false;
+
+   if (mdb.trigrams == NULL) {
+      mdb.trigrams = trigram_new();
+      mdb.trigram_next = 0;
+      mdb.trigram_pass = mdb.library->generation;
+   }
+
+   gettimeofday(&start, NULL);
+   for (i = 0; ; i++) {
+      if (mdb.trigram_next >= mdb.library->nfiles) {
+         if (mdb.trigram_pass == mdb.library->generation) {
+            mdb.trigrams_done = true;
+            return false;
+         }
+         mdb.trigram_next = 0;
+         mdb.trigram_pass = mdb.library->generation;
+      }
+
+      mi = mdb.library->files[mdb.trigram_next++];
+      if (mi->index_id == 0)
+         medialib_index_add(mi);
+
+      if (usec > 0 && i % MEDIALIB_INDEX_SLICE == MEDIALIB_INDEX_SLICE - 1) {
+         gettimeofday(&now, NULL);
+         if ((now.tv_sec - start.tv_sec) * 1000000
+            + (now.tv_usec - start.tv_usec) >= usec)
+            return true;
+      }
+   }
+}
+
+const trigram_set *
+medialib_query_candidates(void)
+{
+   const mi_query_description *q;
+   char                       *tokens[MI_MAX_QUERY_TOKENS];
+   bool                        fuzzy;
+   int                         i, ntokens;
+
+   if (!mdb.trigrams_done) {
+      medialib_decode_all();
+      medialib_index_work(0);
+   }
+
+   /*
+    * Records added since the set was made aren't in it, and so may match,
+    * which leaves it good until the query changes.  A new query that
+    * refines the last one starts from its candidates.  Negated tokens,
+    * numbers, and text shorter than a trigram, can't narrow anything down
+    * (the text of a field can, as every field is in the index).  Fuzzy
+    * text narrows them to the records with enough of its trigrams.
+    */
+   q = mi_query_get();
+   if (mdb.query_set.bits == NULL
+   ||  mdb.query_generation != mi_query_generation()) {
+      if (mdb.query_set.bits == NULL || !medialib_query_refines(q)) {
+         trigram_set_free(&mdb.query_set);
+         trigram_set_init(mdb.trigrams, &mdb.query_set);
+         medialib_query_forget();
+      }
+
+      ntokens = 0;
+      fuzzy = false;
+      for (i = 0; i < q->ntokens; i++) {
+         if (q->match[i] && q->op[i] == MI_QUERY_FUZZY
+         &&  trigram_narrow_approx(mdb.trigrams, q->folded[i], q->value[i],
+                                   &mdb.query_set))
+            fuzzy = true;
+
+         if (!q->match[i] || q->op[i] != MI_QUERY_CONTAINS
+         ||  q->folded_len[i] < 3)
+            continue;
+
+         medialib_query_narrow(q->folded[i]);
+         if ((tokens[ntokens++] = strdup(q->folded[i])) == NULL)
+            err(1, "medialib_query_candidates: strdup failed");
+      }
+
+      medialib_query_forget();
+      memcpy(mdb.query_tokens, tokens, ntokens * sizeof(char*));
+      mdb.query_ntokens = ntokens;
+      mdb.query_fuzzy = fuzzy;
+      mdb.query_generation = mi_query_generation();
+   }
+
+   return (mdb.query_ntokens > 0 || mdb.query_fuzzy ? &mdb.query_set : NULL);
+}
+
+/* are two sort descriptions the same? */
+static bool
+medialib_sort_equal(const mi_sort_description *a, const mi_sort_description *b)
+{
+   int i;
+
+   if (a->nfields != b->nfields)
+      return false;
+
+   for (i = 0; i < a->nfields; i++) {
+      if (a->order[i] != b->order[i] || a->descending[i] != b->descending[i])
+         return false;
+   }
+
+   return true;
+}
+
+/* compare two records as the sorted orders of the database do */
+static int
+medialib_sort_cmp(const meta_info *a, const meta_info *b,
+   const mi_sort_description *d)
+{
+   int ret;
+
+   /* equal ones are in the order of the records, by filename */
+   if ((ret = mi_compare_desc(a, b, d)) != 0)
+      return ret;
+
+   return strcmp(a->filename, b->filename);
+}
+
+/*
+ * Put the library in a sorted order kept in the database, returning false
+ * (leaving it untouched) if the order isn't a permutation of its records.
+ * The records of the database still in the library are taken in that
+ * order, and any others (added or replaced since it was written) are
+ * sorted by themselves and merged in, each found by a binary search, so
+ * only those and the records they're compared to need decoding.
+ */
+static bool
+medialib_sort_apply(const uint32_t *perm, const mi_sort_description *d)
+{
+   meta_info **kept, **others, **files, *mi;
+   uint8_t    *seen;
+   uint32_t    i, n;
+   int         nkept, nothers, lo, hi, mid, pos, j;
+
+   n = mdb.db_nrecords;
+   if ((seen = calloc(n / 8 + 1, sizeof(uint8_t))) == NULL)
+      err(1, "medialib_sort_apply: calloc failed");
+
+   for (i = 0; i < n; i++) {
+      if (perm[i] >= n || (seen[perm[i] / 8] & (1 << (perm[i] % 8))))
+         break;
+      seen[perm[i] / 8] |= 1 << (perm[i] % 8);
+   }
+   if (i < n) {
+      free(seen);
+      return false;
+   }
+
+   /* tell the records of the database in the library from the others */
+   files = mdb.library->files;
+   kept = calloc(n + 1, sizeof(meta_info*));
+   others = calloc(mdb.library->nfiles + 1, sizeof(meta_info*));
+   if (kept == NULL || others == NULL)
+      err(1, "medialib_sort_apply: calloc failed");
+
+   memset(seen, 0, n / 8 + 1);
+   nothers = 0;
+   for (j = 0; j < mdb.library->nfiles; j++) {
+      mi = files[j];
+      if (mi >= mdb.db_records && mi < mdb.db_records + n) {
+         i = mi - mdb.db_records;
+         seen[i / 8] |= 1 << (i % 8);
+      } else {
+         mi_decode(mi);
+         others[nothers++] = mi;
+      }
+   }
+
+   nkept = 0;
+   for (i = 0; i < n; i++) {
+      if (seen[perm[i] / 8] & (1 << (perm[i] % 8)))
+         kept[nkept++] = &(mdb.db_records[perm[i]]);
+   }
+   free(seen);
+
+   qsort(others, nothers, sizeof(meta_info*), mi_cmp_fn);
+   mi_sort_files(others, nothers, d);
+
+   /* each of the others goes after the last record that sorts before it */
+   pos = 0;
+   for (j = 0; j < nothers; j++) {
+      lo = pos;
+      hi = nkept;
+      while (lo < hi) {
+         mid = lo + (hi - lo) / 2;
+         if (medialib_sort_cmp(kept[mid], others[j], d) < 0)
+            lo = mid + 1;
+         else
+            hi = mid;
+      }
+
+      memcpy(files, kept + pos, (lo - pos) * sizeof(meta_info*));
+      files += lo - pos;
+      pos = lo;
+      *files++ = others[j];
+   }
+   memcpy(files, kept + pos, (nkept - pos) * sizeof(meta_info*));
+
+   free(others);
+   free(kept);
+   return true;
+}
+
+/*
+ * Sorting the library is the bulk of starting vitunes, and is redone every
+ * time, so the database keeps the sorted orders of the sort
+ * descriptions used on the library (see db_sort_encode()).  One of those is
+ * applied, with whatever the journal changed since merged in (see
+ * medialib_sort_apply()).  Otherwise the library is sorted, and its
+ * description is marked stale until the database is next written in full.
+ */
+void
+medialib_sort_library(void)
+{
+   medialib_sort sort;
+   int           i;
+
+   playlist_changed(mdb.library);
+   mi_sort_get(&sort.desc);
+   sort.perm = NULL;
+   for (i = 0; i < mdb.nsorts; i++) {
+      if (medialib_sort_equal(&mdb.sorts[i].desc, &sort.desc)) {
+         sort.perm = mdb.sorts[i].perm;
+         break;
+      }
+   }
+
+   /* the most recently used goes first, dropping the least when full */
+   if (i == mdb.nsorts && mdb.nsorts < MEDIALIB_MAX_SORTS)
+      mdb.nsorts++;
+   if (i == MEDIALIB_MAX_SORTS)
+      i--;
+   memmove(&mdb.sorts[1], &mdb.sorts[0], i * sizeof(medialib_sort));
+   mdb.sorts[0] = sort;
+
+   if (sort.perm != NULL && medialib_sort_apply(sort.perm, &sort.desc))
+      return;
+
+   mdb.sorts[0].perm = NULL;
+   medialib_decode_all();
+   mi_sort_files(mdb.library->files, mdb.library->nfiles, &sort.desc);
+}
+
+bool
+medialib_sorts_stale(void)
+{
+   int i;
+
+   for (i = 0; i < mdb.nsorts; i++) {
+      if (mdb.sorts[i].perm == NULL)
+         return true;
+   }
+
+   return false;
+}
+
+/* (re)build the filename index of the library */
+static void
+medialib_files_index_build(void)
+{
+   int i;
+
+   if (mdb.files_index == NULL)
+      mdb.files_index = strhash_new(mdb.library->nfiles);
+   else
+      strhash_clear(mdb.files_index);
+
+   for (i = 0; i < mdb.library->nfiles; i++)
+      strhash_set(mdb.files_index, mdb.library->files[i]->filename, i);
+
+   mdb.files_index_stale = false;
+   mdb.files_index_shift = 0;
+}
+
+int
+medialib_file_find(const char *filename)
+{
+   strhash_entry *e;
+   int            idx, i;
+
+   if (mdb.files_index_stale)
+      medialib_files_index_build();
+
+   if ((e = strhash_get(mdb.files_index, filename)) == NULL)
+      return -1;
+
+   /*
+    * The file may have moved up since, as files before it were removed,
+    * and the library may even have been reordered behind our back.
+    */
+   idx = e->value;
+   i = (idx < mdb.library->nfiles ? idx : mdb.library->nfiles - 1);
+   for (; i >= 0 && i >= idx - mdb.files_index_shift; i--) {
+      if (mdb.library->files[i]->filename == e->key) {
+         e->value = i;
+         return i;
+      }
+   }
+
+   medialib_files_index_build();
+   if ((e = strhash_get(mdb.files_index, filename)) == NULL)
+      return -1;
+
+   return e->value;
+}
+
+/* index of a directory in mdb.dirs by its realpath(3), or -1 */
+static int
+medialib_dir_find(const char *path)
+{
+   strhash_entry *e;
+
+   if ((e = strhash_get(mdb.dirs_index, path)) == NULL)
+      return -1;
+
+   return e->value;
+}
+
+/* index of a directory in mdb.dirs, adding it (to be walked) if not there */
+static int
+medialib_dir_get(const char *path)
+{
+   medialib_dir *new_dirs;
+   size_t        size;
+   int           d;
+
+   if ((d = medialib_dir_find(path)) != -1)
+      return d;
+
+   if (mdb.ndirs == mdb.dirs_capacity) {
+      if (mdb.dirs_capacity == 0)
+         mdb.dirs_capacity = MEDIALIB_DIRS_CHUNK_SIZE;
+      else
+         mdb.dirs_capacity *= 2;
+
+      size = mdb.dirs_capacity * sizeof(medialib_dir);
+      if ((new_dirs = realloc(mdb.dirs, size)) == NULL)
+         err(1, "medialib_dir_get: realloc failed");
+
+      mdb.dirs = new_dirs;
+   }
+
+   d = mdb.ndirs++;
+   if ((mdb.dirs[d].path = strdup(path)) == NULL)
+      err(1, "medialib_dir_get: strdup failed");
+   mdb.dirs[d].mtime    = 0;
+   mdb.dirs[d].nentries = 0;
+   mdb.dirs[d].parent   = -1;
+   mdb.dirs[d].child    = -1;
+   mdb.dirs[d].sibling  = -1;
+
+   strhash_set(mdb.dirs_index, mdb.dirs[d].path, d);
+   return d;
+}
+
+/* move a directory under a new parent (or none, if parent is -1) */
+static void
+medialib_dir_link(int d, int parent)
+{
+   int *c;
+
+   if (mdb.dirs[d].parent == parent)
+      return;
+
+   if (mdb.dirs[d].parent != -1) {
+      c = &(mdb.dirs[mdb.dirs[d].parent].child);
+      while (*c != d)
+         c = &(mdb.dirs[*c].sibling);
+      *c = mdb.dirs[d].sibling;
+   }
+
+   mdb.dirs[d].parent = parent;
+   mdb.dirs[d].sibling = -1;
+   if (parent != -1) {
+      mdb.dirs[d].sibling = mdb.dirs[parent].child;
+      mdb.dirs[parent].child = d;
+   }
+}
+
+/*
+ * Record what a directory looked like when it was walked, recording the
+ * change for the journal if anything differs.  A parent of -1 keeps the
+ * current one, and an mtime of -1 forgets the directory.
+ */
+static void
+medialib_dir_update(int d, int parent, time_t mtime, int nentries)
+{
+   if (mtime == -1)
+      parent = -1;
+   else if (parent == -1)
+      parent = mdb.dirs[d].parent;
+
+   if (mdb.dirs[d].parent == parent && mdb.dirs[d].mtime == mtime
+   &&  mdb.dirs[d].nentries == nentries)
+      return;
+
+   medialib_dir_link(d, parent);
+   mdb.dirs[d].mtime = mtime;
+   mdb.dirs[d].nentries = nentries;
+   medialib_db_change(DB_JOURNAL_DIR, NULL, d);
+}
+
 /* add a new playlist to the media library */
 void
 medialib_playlist_add(playlist *p)
@@ -139,91 +996,1104 @@ medialib_playlist_remove(int pindex)
    for (i = pindex + 1; i < mdb.nplaylists; i++)
       mdb.playlists[i - 1] = mdb.playlists[i];
 
-   mdb.nplaylists--;
+   mdb.nplaylists--;
+}
+
+/*
+ * create the vitunes directory, database file (initially empty, and
+ * playlists directory.
+ */
+void
+medialib_setup_files(const char *vitunes_dir, const char *db_file,
+   const char *playlist_dir)
+{
+   struct stat sb;
+   bufio       out;
+
+   /* create vitunes directory */
+   if (mkdir(vitunes_dir, S_IRWXU) == -1) {
+      if (errno == EEXIST)
+         warnx("vitunes directory '%s' already exists (OK)", vitunes_dir);
+      else
+         err(1, "unable to create vitunes directory '%s'", vitunes_dir);
+   } else
+      warnx("vitunes directory '%s' created", vitunes_dir);
+
+   /* create playlists directory */
+   if (mkdir(playlist_dir, S_IRWXU) == -1) {
+      if (errno == EEXIST)
+         warnx("playlists directory '%s' already exists (OK)", playlist_dir);
+      else
+         err(1, "unable to create playlists directory '%s'", playlist_dir);
+   } else
+      warnx("playlists directory '%s' created", playlist_dir);
+
+   /* create database file (and drop the journal of any previous one) */
+   if (stat(db_file, &sb) < 0) {
+      if (errno == ENOENT) { 
+         char *journal_file = db_journal_name(db_file);
+         if (unlink(journal_file) == -1 && errno != ENOENT)
+            err(1, "unable to remove stale journal '%s'", journal_file);
+         free(journal_file);
+
+         bufio_init(&out, -1, BUFIO_SIZE);
+         db_encode(&out, NULL, 0, NULL, 0, NULL);
+         if (db_write_image(db_file, out.buf, out.len) == -1)
+            err(1, "failed to create database file '%s'", db_file);
+         bufio_free(&out);
+         warnx("empty database at '%s' created", db_file);
+      } else
+         err(1, "database file '%s' exists, but cannot access it", db_file);
+   } else
+      warnx("database file '%s' already exists (OK)", db_file);
+}
+
+/* used to sort media db by filenames. */
+static int mi_cmp_fn(const void *ai, const void *bi)
+{
+   const meta_info **a2 = (const meta_info **) ai;
+   const meta_info **b2 = (const meta_info **) bi;
+   const meta_info *a = (const meta_info *) *a2;
+   const meta_info *b = (const meta_info *) *b2;
+
+   return strcmp(a->filename, b->filename);
+}
+
+/* seconds elapsed since start, to report the throughput of loads/saves */
+static double
+db_seconds_since(const struct timeval *start)
+{
+   struct timeval now;
+
+   gettimeofday(&now, NULL);
+   return (now.tv_sec - start->tv_sec)
+        + (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+/* round a payload size in the database/journal up to a multiple of 8 */
+#define DB_ALIGN(n)  (((n) + 7) & ~((size_t) 7))
+
+/* write the "vitunes" header & version, padded up to DB_HEADER_OFFSET */
+static void
+db_write_version(bufio *out)
+{
+   int version[3] = {DB_VERSION_MAJOR, DB_VERSION_MINOR, DB_VERSION_OTHER};
+
+   bufio_write(out, "vitunes", strlen("vitunes"));
+   bufio_write(out, version, sizeof(version));
+   bufio_zero(out, DB_HEADER_OFFSET - strlen("vitunes") - sizeof(version));
+}
+
+/* the interned strings of a database being written, see db_record_encode() */
+typedef struct {
+   strhash    *index;     /* string -> position in offsets */
+   uint32_t   *offsets;   /* heap offset of each string */
+   int         n;
+   int         capacity;
+} db_dict;
+
+/*
+ * Encode a meta_info as a db_record, where its strings are placed in a
+ * string heap starting at offset *heap_pos (which is advanced past them).
+ * Empty strings are stored as NULL, as they always have been.  If a dict is
+ * given, the MI_CINFO_INTERNED fields are looked up in it, and share the
+ * offset of an equal string placed earlier.
+ */
+static void
+db_record_encode(const meta_info *mi, db_record *rec, uint64_t *heap_pos,
+   db_dict *dict)
+{
+   strhash_entry *e;
+   uint32_t      *new_offsets;
+   int            i;
+
+   mi_decode(mi);
+   memset(rec, 0, sizeof(db_record));
+   rec->filename = *heap_pos;
+   *heap_pos += strlen(mi->filename) + 1;
+   for (i = 0; i < MI_NUM_CINFO; i++) {
+      if (mi->cinfo[i] == NULL || mi->cinfo[i][0] == '\0')
+         continue;
+
+      if (dict != NULL && MI_CINFO_INTERNED[i]) {
+         if ((e = strhash_get(dict->index, mi->cinfo[i])) != NULL) {
+            rec->cinfo[i] = dict->offsets[e->value];
+            continue;
+         }
+
+         if (dict->n == dict->capacity) {
+            dict->capacity = (dict->capacity == 0 ? 256 : dict->capacity * 2);
+            new_offsets = realloc(dict->offsets,
+               dict->capacity * sizeof(uint32_t));
+            if (new_offsets == NULL)
+               err(1, "db_record_encode: realloc failed");
+            dict->offsets = new_offsets;
+         }
+         dict->offsets[dict->n] = *heap_pos;
+         strhash_set(dict->index, mi->cinfo[i], dict->n++);
+      }
+
+      rec->cinfo[i] = *heap_pos;
+      *heap_pos += strlen(mi->cinfo[i]) + 1;
+   }
+   rec->length       = mi->length;
+   rec->last_updated = mi->last_updated;
+   rec->is_url       = mi->is_url;
+}
+
+/*
+ * Write the strings of a meta_info in the order db_record_encode() placed
+ * them, skipping those that share the offset of one written earlier.
+ */
+static void
+db_record_write_strings(const meta_info *mi, const db_record *rec,
+   uint64_t *heap_pos, bufio *out)
+{
+   size_t len;
+   int    i;
+
+   len = strlen(mi->filename) + 1;
+   bufio_write(out, mi->filename, len);
+   *heap_pos += len;
+   for (i = 0; i < MI_NUM_CINFO; i++) {
+      if (rec->cinfo[i] == 0 || rec->cinfo[i] != *heap_pos)
+         continue;
+
+      len = strlen(mi->cinfo[i]) + 1;
+      bufio_write(out, mi->cinfo[i], len);
+      *heap_pos += len;
+   }
+}
+
+/* return the string at the given offset in the heap of a mapped file */
+static char *
+db_heap_str(const char *file, char *heap, uint64_t heap_size, uint32_t off)
+{
+   if (off >= heap_size)
+      errx(1, "Database file '%s' is corrupt (bad string offset)", file);
+
+   return (off == 0 ? NULL : heap + off);
+}
+
+/*
+ * Point a meta_info at the fields of a db_record in a mapped file.  If lazy
+ * is set, the cinfo is left pending, to be decoded by db_record_decode_cinfo()
+ * from the mapped database.
+ */
+static void
+db_record_decode(const char *file, const db_record *rec, char *heap,
+   uint64_t heap_size, meta_info *mi, bool lazy)
+{
+   int i;
+
+   mi->filename = db_heap_str(file, heap, heap_size, rec->filename);
+   if (mi->filename == NULL)
+      errx(1, "Database file '%s' is corrupt (no filename)", file);
+
+   mi->pending = NULL;
+   if (lazy)
+      mi->pending = rec;
+   else {
+      for (i = 0; i < MI_NUM_CINFO; i++)
+         mi->cinfo[i] = db_heap_str(file, heap, heap_size, rec->cinfo[i]);
+   }
+
+   mi->length       = rec->length;
+   mi->last_updated = rec->last_updated;
+   mi->is_url       = rec->is_url;
+   mi->retired      = false;
+   mi->storage      = MI_STORAGE_DB;
+}
+
+/* the mi_decoder of records of the mapped database, see mi_decode() */
+static void
+db_record_decode_cinfo(meta_info *mi)
+{
+   const db_record *rec;
+   int              i;
+
+   rec = (const db_record *) mi->pending;
+   for (i = 0; i < MI_NUM_CINFO; i++)
+      mi->cinfo[i] = db_heap_str(mdb.db_file, mdb.db_heap, mdb.db_heap_size,
+         rec->cinfo[i]);
+   mi->pending = NULL;
+}
+
+/* decode the records [start, end) of the mapped database */
+typedef struct {
+   int start;
+   int end;
+} decode_range;
+
+static void *
+medialib_decode_range(void *arg)
+{
+   decode_range *range = (decode_range *) arg;
+   int           i;
+
+   for (i = range->start; i < range->end; i++)
+      mi_decode(&(mdb.db_records[i]));
+
+   return NULL;
+}
+
+void
+medialib_decode_all(void)
+{
+   decode_range  ranges[MEDIALIB_MAX_JOBS];
+   pthread_t     threads[MEDIALIB_MAX_JOBS];
+   int           n, njobs;
+
+   if (mdb.db_all_decoded)
+      return;
+
+   njobs = nthreads_for(mdb.db_nrecords, MEDIALIB_DECODE_BATCH,
+      MEDIALIB_MAX_JOBS);
+
+   for (n = 0; n < njobs; n++) {
+      ranges[n].start = (int) ((long long) mdb.db_nrecords * n / njobs);
+      ranges[n].end = (int) ((long long) mdb.db_nrecords * (n + 1) / njobs);
+   }
+
+   /* the calling thread takes the first range itself */
+   for (n = 1; n < njobs; n++) {
+      if ((errno = pthread_create(&threads[n], NULL, medialib_decode_range,
+                                  &ranges[n])) != 0)
+         err(1, "medialib_decode_all: pthread_create failed");
+   }
+   medialib_decode_range(&ranges[0]);
+   for (n = 1; n < njobs; n++)
+      pthread_join(threads[n], NULL);
+
+   mdb.db_all_decoded = true;
+}
+
+/*
+ * Write a database/journal image to an open file, sync, and close it,
+ * returning -1 (with errno set) on failure.  If header is set, the
+ * "vitunes" header & version are written first.
+ */
+static int
+db_write_data(int fd, bool header, const char *data, size_t len)
+{
+   bufio out;
+   int   ret, saved_errno;
+
+   bufio_init(&out, fd, BUFIO_SIZE);
+   if (header)
+      db_write_version(&out);
+   bufio_write(&out, data, len);
+
+   ret = 0;
+   if (bufio_flush(&out) == -1 || fsync(fd) == -1)
+      ret = -1;
+
+   saved_errno = errno;
+   if (close(fd) == -1)
+      ret = -1;
+   else
+      errno = saved_errno;
+
+   bufio_free(&out);
+   return ret;
+}
+
+/*
+ * Encode a complete DB_VERSION 3 database containing the given files and
+ * directories (the "vitunes" header & version excluded), without its sorted
+ * orders (see db_sort_encode()).  If sortedp is given, the (allocated) array
+ * of the files in the order they're stored is returned through it.
+ */
+static void
+db_encode(bufio *out, meta_info **files, int nfiles, medialib_dir *dirs,
+   int ndirs, meta_info ***sortedp)
+{
+   meta_info    **sorted;
+   db_header      hdr;
+   db_record     *recs;
+   db_dir_record  dir_rec;
+   db_dict        dict;
+   uint32_t      *dir_idx;
+   uint64_t       heap_pos, dirs_heap_pos;
+   uint32_t       nkept;
+   size_t         dict_size;
+   int            i;
+
+   /* records are stored sorted by filename, so loading needs no sort */
+   sorted = calloc(nfiles + 1, sizeof(meta_info*));
+   recs = calloc(nfiles + 1, sizeof(db_record));
+   if (sorted == NULL || recs == NULL)
+      err(1, "db_encode: failed to allocate sorted records");
+
+   for (i = 0; i < nfiles; i++)
+      sorted[i] = files[i];
+   qsort(sorted, nfiles, sizeof(meta_info*), mi_cmp_fn);
+
+   /* forgotten directories are dropped, so number the ones that are kept */
+   if ((dir_idx = calloc(ndirs + 1, sizeof(uint32_t))) == NULL)
+      err(1, "db_encode: failed to allocate directories");
+
+   nkept = 0;
+   for (i = 0; i < ndirs; i++)
+      dir_idx[i] = (dirs[i].mtime == -1 ? DB_DIR_NO_PARENT : nkept++);
+
+   /* place all strings in the heap, the interned ones only once */
+   memset(&dict, 0, sizeof(dict));
+   dict.index = strhash_new(0);
+
+   heap_pos = 1;
+   for (i = 0; i < nfiles; i++)
+      db_record_encode(sorted[i], &recs[i], &heap_pos, &dict);
+   dirs_heap_pos = heap_pos;
+   for (i = 0; i < ndirs; i++) {
+      if (dirs[i].mtime != -1)
+         heap_pos += strlen(dirs[i].path) + 1;
+   }
+   if (heap_pos > UINT32_MAX)
+      errx(1, "db_encode: database too large");
+
+   /* build header */
+   dict_size = DB_ALIGN(dict.n * sizeof(uint32_t));
+   memset(&hdr, 0, sizeof(hdr));
+   hdr.nrecords        = nfiles;
+   hdr.sort_record_size = sizeof(db_sort_record);
+   hdr.record_size     = sizeof(db_record);
+   hdr.records_offset  = DB_HEADER_OFFSET + sizeof(db_header);
+   hdr.ndirs           = nkept;
+   hdr.dir_record_size = sizeof(db_dir_record);
+   hdr.dirs_offset     = hdr.records_offset + nfiles * sizeof(db_record);
+   hdr.ndict           = dict.n;
+   hdr.dict_offset     = hdr.dirs_offset + nkept * sizeof(db_dir_record);
+   hdr.heap_offset     = hdr.dict_offset + dict_size;
+   hdr.heap_size       = heap_pos;
+
+   /* save header */
+   bufio_write(out, &hdr, sizeof(hdr));
+
+   /* save record table */
+   bufio_write(out, recs, nfiles * sizeof(db_record));
+
+   /* save directory table, whose paths follow the records' in the heap */
+   heap_pos = dirs_heap_pos;
+   for (i = 0; i < ndirs; i++) {
+      if (dirs[i].mtime == -1)
+         continue;
+
+      memset(&dir_rec, 0, sizeof(dir_rec));
+      dir_rec.path     = heap_pos;
+      dir_rec.parent   = (dirs[i].parent == -1 ? DB_DIR_NO_PARENT
+                                               : dir_idx[dirs[i].parent]);
+      dir_rec.nentries = dirs[i].nentries;
+      dir_rec.mtime    = dirs[i].mtime;
+      bufio_write(out, &dir_rec, sizeof(dir_rec));
+      heap_pos += strlen(dirs[i].path) + 1;
+   }
+
+   /* save dictionary */
+   bufio_write(out, dict.offsets, dict.n * sizeof(uint32_t));
+   bufio_zero(out, dict_size - dict.n * sizeof(uint32_t));
+
+   /* save string heap, in the same order as the offsets above */
+   bufio_zero(out, 1);
+   heap_pos = 1;
+   for (i = 0; i < nfiles; i++)
+      db_record_write_strings(sorted[i], &recs[i], &heap_pos, out);
+   for (i = 0; i < ndirs; i++) {
+      if (dirs[i].mtime != -1)
+         bufio_write(out, dirs[i].path, strlen(dirs[i].path) + 1);
+   }
+
+   strhash_free(dict.index);
+   free(dict.offsets);
+   free(dir_idx);
+   free(recs);
+   if (sortedp != NULL)
+      *sortedp = sorted;
+   else
+      free(sorted);
+}
+
+/*
+ * The stamp of the sorted orders of a database, which changes with the
+ * order mi_compare() sorts in (and, as a sanity check, with the size of the
+ * database).
+ */
+static uint64_t
+db_sort_stamp(const db_header *hdr)
+{
+   uint64_t values[3];
+   uint64_t stamp;
+   size_t   i;
+
+   values[0] = MI_SORT_VERSION;
+   values[1] = hdr->nrecords;
+   values[2] = hdr->heap_size;
+
+   /* FNV-1a */
+   stamp = 14695981039346656037ULL;
+   for (i = 0; i < sizeof(values); i++) {
+      stamp ^= ((const unsigned char *) values)[i];
+      stamp *= 1099511628211ULL;
+   }
+
+   return stamp;
+}
+
+/*
+ * Add the sorted orders of the sort descriptions of a snapshot to the
+ * database image in it, sorting its files (in the order they're stored) by
+ * each.  This happens as the snapshot is written, off the main thread, so
+ * the records must all be decoded already.  Those files were taken along
+ * with the image, and records aren't changed in place once in the library,
+ * so the orders match the image even if the library has changed since.
+ */
+static void
+db_sort_encode(db_snapshot *snap)
+{
+   db_sort_record  rec;
+   db_header       hdr;
+   bufio           out;
+   uint32_t       *perm;
+   uint64_t        offset;
+   size_t          perm_size;
+   int             i, j, n;
+
+   memcpy(&hdr, snap->data, sizeof(hdr));
+   n = snap->nfiles;
+   perm_size = DB_ALIGN(n * sizeof(uint32_t));
+   if ((perm = calloc(n + 1, sizeof(uint32_t))) == NULL)
+      err(1, "db_sort_encode: calloc failed");
+
+   /* the table and orders follow the heap, after padding it */
+   bufio_init(&out, -1, BUFIO_SIZE);
+   bufio_write(&out, snap->data, snap->len);
+   bufio_zero(&out, DB_ALIGN(snap->len) - snap->len);
+
+   hdr.nsorts = snap->nsorts;
+   hdr.sorts_offset = DB_HEADER_OFFSET + out.len;
+   offset = hdr.sorts_offset + snap->nsorts * sizeof(db_sort_record);
+   for (i = 0; i < snap->nsorts; i++) {
+      memset(&rec, 0, sizeof(rec));
+      rec.stamp       = db_sort_stamp(&hdr);
+      rec.nfields     = snap->sorts[i].nfields;
+      rec.perm_offset = offset + i * perm_size;
+      for (j = 0; j < (int) rec.nfields; j++) {
+         rec.order[j] = snap->sorts[i].order[j];
+         rec.descending[j] = snap->sorts[i].descending[j];
+      }
+      bufio_write(&out, &rec, sizeof(rec));
+   }
+
+   for (i = 0; i < snap->nsorts; i++) {
+      mi_sort_perm(snap->files, n, &(snap->sorts[i]), perm);
+      bufio_write(&out, perm, n * sizeof(uint32_t));
+      bufio_zero(&out, perm_size - n * sizeof(uint32_t));
+   }
+
+   memcpy(out.buf, &hdr, sizeof(hdr));
+   free(snap->data);
+   snap->data = out.buf;
+   snap->len = out.len;
+   free(perm);
+}
+
+/*
+ * Write a complete database image (see db_encode()) to a temporary file that
+ * is then rename(2)'d over the existing database, so a database that is
+ * currently mmap(2)'d is never touched.  The journal of the database is
+ * removed after.  Returns -1 (with errno set) on failure.
+ */
+static int
+db_write_image(const char *db_file, const char *data, size_t len)
+{
+   char *tmp_file, *journal_file;
+   int   fd, ret;
+
+   if (asprintf(&tmp_file, "%s.XXXXXX", db_file) == -1)
+      err(1, "db_write_image: asprintf failed");
+
+   ret = -1;
+   if ((fd = mkstemp(tmp_file)) != -1) {
+      if (db_write_data(fd, true, data, len) == 0
+      &&  rename(tmp_file, db_file) == 0)
+         ret = 0;
+      else
+         unlink(tmp_file);
+   }
+   free(tmp_file);
+
+   if (ret == 0) {
+      journal_file = db_journal_name(db_file);
+      if (unlink(journal_file) == -1 && errno != ENOENT)
+         ret = -1;
+      free(journal_file);
+   }
+
+   return ret;
+}
+
+/* mmap(2) an entire database/journal file, returning its size in *size */
+static char *
+db_map_file(const char *file, int fd, size_t *size)
+{
+   struct stat sb;
+   char       *map;
+
+   if (fstat(fd, &sb) == -1)
+      err(1, "Failed to stat database file '%s'", file);
+
+   if ((size_t) sb.st_size < DB_HEADER_OFFSET)
+      errx(1, "Database file '%s' is corrupt (truncated)", file);
+
+   /* private & writable, so str_sanitize() and friends still work */
+   map = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+   if (map == MAP_FAILED)
+      err(1, "Failed to mmap database file '%s'", file);
+
+   *size = sb.st_size;
+   return map;
+}
+
+/* load the directory table of a mapped DB_VERSION 3.1 database */
+static void
+db_load_dirs(const char *db_file, const db_header *hdr)
+{
+   db_dir_record *rec;
+   char          *map, *path;
+   uint32_t       i;
+
+   map = mdb.db_map;
+   rec = (db_dir_record *) (map + hdr->dirs_offset);
+   for (i = 0; i < hdr->ndirs; i++) {
+      path = db_heap_str(db_file, map + hdr->heap_offset, hdr->heap_size,
+         rec[i].path);
+      if (path == NULL || medialib_dir_get(path) != (int) i)
+         errx(1, "Database file '%s' is corrupt (bad directory)", db_file);
+
+      mdb.dirs[i].mtime    = rec[i].mtime;
+      mdb.dirs[i].nentries = rec[i].nentries;
+   }
+
+   for (i = 0; i < hdr->ndirs; i++) {
+      if (rec[i].parent == DB_DIR_NO_PARENT)
+         continue;
+      if (rec[i].parent >= hdr->ndirs)
+         errx(1, "Database file '%s' is corrupt (bad directory)", db_file);
+      medialib_dir_link(i, rec[i].parent);
+   }
+}
+
+/* intern the strings in the dictionary of a mapped DB_VERSION 3.2 database */
+static void
+db_load_dict(const char *db_file, const db_header *hdr)
+{
+   uint32_t *offsets;
+   char     *map, *str;
+   uint32_t  i;
+
+   map = mdb.db_map;
+   offsets = (uint32_t *) (map + hdr->dict_offset);
+   for (i = 0; i < hdr->ndict; i++) {
+      str = db_heap_str(db_file, map + hdr->heap_offset, hdr->heap_size,
+         offsets[i]);
+      if (str == NULL)
+         errx(1, "Database file '%s' is corrupt (bad dictionary)", db_file);
+
+      strhash_set(mdb.strings, str, 0);
+   }
+}
+
+/*
+ * Remember the sort descriptions of a mapped DB_VERSION 3.3 database, with
+ * their sorted orders if those are still of use (see
+ * medialib_sort_library()).
+ */
+static void
+db_load_sorts(const char *db_file, const db_header *hdr)
+{
+   db_sort_record *rec;
+   medialib_sort  *sort;
+   char           *map;
+   uint32_t        i, j;
+
+   map = mdb.db_map;
+   rec = (db_sort_record *) (map + hdr->sorts_offset);
+   for (i = 0; i < hdr->nsorts && mdb.nsorts < MEDIALIB_MAX_SORTS; i++) {
+      if (rec[i].nfields > MI_NUM_CINFO
+      ||  rec[i].perm_offset % sizeof(uint32_t) != 0
+      ||  rec[i].perm_offset + (uint64_t) hdr->nrecords * sizeof(uint32_t)
+                             > mdb.db_map_size)
+         errx(1, "Database file '%s' is corrupt (bad sort)", db_file);
+
+      sort = &(mdb.sorts[mdb.nsorts++]);
+      sort->desc.nfields = rec[i].nfields;
+      for (j = 0; j < rec[i].nfields; j++) {
+         if (rec[i].order[j] >= MI_NUM_CINFO)
+            errx(1, "Database file '%s' is corrupt (bad sort)", db_file);
+
+         sort->desc.order[j] = rec[i].order[j];
+         sort->desc.descending[j] = rec[i].descending[j];
+      }
+
+      sort->perm = NULL;
+      if (rec[i].stamp == db_sort_stamp(hdr))
+         sort->perm = (uint32_t *) (map + rec[i].perm_offset);
+   }
+}
+
+/*
+ * Load a DB_VERSION 3 database by mmap(2)'ing it and pointing each record
+ * of the library straight into the mapping.  Apart from the array holding
+ * all of the records, and the library's files array, nothing is allocated.
+ * The records are stored sorted by filename, so no sort is needed either.
+ * Older version 3 databases lack some of the tables, and are re-written in
+ * the current format the next time they're saved.
+ */
+static void
+db_load_mapped(const char *db_file, int fd, int minor)
+{
+   db_header   hdr;
+   db_record  *rec;
+   meta_info **files;
+   char       *map;
+   size_t      hdr_size;
+   uint32_t    i;
+
+   map = db_map_file(db_file, fd, &mdb.db_map_size);
+   mdb.db_map = map;
+
+   hdr_size = sizeof(db_header);
+   if (minor == 0)
+      hdr_size = offsetof(db_header, ndirs);
+   else if (minor == 1)
+      hdr_size = offsetof(db_header, ndict);
+   else if (minor == 2)
+      hdr_size = offsetof(db_header, nsorts);
+
+   if (mdb.db_map_size < DB_HEADER_OFFSET + hdr_size)
+      errx(1, "Database file '%s' is corrupt (bad header)", db_file);
+
+   /* older headers lack the tables that follow, so make them empty */
+   memset(&hdr, 0, sizeof(hdr));
+   memcpy(&hdr, map + DB_HEADER_OFFSET, hdr_size);
+   if (minor == 0) {
+      hdr.dir_record_size = sizeof(db_dir_record);
+      hdr.dirs_offset = hdr.records_offset
+                      + (uint64_t) hdr.nrecords * sizeof(db_record);
+   }
+   if (minor <= 1) {
+      hdr.dict_offset = hdr.dirs_offset
+                      + (uint64_t) hdr.ndirs * sizeof(db_dir_record);
+      mdb.db_needs_rewrite = true;
+   }
+   if (minor <= 2)
+      hdr.sort_record_size = sizeof(db_sort_record);
+
+   /* sanity check the header */
+   if (hdr.record_size != sizeof(db_record)
+   ||  hdr.dir_record_size != sizeof(db_dir_record)
+   ||  hdr.records_offset < DB_HEADER_OFFSET + hdr_size
+   ||  hdr.records_offset % sizeof(uint64_t) != 0
+   ||  hdr.dirs_offset < hdr.records_offset
+                       + (uint64_t) hdr.nrecords * sizeof(db_record)
+   ||  hdr.dirs_offset % sizeof(uint64_t) != 0
+   ||  hdr.dict_offset < hdr.dirs_offset
+                       + (uint64_t) hdr.ndirs * sizeof(db_dir_record)
+   ||  hdr.heap_offset < hdr.dict_offset
+                       + (uint64_t) hdr.ndict * sizeof(uint32_t)
+   ||  hdr.heap_size == 0
+   ||  hdr.heap_offset + hdr.heap_size > mdb.db_map_size
+   ||  map[hdr.heap_offset + hdr.heap_size - 1] != '\0'
+   ||  hdr.sort_record_size != sizeof(db_sort_record)
+   || (hdr.nsorts > 0
+   && (hdr.sorts_offset < hdr.heap_offset + hdr.heap_size
+   ||  hdr.sorts_offset % sizeof(uint64_t) != 0
+   ||  hdr.sorts_offset + (uint64_t) hdr.nsorts * sizeof(db_sort_record)
+                       > mdb.db_map_size)))
+      errx(1, "Database file '%s' is corrupt (bad header)", db_file);
+
+   db_load_dirs(db_file, &hdr);
+   db_load_dict(db_file, &hdr);
+
+   if (hdr.nrecords == 0)
+      return;
+
+   /* allocate all records and make room for them in the library at once */
+   if ((mdb.db_records = calloc(hdr.nrecords, sizeof(meta_info))) == NULL)
+      err(1, "medialib_db_load: failed to allocate records");
+
+   mdb.library->capacity = hdr.nrecords + PLAYLIST_CHUNK_SIZE;
+   files = realloc(mdb.library->files,
+      mdb.library->capacity * sizeof(meta_info*));
+   if (files == NULL)
+      err(1, "medialib_db_load: failed to allocate library");
+   mdb.library->files = files;
+
+   /* point each record into the mapping, leaving the cinfo for later */
+   rec = (db_record *) (map + hdr.records_offset);
+   for (i = 0; i < hdr.nrecords; i++, rec++) {
+      db_record_decode(db_file, rec, map + hdr.heap_offset, hdr.heap_size,
+         &(mdb.db_records[i]), true);
+      files[i] = &(mdb.db_records[i]);
+   }
+
+   mdb.library->nfiles = hdr.nrecords;
+   mdb.db_nrecords = hdr.nrecords;
+   mdb.db_heap = map + hdr.heap_offset;
+   mdb.db_heap_size = hdr.heap_size;
+   mdb.db_all_decoded = false;
+   mi_decoder = db_record_decode_cinfo;
+
+   db_load_sorts(db_file, &hdr);
+}
+
+/* load a DB_VERSION 2 database, one record at a time */
+static void
+db_load_v2(const char *db_file, bufio *in)
+{
+   mi_builder b;
+   meta_info *mi;
+
+   mi_builder_init(&b);
+   while (!in->eof) {
+      mi_fread(&b, in);
+      if (in->error != 0) {
+         errno = in->error;
+         err(1, "Error loading database file '%s'", db_file);
+      } else if (in->eof)
+         break;
+
+      mi = medialib_adopt(mi_builder_finish(&b));
+      playlist_files_append(mdb.library, &mi, 1, false);
+   }
+   mi_builder_free(&b);
+
+   /* sort library by filenames */
+   qsort(mdb.library->files, mdb.library->nfiles, sizeof(meta_info*), mi_cmp_fn);
+
+   /* and re-write it in the current format the next time it's saved */
+   mdb.db_needs_rewrite = true;
+}
+
+/* return the (allocated) name of the journal of a given database */
+static char *
+db_journal_name(const char *db_file)
+{
+   char *journal_file;
+
+   if (asprintf(&journal_file, DB_JOURNAL_FMT, db_file) == -1)
+      err(1, "db_journal_name: asprintf failed");
+
+   return journal_file;
+}
+
+/* encode the given changes as entries of the journal of a database */
+static void
+db_journal_encode(bufio *out, const db_change *changes, int nchanges)
+{
+   db_journal_entry  entry;
+   db_record         rec;
+   db_dir_record     dir_rec;
+   medialib_dir     *dir;
+   const char       *parent;
+   uint64_t          heap_pos;
+   size_t            len;
+   int               i;
+
+   for (i = 0; i < nchanges; i++) {
+      entry.op = changes[i].op;
+      if (changes[i].op == DB_JOURNAL_DIR) {
+         dir = &(mdb.dirs[changes[i].dir]);
+         parent = (dir->parent == -1 ? NULL : mdb.dirs[dir->parent].path);
+         len = sizeof(db_dir_record) + 1 + strlen(dir->path) + 1;
+         if (parent != NULL)
+            len += strlen(parent) + 1;
+         entry.size = DB_ALIGN(len);
+
+         memset(&dir_rec, 0, sizeof(dir_rec));
+         dir_rec.path     = 1;
+         dir_rec.parent   = (parent == NULL ? 0 : 1 + strlen(dir->path) + 1);
+         dir_rec.nentries = dir->nentries;
+         dir_rec.mtime    = dir->mtime;
+         bufio_write(out, &entry, sizeof(entry));
+         bufio_write(out, &dir_rec, sizeof(dir_rec));
+         bufio_zero(out, 1);
+         bufio_write(out, dir->path, strlen(dir->path) + 1);
+         if (parent != NULL)
+            bufio_write(out, parent, strlen(parent) + 1);
+      } else if (changes[i].op == DB_JOURNAL_REMOVE) {
+         len = strlen(changes[i].mi->filename) + 1;
+         entry.size = DB_ALIGN(len);
+         bufio_write(out, &entry, sizeof(entry));
+         bufio_write(out, changes[i].mi->filename, len);
+      } else {
+         heap_pos = 1;
+         db_record_encode(changes[i].mi, &rec, &heap_pos, NULL);
+         len = sizeof(db_record) + heap_pos;
+         entry.size = DB_ALIGN(len);
+         bufio_write(out, &entry, sizeof(entry));
+         bufio_write(out, &rec, sizeof(rec));
+         bufio_zero(out, 1);
+         heap_pos = 1;
+         db_record_write_strings(changes[i].mi, &rec, &heap_pos, out);
+      }
+      bufio_zero(out, entry.size - len);
+   }
+}
+
+/*
+ * Append journal entries (see db_journal_encode()) to the journal of a
+ * database, returning -1 (with errno set) on failure.
+ */
+static int
+db_journal_write(const char *journal_file, const char *data, size_t len)
+{
+   struct stat sb;
+   int         fd;
+
+   fd = open(journal_file, O_WRONLY | O_APPEND | O_CREAT, S_IRUSR | S_IWUSR);
+   if (fd == -1)
+      return -1;
+   if (fstat(fd, &sb) == -1) {
+      close(fd);
+      return -1;
+   }
+
+   return db_write_data(fd, sb.st_size == 0, data, len);
+}
+
+/* an entry of the journal while it's being replayed */
+typedef struct {
+   const char *filename;
+   meta_info  *mi;         /* NULL if the file was removed */
+   int         seq;        /* position in the journal */
+} db_journal_op;
+
+/* used to sort journal entries by filename, then position in the journal */
+static int
+db_journal_op_cmp(const void *ai, const void *bi)
+{
+   const db_journal_op *a = (const db_journal_op *) ai;
+   const db_journal_op *b = (const db_journal_op *) bi;
+   int ret;
+
+   if ((ret = strcmp(a->filename, b->filename)) != 0)
+      return ret;
+
+   return a->seq - b->seq;
+}
+
+/* replay a DB_JOURNAL_DIR entry of the journal onto mdb.dirs */
+static void
+db_journal_replay_dir(const char *journal_file, char *payload, uint32_t size)
+{
+   db_dir_record *rec;
+   char          *heap, *path, *parent;
+   uint64_t       heap_size;
+   int            d;
+
+   if (size <= sizeof(db_dir_record))
+      errx(1, "Database journal '%s' is corrupt", journal_file);
+
+   rec = (db_dir_record *) payload;
+   heap = payload + sizeof(db_dir_record);
+   heap_size = size - sizeof(db_dir_record);
+   path = db_heap_str(journal_file, heap, heap_size, rec->path);
+   parent = db_heap_str(journal_file, heap, heap_size, rec->parent);
+   if (path == NULL)
+      errx(1, "Database journal '%s' is corrupt", journal_file);
+
+   d = medialib_dir_get(path);
+   if (rec->mtime == -1)
+      medialib_dir_link(d, -1);
+   else if (parent != NULL)
+      medialib_dir_link(d, medialib_dir_get(parent));
+
+   mdb.dirs[d].mtime    = rec->mtime;
+   mdb.dirs[d].nentries = rec->nentries;
 }
 
 /*
- * create the vitunes directory, database file (initially empty, and
- * playlists directory.
+ * Replay the journal of a database onto the (sorted by filename) library.
+ * Like the database, the journal is mmap(2)'d and its records point into
+ * the mapping.  The entries are sorted by filename and merged with the
+ * library in a single pass, keeping it sorted by filename.
  */
-void
-medialib_setup_files(const char *vitunes_dir, const char *db_file,
-   const char *playlist_dir)
+static void
+db_journal_replay(const char *journal_file)
 {
-   struct stat sb;
+   db_journal_entry *entry;
+   db_journal_op    *ops;
+   meta_info       **files;
+   char             *map, *payload;
+   size_t            size, pos, end;
+   int               version[3];
+   int               fd, nops, nputs, nfiles, capacity;
+   int               i, j, cmp;
+
+   if ((fd = open(journal_file, O_RDONLY)) == -1) {
+      if (errno == ENOENT)
+         return;
+      err(1, "Failed to open database journal '%s'", journal_file);
+   }
 
-   /* create vitunes directory */
-   if (mkdir(vitunes_dir, S_IRWXU) == -1) {
-      if (errno == EEXIST)
-         warnx("vitunes directory '%s' already exists (OK)", vitunes_dir);
-      else
-         err(1, "unable to create vitunes directory '%s'", vitunes_dir);
-   } else
-      warnx("vitunes directory '%s' created", vitunes_dir);
+   map = db_map_file(journal_file, fd, &size);
+   close(fd);
+   mdb.journal_map = map;
+   mdb.journal_map_size = size;
+
+   memcpy(version, map + strlen("vitunes"), sizeof(version));
+   if (strncmp(map, "vitunes", strlen("vitunes")) != 0
+   ||  version[0] != DB_VERSION_MAJOR || version[1] > DB_VERSION_MINOR
+   ||  version[2] != DB_VERSION_OTHER)
+      errx(1, "Database journal '%s' is of an unknown version", journal_file);
+
+   /* count entries, stopping at one that was torn by a crash */
+   nops = nputs = 0;
+   pos = DB_HEADER_OFFSET;
+   while (pos + sizeof(db_journal_entry) <= size) {
+      entry = (db_journal_entry *) (map + pos);
+      if (entry->size > size - pos - sizeof(db_journal_entry))
+         break;
+
+      pos += sizeof(db_journal_entry) + entry->size;
+      if (entry->op == DB_JOURNAL_ADD || entry->op == DB_JOURNAL_REPLACE)
+         nputs++;
+      if (entry->op != DB_JOURNAL_DIR)
+         nops++;
+   }
 
-   /* create playlists directory */
-   if (mkdir(playlist_dir, S_IRWXU) == -1) {
-      if (errno == EEXIST)
-         warnx("playlists directory '%s' already exists (OK)", playlist_dir);
-      else
-         err(1, "unable to create playlists directory '%s'", playlist_dir);
-   } else
-      warnx("playlists directory '%s' created", playlist_dir);
+   /* anything appended after a torn entry would be lost, so start over */
+   end = pos;
+   if (pos != size)
+      mdb.db_needs_rewrite = true;
+
+   ops = calloc(nops + 1, sizeof(db_journal_op));
+   mdb.journal_records = calloc(nputs + 1, sizeof(meta_info));
+   if (ops == NULL || mdb.journal_records == NULL)
+      err(1, "db_journal_replay: failed to allocate journal");
+
+   /* decode entries, applying those of directories right away */
+   pos = DB_HEADER_OFFSET;
+   nputs = 0;
+   i = 0;
+   while (pos < end) {
+      entry = (db_journal_entry *) (map + pos);
+      payload = map + pos + sizeof(db_journal_entry);
+      pos += sizeof(db_journal_entry) + entry->size;
+
+      if (entry->size == 0 || payload[entry->size - 1] != '\0')
+         errx(1, "Database journal '%s' is corrupt", journal_file);
+
+      if (entry->op == DB_JOURNAL_DIR) {
+         db_journal_replay_dir(journal_file, payload, entry->size);
+         continue;
+      }
 
-   /* create database file */
-   if (stat(db_file, &sb) < 0) {
-      if (errno == ENOENT) { 
+      ops[i].seq = i;
+      switch (entry->op) {
+         case DB_JOURNAL_ADD:
+         case DB_JOURNAL_REPLACE:
+            if (entry->size <= sizeof(db_record))
+               errx(1, "Database journal '%s' is corrupt", journal_file);
+
+            ops[i].mi = &(mdb.journal_records[nputs++]);
+            db_record_decode(journal_file, (db_record *) payload,
+               payload + sizeof(db_record), entry->size - sizeof(db_record),
+               ops[i].mi, false);
+            medialib_intern_fields(ops[i].mi);
+            ops[i].filename = ops[i].mi->filename;
+            break;
 
-         int   version[3] = {DB_VERSION_MAJOR, DB_VERSION_MINOR, DB_VERSION_OTHER};
-         FILE *f;
+         case DB_JOURNAL_REMOVE:
+            ops[i].mi = NULL;
+            ops[i].filename = payload;
+            break;
 
-         /* open for writing */
-         if ((f = fopen(db_file, "w")) == NULL)
-            err(1, "failed to create database file '%s'", db_file);
+         default:
+            errx(1, "Database journal '%s' is corrupt", journal_file);
+      }
+      i++;
+   }
 
-         /* save header & version */
-         fwrite("vitunes", strlen("vitunes"), 1, f);
-         fwrite(version, sizeof(version), 1, f);
+   if (nops == 0) {
+      free(ops);
+      return;
+   }
 
-         warnx("empty database at '%s' created", db_file);
-         fclose(f);
-      } else
-         err(1, "database file '%s' exists, but cannot access it", db_file);
-   } else
-      warnx("database file '%s' already exists (OK)", db_file);
-}
+   qsort(ops, nops, sizeof(db_journal_op), db_journal_op_cmp);
 
-/* used to sort media db by filenames. */
-static int mi_cmp_fn(const void *ai, const void *bi)
-{
-   const meta_info **a2 = (const meta_info **) ai;
-   const meta_info **b2 = (const meta_info **) bi;
-   const meta_info *a = (const meta_info *) *a2;
-   const meta_info *b = (const meta_info *) *b2;
+   /* merge with the library */
+   capacity = mdb.library->nfiles + nputs + PLAYLIST_CHUNK_SIZE;
+   if ((files = calloc(capacity, sizeof(meta_info*))) == NULL)
+      err(1, "db_journal_replay: failed to allocate library");
 
-   return strcmp(a->filename, b->filename);
+   i = nfiles = 0;
+   for (j = 0; j < nops; j++) {
+
+      /* only the last entry for a filename counts */
+      if (j + 1 < nops && strcmp(ops[j].filename, ops[j + 1].filename) == 0)
+         continue;
+
+      cmp = -1;
+      while (i < mdb.library->nfiles
+      && (cmp = strcmp(mdb.library->files[i]->filename, ops[j].filename)) < 0)
+         files[nfiles++] = mdb.library->files[i++];
+
+      /* the file is in the database, but was replaced or removed */
+      if (i < mdb.library->nfiles && cmp == 0)
+         i++;
+
+      if (ops[j].mi != NULL)
+         files[nfiles++] = ops[j].mi;
+   }
+   while (i < mdb.library->nfiles)
+      files[nfiles++] = mdb.library->files[i++];
+
+   free(mdb.library->files);
+   mdb.library->files    = files;
+   mdb.library->nfiles   = nfiles;
+   mdb.library->capacity = capacity;
+
+   free(ops);
 }
 
-/* load the library database into the global media library */
+/*
+ * Load the library database into the global media library, and replay any
+ * journal of changes made to it since.  Databases of DB_VERSION 2 are still
+ * read, and are converted to the current version the next time the database
+ * is saved.
+ */
 void
 medialib_db_load(const char *db_file)
 {
-   meta_info *mi;
-   FILE      *fin;
-   char       header[255] = { 0 };
-   int        version[3];
-
-   if ((fin = fopen(db_file, "r")) == NULL)
+   struct timeval start;
+   bufio          in;
+   char          *journal_file;
+   char           header[255] = { 0 };
+   int            version[3] = { 0 };
+   int            fd;
+
+   gettimeofday(&start, NULL);
+   if ((fd = open(db_file, O_RDONLY)) == -1)
       err(1, "Failed to open database file '%s'", db_file);
 
    /* read and check header & version */
-   fread(header, strlen("vitunes"), 1, fin);
+   read(fd, header, strlen("vitunes"));
    if (strncmp(header, "vitunes", strlen("vitunes")) != 0)
       errx(1, "Database file '%s' NOT a vitunes database", db_file);
 
-   fread(version, sizeof(version), 1, fin);
-   if (version[0] != DB_VERSION_MAJOR || version[1] != DB_VERSION_MINOR
-   ||  version[2] != DB_VERSION_OTHER) {
+   read(fd, version, sizeof(version));
+   if (version[0] == DB_VERSION_MAJOR && version[1] <= DB_VERSION_MINOR
+   &&  version[2] == DB_VERSION_OTHER) {
+      db_load_mapped(db_file, fd, version[1]);
+      mdb.db_load_io.bytes = mdb.db_map_size;
+   } else if (version[0] == 2 && version[1] == 1 && version[2] == 0) {
+      bufio_init(&in, fd, BUFIO_SIZE);
+      db_load_v2(db_file, &in);
+      mdb.db_load_io.bytes = strlen("vitunes") + sizeof(version) + in.bytes;
+      bufio_free(&in);
+   } else {
       printf("Loading vitunes database: old database version detected.\n");
       printf("\tExisting database at '%s' is of version %d.%d.%d\n",
          db_file, version[0], version[1], version[2]);
@@ -237,47 +2107,138 @@ medialib_db_load(const char *db_file)
       exit(1);
    }
 
-   /* read rest of records */
-   while (!feof(fin)) {
-      mi = mi_new();
-      mi_fread(mi, fin);
-      if (feof(fin))
-         mi_free(mi);
-      else if (ferror(fin))
-         err(1, "Error loading database file '%s'", db_file);
-      else
-         playlist_files_append(mdb.library, &mi, 1, false);
+   close(fd);
+
+   journal_file = db_journal_name(db_file);
+   db_journal_replay(journal_file);
+   free(journal_file);
+
+   mdb.db_load_io.bytes += mdb.journal_map_size;
+   mdb.db_load_io.seconds = db_seconds_since(&start);
+}
+
+/*
+ * Take a snapshot of the changes made to the library (see medialib_file_add()
+ * and friends) for medialib_db_snapshot_write(), returning false if there's
+ * nothing to save.  The changes are journaled, but once the journal grows
+ * past DB_JOURNAL_MIN_SIZE and 1/DB_JOURNAL_RATIO the size of the database,
+ * it's compacted: the whole database is snapshot instead, and the journal
+ * removed when it's written.
+ */
+bool
+medialib_db_snapshot(const char *db_file, db_snapshot *snap)
+{
+   struct stat sb;
+   off_t       db_size, journal_size;
+   bufio       out;
+   char       *journal_file;
+   int         i;
+
+   memset(snap, 0, sizeof(db_snapshot));
+   if (!mdb.db_needs_rewrite && mdb.nchanges == 0)
+      return false;
+
+   bufio_init(&out, -1, BUFIO_SIZE);
+   if (!mdb.db_needs_rewrite) {
+      db_journal_encode(&out, mdb.changes, mdb.nchanges);
+
+      db_size = journal_size = 0;
+      journal_file = db_journal_name(db_file);
+      if (stat(db_file, &sb) == 0)
+         db_size = sb.st_size;
+      if (stat(journal_file, &sb) == 0)
+         journal_size = sb.st_size;
+      free(journal_file);
+
+      journal_size += out.len;
+      if (journal_size > DB_JOURNAL_MIN_SIZE
+      &&  journal_size * DB_JOURNAL_RATIO > db_size)
+         mdb.db_needs_rewrite = true;
+   }
+
+   if (mdb.db_needs_rewrite) {
+      out.len = 0;
+      medialib_decode_all();
+      db_encode(&out, mdb.library->files, mdb.library->nfiles, mdb.dirs,
+         mdb.ndirs, &snap->files);
+      snap->rewrite = true;
+      snap->nfiles = mdb.library->nfiles;
+      for (i = 0; i < mdb.nsorts; i++)
+         snap->sorts[i] = mdb.sorts[i].desc;
+      snap->nsorts = mdb.nsorts;
+      mdb.db_needs_rewrite = false;
    }
+   mdb.nchanges = 0;
 
-   fclose(fin);
+   if ((snap->db_file = strdup(db_file)) == NULL)
+      err(1, "medialib_db_snapshot: strdup failed");
+   snap->data = out.buf;
+   snap->len = out.len;
+   return true;
+}
 
-   /* sort library by filenames */
-   qsort(mdb.library->files, mdb.library->nfiles, sizeof(meta_info*), mi_cmp_fn);
+/* write a snapshot to disk, returning -1 (with errno set) on failure */
+int
+medialib_db_snapshot_write(db_snapshot *snap)
+{
+   char *journal_file;
+   int   ret;
+
+   if (snap->rewrite) {
+      if (snap->nsorts > 0 && snap->nfiles > 0)
+         db_sort_encode(snap);
+      return db_write_image(snap->db_file, snap->data, snap->len);
+   }
+
+   journal_file = db_journal_name(snap->db_file);
+   ret = db_journal_write(journal_file, snap->data, snap->len);
+   free(journal_file);
+   return ret;
 }
 
-/* save the library database from the global media library to disk */
 void
-medialib_db_save(const char *db_file)
+medialib_db_snapshot_free(db_snapshot *snap)
 {
-   FILE *fout;
-   int   version[3] = {DB_VERSION_MAJOR, DB_VERSION_MINOR, DB_VERSION_OTHER};
-   int   i;
+   free(snap->db_file);
+   free(snap->data);
+   free(snap->files);
+   memset(snap, 0, sizeof(db_snapshot));
+}
 
-   if ((fout = fopen(db_file, "w")) == NULL)
-      err(1, "medialib_db_save: failed to open database file '%s'", db_file);
+/* save the changes made to the library, see medialib_db_snapshot() */
+void
+medialib_db_save(const char *db_file)
+{
+   struct timeval start;
+   db_snapshot    snap;
 
-   /* save header & version */
-   fwrite("vitunes", strlen("vitunes"), 1, fout);
-   fwrite(version, sizeof(version), 1, fout);
+   gettimeofday(&start, NULL);
+   mdb.db_save_io.bytes = 0;
+   if (medialib_db_snapshot(db_file, &snap)) {
+      if (medialib_db_snapshot_write(&snap) == -1)
+         err(1, "error saving database file '%s'", db_file);
 
-   /* save records */
-   for (i = 0; i < mdb.library->nfiles; i++) {
-      mi_fwrite(mdb.library->files[i], fout);
-      if (ferror(fout))
-         err(1, "medialib_db_save: error saving database");
+      mdb.db_save_io.bytes = snap.len;
+      medialib_db_snapshot_free(&snap);
    }
+   mdb.db_save_io.seconds = db_seconds_since(&start);
+}
 
-   fclose(fout);
+/* report the throughput of the last load & save of the database */
+static void
+medialib_db_io_report(void)
+{
+   const db_io_stats *io[2];
+   const char        *what[2] = { "loaded", "saved" };
+   int                i;
+
+   io[0] = &mdb.db_load_io;
+   io[1] = &mdb.db_save_io;
+   for (i = 0; i < 2; i++) {
+      printf("    %9.1f MB/s database %s (%lu bytes in %.3f seconds)\n",
+         (io[i]->seconds > 0 ? io[i]->bytes / io[i]->seconds / 1e6 : 0.0),
+         what[i], (unsigned long) io[i]->bytes, io[i]->seconds);
+   }
 }
 
 /* flush the library to stdout in a csv format */
@@ -297,6 +2258,7 @@ medialib_db_flush(FILE *fout, const char *timefmt)
 
    fprintf(fout, "length-seconds, is_url, \"last-updated\"\n");
    fflush(fout);
+   medialib_decode_all();
 
    /* start output of db */
    for (f = 0; f < mdb.library->nfiles; f++) {
@@ -321,21 +2283,279 @@ medialib_db_flush(FILE *fout, const char *timefmt)
    }
 }
 
+/*****************************************************************************
+ * Running mi_extract() on many files at once
+ ****************************************************************************/
+
+/*
+ * A file queued for mi_extract().  'path' is what's given to mi_extract()
+ * and printed, 'name' is its realpath(3), used to find it in the library.
+ */
+typedef struct {
+   char       *path;
+   char       *name;
+   time_t      mtime;
+   int         idx;     /* index in the library (medialib_db_update only) */
+   meta_info  *mi;      /* result of mi_extract() + mi_sanitize() */
+   bool        done;
+} extract_job;
+
+/*
+ * A pool of threads running mi_extract() on a bounded ring of jobs.  Jobs
+ * are handed to the threads in the order they're submitted and may finish
+ * in any order, but are collected in the order submitted, so what's done
+ * with the results doesn't depend on the number of threads.  A pool with
+ * no threads runs each job as it's submitted.
+ */
+typedef struct {
+   extract_job     *jobs;
+   int              size;
+   unsigned long    submitted;  /* number of jobs submitted... */
+   unsigned long    taken;      /* ...taken by a thread */
+   unsigned long    collected;  /* ...and collected */
+   pthread_t       *threads;
+   int              nthreads;
+   bool             stopping;
+   pthread_mutex_t  mutex;
+   pthread_cond_t   job_ready;  /* signaled when a job is submitted */
+   pthread_cond_t   job_done;   /* signaled when a job is finished */
+} extract_pool;
+
+static void
+extract_job_run(extract_job *job)
+{
+   if ((job->mi = mi_extract(job->path)) != NULL)
+      mi_sanitize(job->mi);
+}
+
+static void *
+extract_pool_thread(void *arg)
+{
+   extract_pool *pool = (extract_pool *) arg;
+   extract_job  *job;
+
+   pthread_mutex_lock(&pool->mutex);
+   for (;;) {
+      while (pool->taken == pool->submitted && !pool->stopping)
+         pthread_cond_wait(&pool->job_ready, &pool->mutex);
+      if (pool->taken == pool->submitted)
+         break;
+
+      job = &(pool->jobs[pool->taken++ % pool->size]);
+      pthread_mutex_unlock(&pool->mutex);
+
+      extract_job_run(job);
+
+      pthread_mutex_lock(&pool->mutex);
+      job->done = true;
+      pthread_cond_signal(&pool->job_done);
+   }
+   pthread_mutex_unlock(&pool->mutex);
+
+   return NULL;
+}
+
+static void
+extract_pool_start(extract_pool *pool, int nthreads)
+{
+   int i;
+
+   pool->nthreads  = nthreads;
+   pool->size      = nthreads > 0 ? nthreads * MEDIALIB_JOB_QUEUE_FACTOR : 1;
+   pool->submitted = 0;
+   pool->taken     = 0;
+   pool->collected = 0;
+   pool->stopping  = false;
+
+   if ((pool->jobs = calloc(pool->size, sizeof(extract_job))) == NULL)
+      err(1, "extract_pool_start: failed to allocate jobs");
+   if ((pool->threads = calloc(nthreads + 1, sizeof(pthread_t))) == NULL)
+      err(1, "extract_pool_start: failed to allocate threads");
+
+   if (pthread_mutex_init(&pool->mutex, NULL) != 0
+   ||  pthread_cond_init(&pool->job_ready, NULL) != 0
+   ||  pthread_cond_init(&pool->job_done, NULL) != 0)
+      errx(1, "extract_pool_start: failed to initialize locks");
+
+   for (i = 0; i < nthreads; i++) {
+      errno = pthread_create(&(pool->threads[i]), NULL, extract_pool_thread,
+         pool);
+      if (errno != 0)
+         err(1, "extract_pool_start: pthread_create failed");
+   }
+}
+
+/* wait for all threads to finish (there must be no jobs left) */
+static void
+extract_pool_stop(extract_pool *pool)
+{
+   int i;
+
+   pthread_mutex_lock(&pool->mutex);
+   pool->stopping = true;
+   pthread_cond_broadcast(&pool->job_ready);
+   pthread_mutex_unlock(&pool->mutex);
+
+   for (i = 0; i < pool->nthreads; i++)
+      pthread_join(pool->threads[i], NULL);
+
+   pthread_cond_destroy(&pool->job_done);
+   pthread_cond_destroy(&pool->job_ready);
+   pthread_mutex_destroy(&pool->mutex);
+   free(pool->threads);
+   free(pool->jobs);
+}
+
+static bool
+extract_pool_full(const extract_pool *pool)
+{
+   return pool->submitted - pool->collected == (unsigned long) pool->size;
+}
+
+static bool
+extract_pool_empty(const extract_pool *pool)
+{
+   return pool->submitted == pool->collected;
+}
+
+/* queue a copy of a job (the pool must not be full) */
+static void
+extract_pool_submit(extract_pool *pool, const extract_job *job)
+{
+   extract_job *slot;
+
+   slot = &(pool->jobs[pool->submitted % pool->size]);
+   *slot = *job;
+   slot->mi = NULL;
+   slot->done = false;
+
+   if (pool->nthreads == 0) {
+      extract_job_run(slot);
+      slot->done = true;
+   }
+
+   pthread_mutex_lock(&pool->mutex);
+   pool->submitted++;
+   pthread_cond_signal(&pool->job_ready);
+   pthread_mutex_unlock(&pool->mutex);
+}
+
+/*
+ * Wait for the oldest job to finish and return it (the pool must not be
+ * empty).  The job remains valid until the next extract_pool_submit().
+ */
+static extract_job *
+extract_pool_collect(extract_pool *pool)
+{
+   extract_job *job;
+
+   job = &(pool->jobs[pool->collected % pool->size]);
+
+   pthread_mutex_lock(&pool->mutex);
+   while (!job->done)
+      pthread_cond_wait(&pool->job_done, &pool->mutex);
+   pthread_mutex_unlock(&pool->mutex);
+
+   pool->collected++;
+   return job;
+}
+
+/* what medialib_db_update() found out about each file in the library */
+#define UPDATE_UNCHANGED   0
+#define UPDATE_CHANGED     1     /* modified (or forced), to be extracted */
+#define UPDATE_URL         2
+#define UPDATE_GONE        3     /* file no longer exists */
+#define UPDATE_ERROR       4     /* couldn't stat(2) file */
+
+typedef struct {
+   int         status;  /* one of UPDATE_* above */
+   meta_info  *mi;      /* new meta-info of UPDATE_CHANGED files */
+} update_entry;
+
+/* a range of the library to be checked by a medialib_db_update() thread */
+typedef struct {
+   update_entry  *entries;
+   int            start;
+   int            end;
+   bool           force_update;
+} update_range;
+
+/*
+ * Get the modification time of a file.  Where statx(2) is available only
+ * the modification time is asked for, which saves network filesystems from
+ * fetching anything else.
+ */
+static int
+medialib_file_mtime(const char *filename, time_t *mtime)
+{
+#if defined(STATX_MTIME)
+   struct statx stx;
+
+   if (statx(AT_FDCWD, filename, 0, STATX_MTIME, &stx) == -1)
+      return -1;
+
+   *mtime = stx.stx_mtime.tv_sec;
+#else
+   struct stat sb;
+
+   if (stat(filename, &sb) == -1)
+      return -1;
+
+   *mtime = sb.st_mtime;
+#endif
+   return 0;
+}
+
+/* check which files in a range of the library have changed */
+static void *
+medialib_db_update_range(void *arg)
+{
+   update_range *range = (update_range *) arg;
+   meta_info    *mi;
+   time_t        mtime;
+   int           i;
+
+   for (i = range->start; i < range->end; i++) {
+      mi = mdb.library->files[i];
+
+      if (mi->is_url)
+         range->entries[i].status = UPDATE_URL;
+      else if (medialib_file_mtime(mi->filename, &mtime) == -1)
+         range->entries[i].status = (errno == ENOENT ? UPDATE_GONE
+                                                     : UPDATE_ERROR);
+      else if (range->force_update || mtime > mi->last_updated)
+         range->entries[i].status = UPDATE_CHANGED;
+      else
+         range->entries[i].status = UPDATE_UNCHANGED;
+   }
+
+   return NULL;
+}
+
 /*
  * AFTER loading the global media library using medialib_load(), this function
  * is used to re-scan all files that exist in the database and re-check their
  * meta_info.  Any files that no longer exist are removed, and any meta
  * information that has changed is updated.
  *
+ * This is done in three passes: the files are stat(2)'d, split among 'njobs'
+ * threads, then the changed files are extracted by a pool of 'njobs'
+ * threads, and finally all removals and replacements are applied to the
+ * library at once.  If 'njobs' is 1 the calling thread does all of the work.
+ *
  * The database is then re-saved to disk.
  */
 void
-medialib_db_update(bool show_skipped, bool force_update)
+medialib_db_update(bool show_skipped, bool force_update, int njobs)
 {
-   meta_info *mi;
-   struct stat sb;
-   char  *filename;
-   int    i;
+   update_entry  *entries;
+   update_range  *ranges;
+   pthread_t     *threads;
+   extract_pool   pool;
+   extract_job    job, *done;
+   meta_info     *mi;
+   char          *filename;
+   int            nfiles, i, n;
 
    /* stat counters */
    int    count_removed_file_gone = 0;
@@ -345,68 +2565,132 @@ medialib_db_update(bool show_skipped, bool force_update)
    int    count_errors = 0;
    int    count_urls = 0;
 
-   for (i = 0; i < mdb.library->nfiles; i++) {
+   nfiles = mdb.library->nfiles;
+   if (njobs < 1)
+      njobs = 1;
+
+   entries = calloc(nfiles + 1, sizeof(update_entry));
+   ranges = calloc(njobs, sizeof(update_range));
+   threads = calloc(njobs, sizeof(pthread_t));
+   if (entries == NULL || ranges == NULL || threads == NULL)
+      err(1, "medialib_db_update: calloc failed");
+
+   /* pass 1: find out which files were removed/modified */
+   for (n = 0; n < njobs; n++) {
+      ranges[n].entries = entries;
+      ranges[n].start = (int) ((long long) nfiles * n / njobs);
+      ranges[n].end = (int) ((long long) nfiles * (n + 1) / njobs);
+      ranges[n].force_update = force_update;
+   }
 
-      filename = mdb.library->files[i]->filename;
+   if (njobs == 1)
+      medialib_db_update_range(&ranges[0]);
+   else {
+      for (n = 0; n < njobs; n++) {
+         errno = pthread_create(&threads[n], NULL, medialib_db_update_range,
+            &ranges[n]);
+         if (errno != 0)
+            err(1, "medialib_db_update: pthread_create failed");
+      }
+      for (n = 0; n < njobs; n++)
+         pthread_join(threads[n], NULL);
+   }
 
-      /* skip url's */
-      if (mdb.library->files[i]->is_url) {
-         printf("s %s\n", filename);
-         count_urls++;
+   /* pass 2: extract meta-info from the modified files */
+   extract_pool_start(&pool, njobs > 1 ? njobs : 0);
+   for (i = 0; i < nfiles; i++) {
+      if (entries[i].status != UPDATE_CHANGED)
          continue;
-      }
 
-      if (stat(filename, &sb) == -1) {
+      if (extract_pool_full(&pool)) {
+         done = extract_pool_collect(&pool);
+         entries[done->idx].mi = done->mi;
+      }
 
-         /* file was removed -or- stat() failed */
+      memset(&job, 0, sizeof(job));
+      job.path = mdb.library->files[i]->filename;
+      job.idx = i;
+      extract_pool_submit(&pool, &job);
+   }
+   while (!extract_pool_empty(&pool)) {
+      done = extract_pool_collect(&pool);
+      entries[done->idx].mi = done->mi;
+   }
+   extract_pool_stop(&pool);
+
+   /*
+    * pass 3: apply all removals/replacements to the library.  Replacements
+    * go through medialib_file_replace(), but the removals are made all at
+    * once, closing the gaps in a single pass instead of moving the rest of
+    * the library for each (as medialib_file_remove() would), so whatever
+    * else that does for a removal is done for them below.  As always, the
+    * old records are not free'd, other playlists may refer to them (until
+    * medialib_reclaim() below).
+    */
+   n = 0;
+   for (i = 0; i < nfiles; i++) {
+
+      mi = mdb.library->files[i];
+      filename = mi->filename;
+
+      switch (entries[i].status) {
+         case UPDATE_URL:
+            printf("s %s\n", filename);
+            count_urls++;
+            break;
 
-         if (errno == ENOENT) {
+         case UPDATE_GONE:
             /* file was removed, remove from library */
-            playlist_files_remove(mdb.library, i, 1, false);
-            i--;  /* since removed a file, we want to decrement i */
+            medialib_db_change(DB_JOURNAL_REMOVE, mi, -1);
             printf("x %s\n", filename);
             count_removed_file_gone++;
-         } else {
+            continue;
+
+         case UPDATE_ERROR:
             /* stat() failed for some reason - unknown error */
             printf("? %s\n", filename);
             count_errors++;
-         }
-
-      } else {
-
-         /*
-          * file still exists... check if it has been modified since we
-          * last extracted meta-info from it (otherwise we ignore)
-          */
-
-         if (force_update ||
-            (sb.st_mtime > mdb.library->files[i]->last_updated)) {
+            break;
 
-            mi = mi_extract(filename);
-            if (mi == NULL) {
+         case UPDATE_CHANGED:
+            if (entries[i].mi == NULL) {
                /* file now has no meta-info, remove from library */
-               playlist_files_remove(mdb.library, i, 1, false);
-               i--;  /* since removed a file, we want to decrement i */
+               medialib_db_change(DB_JOURNAL_REMOVE, mi, -1);
                printf("- %s\n", filename);
                count_removed_meta_gone++;
-            } else {
-               /* file's meta-info has changed, update it */
-               mi_sanitize(mi);
-               playlist_file_replace(mdb.library, i, mi);
-               printf("u %s\n", filename);
-               count_updated++;
+               continue;
             }
-         } else {
+
+            /* file's meta-info has changed, update it */
+            printf("u %s\n", filename);
+            medialib_file_replace(i, entries[i].mi);
+            mi = mdb.library->files[i];
+            count_updated++;
+            break;
+
+         default:
             count_skipped_not_updated++;
             if (show_skipped)
                printf(". %s\n", filename);
-         }
-
       }
+
+      mdb.library->files[n++] = mi;
+   }
+
+   if (n < nfiles) {
+      mdb.library->nfiles = n;
+      playlist_changed(mdb.library);
+         mdb.generation++;
+      mdb.files_index_stale = true;
    }
 
+   free(threads);
+   free(ranges);
+   free(entries);
+
    /* save to file */
    medialib_db_save(mdb.db_file);
+   medialib_reclaim();
 
    /* output some of our stats */
    printf("--------------------------------------------------\n");
@@ -421,55 +2705,248 @@ medialib_db_update(bool show_skipped, bool force_update)
       count_skipped_not_updated);
    printf("(?) %9d files with errors (couldn't stat, but kept)\n",
       count_errors);
+   medialib_db_io_report();
+}
+
+/* counters reported at the end of medialib_db_scan_dirs() */
+typedef struct {
+   int removed_lost_info;
+   int updated;
+   int skipped_no_info;
+   int skipped_dir;
+   int skipped_error;
+   int skipped_not_updated;
+   int skipped_unchanged_dir;
+   int added;
+} scan_stats;
+
+/* state of a medialib_db_scan_dirs() */
+typedef struct {
+   extract_pool   pool;
+   scan_stats     stats;
+   bool           force;      /* walk directories even if unchanged */
+   time_t         start;
+   strhash       *skipped;    /* directories skipped so far */
+   char         **pending;    /* subdirectories of those, to be walked */
+   int            npending;
+   int            pending_capacity;
+} scan_state;
+
+/* apply the result of extracting a file found by medialib_db_scan_dirs() */
+static void
+medialib_db_scan_commit(extract_job *job, scan_stats *stats)
+{
+   int idx;
+
+   /*
+    * Look the file up again, as earlier results may have moved it, or even
+    * added it if the same file was reached twice (through a symlink).
+    */
+   idx = medialib_file_find(job->name);
+   if (idx != -1 && job->mtime <= mdb.library->files[idx]->last_updated) {
+      /* file already added/updated during this scan */
+      if (job->mi != NULL)
+         mi_free(job->mi);
+      printf(". %s\n", job->path);
+      stats->skipped_not_updated++;
+
+   } else if (idx != -1) {
+      /* file already exists in library database - update */
+      if (job->mi == NULL) {
+         /* file now has no meta-info, remove from library */
+         medialib_file_remove(idx);
+         printf("- %s\n", job->path);
+         stats->removed_lost_info++;
+      } else {
+         /* file's meta-info has changed, update it */
+         medialib_file_replace(idx, job->mi);
+         printf("u %s\n", job->path);
+         stats->updated++;
+      }
+
+   } else {
+      /* file does NOT exists in library database - add it */
+      if (job->mi == NULL) {
+         /* file has no info */
+         printf("s %s\n", job->path);
+         stats->skipped_no_info++;
+      } else {
+         /* file does have info, add it to library */
+         medialib_file_add(job->mi);
+         printf("+ %s\n", job->path);
+         stats->added++;
+      }
+   }
+
+   free(job->path);
+   free(job->name);
+
+   if (mdb.nretired >= MEDIALIB_RECLAIM_BATCH)
+      medialib_reclaim();
+}
+
+/* number of entries in a directory, other than "." and "..", or -1 */
+static int
+medialib_dir_count(const char *path)
+{
+   struct dirent *dp;
+   DIR           *dirp;
+   int            n;
+
+   if ((dirp = opendir(path)) == NULL)
+      return -1;
+
+   n = 0;
+   while ((dp = readdir(dirp)) != NULL) {
+      if (strcmp(dp->d_name, ".") != 0 && strcmp(dp->d_name, "..") != 0)
+         n++;
+   }
+
+   closedir(dirp);
+   return n;
 }
 
 /*
- * AFTER loading the global media library using medialib_load(), this function
- * will scan the list of directories specified in the parameter and
+ * Check if a directory is unchanged since it was last walked.  Adding,
+ * removing, or renaming an entry changes its mtime, and the entries are
+ * counted (without stat(2)'ing them) in case that happened within the
+ * granularity of the mtime.
  */
-void
-medialib_db_scan_dirs(char *dirlist[])
+static bool
+medialib_dir_unchanged(int d, FTSENT *ftsent)
 {
-   FTS        *fts;
-   FTSENT     *ftsent;
-   meta_info  *mi;
-   char        fullname[PATH_MAX];
-   int         i, idx;
+   if (mdb.dirs[d].mtime <= 0
+   ||  mdb.dirs[d].mtime != ftsent->fts_statp->st_mtime)
+      return false;
 
-   /* stat counters */
-   int         count_removed_lost_info = 0;
-   int         count_updated = 0;
-   int         count_skipped_no_info = 0;
-   int         count_skipped_dir = 0;
-   int         count_skipped_error = 0;
-   int         count_skipped_not_updated = 0;
-   int         count_added = 0;
+   return medialib_dir_count(ftsent->fts_accpath) == mdb.dirs[d].nentries;
+}
+
+/* queue a directory to be walked once the current walk is done */
+static void
+scan_pending_add(scan_state *scan, const char *path)
+{
+   char **new_pending;
+
+   if (scan->npending + 1 >= scan->pending_capacity) {
+      scan->pending_capacity += MEDIALIB_DIRS_CHUNK_SIZE;
+      new_pending = realloc(scan->pending,
+         scan->pending_capacity * sizeof(char*));
+      if (new_pending == NULL)
+         err(1, "scan_pending_add: realloc failed");
+
+      scan->pending = new_pending;
+   }
 
+   if ((scan->pending[scan->npending++] = strdup(path)) == NULL)
+      err(1, "scan_pending_add: strdup failed");
+   scan->pending[scan->npending] = NULL;
+}
+
+/* index in mdb.dirs of a directory being walked, or -1 if it isn't */
+static int
+scan_dir(const FTSENT *ftsent)
+{
+   if (ftsent == NULL)
+      return -1;
 
+   return (int) (intptr_t) ftsent->fts_pointer - 1;
+}
 
-   fts = fts_open(dirlist, FTS_LOGICAL | FTS_NOCHDIR, NULL);
+/*
+ * Walk the given files & directories, queueing every new or modified file
+ * for mi_extract().  Directories that haven't changed since they were last
+ * walked are skipped, and their subdirectories (which may well have
+ * changed) are queued to be walked next.  When walking those 'pending' is
+ * set, and any that no longer exist are forgotten.
+ *
+ * The entries of each directory being walked are counted in fts_number,
+ * which is set to -1 if any of them fail, so that the directory is walked
+ * again the next time.
+ */
+static void
+medialib_db_scan_walk(scan_state *scan, char *roots[], bool pending)
+{
+   FTS          *fts;
+   FTSENT       *ftsent, *parent;
+   extract_job   job;
+   char          fullname[PATH_MAX];
+   time_t        mtime;
+   int           idx, d, c;
+
+   fts = fts_open(roots, FTS_LOGICAL | FTS_NOCHDIR, NULL);
    if (fts == NULL)
       err(1, "medialib_db_scan_dirs: fts_open failed");
 
    while ((ftsent = fts_read(fts)) != NULL) {
 
+      parent = (ftsent->fts_level > 0 ? ftsent->fts_parent : NULL);
+      if (parent != NULL && parent->fts_number >= 0
+      &&  ftsent->fts_info != FTS_DP && ftsent->fts_info != FTS_DNR)
+         parent->fts_number++;
+
       switch (ftsent->fts_info) {   /* file type */
          case FTS_D:    /* TYPE: directory (going in) */
+            if (realpath(ftsent->fts_accpath, fullname) == NULL) {
+               err(1, "medialib_db_scan_dirs: realpath failed for '%s'",
+                  ftsent->fts_accpath);
+            }
+
+            d = medialib_dir_get(fullname);
+            if (!scan->force && medialib_dir_unchanged(d, ftsent)) {
+               printf("Unchanged Directory: %s\n", ftsent->fts_path);
+               fts_set(fts, ftsent, FTS_SKIP);
+               scan->stats.skipped_unchanged_dir++;
+
+               /* (only once, in case symlinks made a loop of them) */
+               if (strhash_get(scan->skipped, mdb.dirs[d].path) == NULL) {
+                  strhash_set(scan->skipped, mdb.dirs[d].path, d);
+                  for (c = mdb.dirs[d].child; c != -1; c = mdb.dirs[c].sibling)
+                     scan_pending_add(scan, mdb.dirs[c].path);
+               }
+               break;
+            }
+
             printf("Checking Directory: %s\n", ftsent->fts_path);
+            ftsent->fts_number = 0;
+            ftsent->fts_pointer = (void *) (intptr_t) (d + 1);
             break;
 
          case FTS_DP:   /* TYPE: directory (coming out) */
+            if ((d = scan_dir(ftsent)) == -1)
+               break;
+
+            /* an mtime that may still change within this second is no use */
+            mtime = ftsent->fts_statp->st_mtime;
+            if (ftsent->fts_number < 0 || mtime >= scan->start)
+               mtime = 0;
+
+            medialib_dir_update(d, scan_dir(parent), mtime,
+               ftsent->fts_number < 0 ? 0 : ftsent->fts_number);
             break;
 
          case FTS_DNR:  /* TYPE: unreadable directory */
             printf("Directory '%s' Unreadable\n", ftsent->fts_accpath);
-            count_skipped_dir++;
+            scan->stats.skipped_dir++;
+            if ((d = scan_dir(ftsent)) != -1)
+               medialib_dir_update(d, scan_dir(parent), 0, 0);
+            if (parent != NULL)
+               parent->fts_number = -1;
             break;
 
          case FTS_NS:   /* TYPE: file/dir that couldn't be stat(2) */
          case FTS_ERR:  /* TYPE: other error */
+            if (pending && ftsent->fts_level == 0
+            &&  ftsent->fts_errno == ENOENT) {
+               if ((d = medialib_dir_find(ftsent->fts_path)) != -1)
+                  medialib_dir_update(d, -1, -1, 0);
+               break;
+            }
+
             printf("? %s\n", ftsent->fts_path);
-            count_skipped_error++;
+            scan->stats.skipped_error++;
+            if (parent != NULL)
+               parent->fts_number = -1;
             break;
 
          case FTS_F:    /* TYPE: regular file */
@@ -480,77 +2957,97 @@ medialib_db_scan_dirs(char *dirlist[])
                   ftsent->fts_accpath);
             }
 
-            /* check if the file already exists in the db */
-            idx = -1;
-            for (i = 0; i < mdb.library->nfiles; i++) {
-               if (strcmp(fullname, mdb.library->files[i]->filename) == 0)
-                  idx = i;
+            /* skip files in the db that haven't changed since extracted */
+            idx = medialib_file_find(fullname);
+            if (idx != -1 && ftsent->fts_statp->st_mtime <=
+                mdb.library->files[idx]->last_updated) {
+               printf(". %s\n", ftsent->fts_accpath);
+               scan->stats.skipped_not_updated++;
+               break;
             }
 
-            if (idx != -1) {
-               /* file already exists in library database - update */
-
-               if (ftsent->fts_statp->st_mtime >
-                   mdb.library->files[idx]->last_updated) {
-
-                  /* file has been modified since we last extracted info */
-
-                  mi = mi_extract(ftsent->fts_accpath);
-
-                  if (mi == NULL) {
-                     /* file now has no meta-info, remove from library */
-                     playlist_files_remove(mdb.library, idx, 1, false);
-                     printf("- %s\n", ftsent->fts_accpath);
-                     count_removed_lost_info++;
-                  } else {
-                     /* file's meta-info has changed, update it */
-                     mi_sanitize(mi);
-                     playlist_file_replace(mdb.library, idx, mi);
-                     printf("u %s\n", ftsent->fts_accpath);
-                     count_updated++;
-                  }
-               } else {
-                  printf(". %s\n", ftsent->fts_accpath);
-                  count_skipped_not_updated++;
-               }
-
-            } else {
-
-               /* file does NOT exists in library database - add it */
-
-               mi = mi_extract(ftsent->fts_accpath);
-
-               if (mi == NULL) {
-                  /* file has no info */
-                  printf("s %s\n", ftsent->fts_accpath);
-                  count_skipped_no_info++;
-               } else {
-                  /* file does have info, add it to library */
-                  mi_sanitize(mi);
-                  playlist_files_append(mdb.library, &mi, 1, false);
-                  printf("+ %s\n", ftsent->fts_accpath);
-                  count_added++;
-               }
-            }
+            /* otherwise queue it to be extracted, making room if needed */
+            if (extract_pool_full(&scan->pool))
+               medialib_db_scan_commit(extract_pool_collect(&scan->pool),
+                  &scan->stats);
+
+            job.path = strdup(ftsent->fts_accpath);
+            job.name = strdup(fullname);
+            if (job.path == NULL || job.name == NULL)
+               err(1, "medialib_db_scan_dirs: strdup failed");
+            job.mtime = ftsent->fts_statp->st_mtime;
+            extract_pool_submit(&scan->pool, &job);
       }
    }
 
    if (fts_close(fts) == -1)
       err(1, "medialib_db_scan_dirs: failed to close file heirarchy");
+}
+
+/*
+ * AFTER loading the global media library using medialib_load(), this function
+ * will scan the list of directories specified in the parameter and add/update
+ * the files found in the library.  The directories are walked by the calling
+ * thread, which queues every new or modified file for mi_extract() by a pool
+ * of 'njobs' threads (if 'njobs' is 1, it extracts them itself), and applies
+ * the results to the library in the order the files were found.
+ *
+ * Unless 'force' is set, directories that haven't changed since they were
+ * last walked are skipped, see medialib_db_scan_walk().  Files modified in
+ * place don't change their directory, so those are left to
+ * medialib_db_update().
+ */
+void
+medialib_db_scan_dirs(char *dirlist[], int njobs, bool force)
+{
+   scan_state   scan;
+   char       **roots;
+   int          i;
+
+   memset(&scan, 0, sizeof(scan));
+   scan.force = force;
+   scan.start = time(NULL);
+   scan.skipped = strhash_new(0);
+   extract_pool_start(&scan.pool, njobs > 1 ? njobs : 0);
+
+   /* walk the paths given, then the subdirectories of any skipped */
+   medialib_db_scan_walk(&scan, dirlist, false);
+   while (scan.npending > 0) {
+      roots = scan.pending;
+      scan.pending = NULL;
+      scan.npending = scan.pending_capacity = 0;
+
+      medialib_db_scan_walk(&scan, roots, true);
+
+      for (i = 0; roots[i] != NULL; i++)
+         free(roots[i]);
+      free(roots);
+   }
+
+   /* apply whatever is still being extracted */
+   while (!extract_pool_empty(&scan.pool))
+      medialib_db_scan_commit(extract_pool_collect(&scan.pool), &scan.stats);
+   extract_pool_stop(&scan.pool);
+   strhash_free(scan.skipped);
 
    /* save to file */
    medialib_db_save(mdb.db_file);
+   medialib_reclaim();
 
    /* output some of our stats */
    printf("--------------------------------------------------\n");
    printf("Results of scanning directories...\n");
-   printf("(+) %9d files added\n", count_added);
-   printf("(u) %9d files updated\n", count_updated);
+   printf("(+) %9d files added\n", scan.stats.added);
+   printf("(u) %9d files updated\n", scan.stats.updated);
    printf("(-) %9d files removed (was in DB, but no longer has meta-info)\n",
-      count_removed_lost_info);
+      scan.stats.removed_lost_info);
    printf("(.) %9d files skipped (in DB, file unchanged since last checked)\n",
-      count_skipped_not_updated);
-   printf("(s) %9d files skipped (no info)\n", count_skipped_no_info);
-   printf("(?) %9d files skipped (other error)\n", count_skipped_error);
-   printf("    %9d directories skipped (couldn't read)\n", count_skipped_dir);
+      scan.stats.skipped_not_updated);
+   printf("(s) %9d files skipped (no info)\n", scan.stats.skipped_no_info);
+   printf("(?) %9d files skipped (other error)\n", scan.stats.skipped_error);
+   printf("    %9d directories skipped (couldn't read)\n",
+      scan.stats.skipped_dir);
+   printf("    %9d directories skipped (unchanged since last checked)\n",
+      scan.stats.skipped_unchanged_dir);
+   medialib_db_io_report();
 }
@@ -14,14 +14,6 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
-/*
- * TODO Maintain an index of the filenames of each meta_info in the db
- * and provide ability to bin-search against that when loading
- * playlists from file.  As-is, really large playlists can take a
- * while.  Also could be used in medialib_scan_dirs when checking if file
- * already exists in database.  Possibly elsewhere too.
- */
-
 #ifndef MEDIALIB_H
 #define MEDIALIB_H
 
@@ -29,24 +21,204 @@
 
 #include <sys/errno.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 
+#include <dirent.h>
+#include <fcntl.h>
 #include <fts.h>
 #include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
 
 #include "debug.h"
 #include "meta_info.h"
 #include "playlist.h"
+#include "util/arena.h"
+#include "util/bufio.h"
+#include "util/nthreads.h"
+#include "util/strhash.h"
 
 #define MEDIALIB_PLAYLISTS_CHUNK_SIZE  100
+#define MEDIALIB_CHANGES_CHUNK_SIZE    100
+#define MEDIALIB_DIRS_CHUNK_SIZE       100
+#define MEDIALIB_RETIRED_CHUNK_SIZE    100
+#define MEDIALIB_RECLAIM_BATCH         256
+#define MEDIALIB_MAX_SORTS             8      /* sorted orders kept, at most */
+#define MEDIALIB_FILES_INDEX_MAX_SHIFT 256    /* removals before a rebuild */
+#define MEDIALIB_INDEX_SLICE           1024   /* indexed between time checks */
+
+/*
+ * Limit on the number of threads used when scanning/updating the library,
+ * and the number of files queued for mi_extract() for each of them.
+ */
+#define MEDIALIB_MAX_JOBS              256
+#define MEDIALIB_DECODE_BATCH          16384  /* fewest decoded by a thread */
+#define MEDIALIB_JOB_QUEUE_FACTOR      4
 
 /* current database file-format version */
-#define DB_VERSION_MAJOR   2
-#define DB_VERSION_MINOR   1
+#define DB_VERSION_MAJOR   3
+#define DB_VERSION_MINOR   3
 #define DB_VERSION_OTHER   0
 
+/*
+ * The DB_VERSION 3 file-format.  It is laid out so that the whole file can
+ * be mmap(2)'d and the meta_info's of the library pointed straight into it:
+ *
+ *    "vitunes"               7 bytes, followed by the version (3 int's)
+ *    db_header               at DB_HEADER_OFFSET
+ *    db_record[nrecords]     at records_offset, sorted by filename
+ *    db_dir_record[ndirs]    at dirs_offset (since 3.1.0)
+ *    uint32_t[ndict]         at dict_offset (since 3.2.0)
+ *    string heap             at heap_offset, NUL-terminated strings
+ *    db_sort_record[nsorts]  at sorts_offset (since 3.3.0), each followed
+ *                            by a uint32_t[nrecords] at perm_offset
+ *
+ * Each string in a db_record is stored as an offset into the string heap,
+ * where an offset of 0 means NULL (the heap starts with a single '\0').
+ * All values are stored in host byte-order, as they always have been.
+ *
+ * The db_dir_record's remember the directories walked by "vitunes -e add",
+ * so that directories that haven't changed since can be skipped the next
+ * time (see medialib_db_scan_dirs()).
+ *
+ * The values of the fields in MI_CINFO_INTERNED repeat a lot (the same
+ * artist on every track of every album), so each is stored in the heap only
+ * once, and the records that share it share its offset.  The dictionary
+ * lists the heap offsets of all of them, so that they can be interned
+ * without looking at every record (see medialib_intern()).
+ *
+ * The db_sort_record's keep the order of the records under the sort
+ * descriptions used by default and in the config file, so that starting
+ * vitunes needs no sort: each lists the index of every record in sorted
+ * order.  They're only trusted if their stamp matches db_sort_stamp() (see
+ * medialib_sort_library()).
+ *
+ * Version 3.0.0, 3.1.0 and 3.2.0 databases, whose header ends at ndirs,
+ * ndict and nsorts respectively, are still read.
+ */
+#define DB_HEADER_OFFSET   24
+
+typedef struct {
+   uint32_t nrecords;         /* number of db_record's */
+   uint32_t record_size;      /* sizeof(db_record), as a sanity check */
+   uint64_t records_offset;   /* file offset of the db_record table */
+   uint64_t heap_offset;      /* file offset of the string heap */
+   uint64_t heap_size;        /* size of the string heap in bytes */
+   uint32_t ndirs;            /* number of db_dir_record's */
+   uint32_t dir_record_size;  /* sizeof(db_dir_record), as a sanity check */
+   uint64_t dirs_offset;      /* file offset of the db_dir_record table */
+   uint32_t ndict;            /* number of interned strings */
+   uint32_t pad;
+   uint64_t dict_offset;      /* file offset of their heap offsets */
+   uint32_t nsorts;           /* number of db_sort_record's */
+   uint32_t sort_record_size; /* sizeof(db_sort_record), as a sanity check */
+   uint64_t sorts_offset;     /* file offset of the db_sort_record table */
+} db_header;
+
+typedef struct {
+   uint32_t filename;               /* heap offset of filename */
+   uint32_t cinfo[MI_NUM_CINFO];    /* heap offsets of cinfo fields */
+   int32_t  length;
+   int64_t  last_updated;
+   uint8_t  is_url;
+   uint8_t  pad[7];
+} db_record;
+
+#define DB_DIR_NO_PARENT   UINT32_MAX
+
+typedef struct {
+   uint32_t path;       /* heap offset of the directory's realpath(3) */
+   uint32_t parent;     /* index of the parent's db_dir_record, if any */
+   uint32_t nentries;   /* number of entries when last walked */
+   uint32_t pad;
+   int64_t  mtime;      /* mtime when last walked, 0 if it must be walked */
+} db_dir_record;
+
+typedef struct {
+   uint64_t stamp;                  /* db_sort_stamp() when written */
+   uint32_t nfields;                /* the mi_sort_description sorted by */
+   uint8_t  order[MI_NUM_CINFO];
+   uint8_t  descending[MI_NUM_CINFO];
+   uint32_t pad;
+   uint64_t perm_offset;            /* file offset of the sorted order */
+} db_sort_record;
+
+/*
+ * Changes made to the library since the database was last written in full
+ * are appended to a journal kept next to it (see DB_JOURNAL_FMT), so small
+ * edits of a large library only cost the size of the edit.  The journal
+ * starts with the same "vitunes" + version header as the database, padded
+ * to DB_HEADER_OFFSET, followed by entries.  Each entry is a
+ * db_journal_entry followed by its payload, padded to a multiple of 8:
+ *
+ *    DB_JOURNAL_ADD/REPLACE     a db_record followed by its string heap
+ *    DB_JOURNAL_REMOVE          the NUL-terminated filename
+ *    DB_JOURNAL_DIR             a db_dir_record followed by its string heap,
+ *                               with parent as the heap offset of the
+ *                               parent's path (0 if none)
+ *
+ * Entries are keyed by filename (or path) and the last one for it wins.
+ * Loading replays the journal, and medialib_db_save() folds it back into
+ * the database once it is larger than both of the limits below.
+ */
+#define DB_JOURNAL_FMT        "%s.journal"
+#define DB_JOURNAL_ADD        1
+#define DB_JOURNAL_REPLACE    2
+#define DB_JOURNAL_REMOVE     3
+#define DB_JOURNAL_DIR        4
+
+#define DB_JOURNAL_MIN_SIZE   (1024 * 1024)
+#define DB_JOURNAL_RATIO      4     /* i.e. 1/4 the size of the database */
+
+typedef struct {
+   uint32_t op;      /* one of DB_JOURNAL_* */
+   uint32_t size;    /* size of the payload that follows */
+} db_journal_entry;
+
+/* a change to the library that has not been saved yet */
+typedef struct {
+   int         op;   /* one of DB_JOURNAL_* */
+   meta_info  *mi;
+   int         dir;  /* index in medialib.dirs, for DB_JOURNAL_DIR */
+} db_change;
+
+/*
+ * A directory walked by medialib_db_scan_dirs().  The directories form a
+ * tree through the parent/child/sibling indices (-1 if none), so that the
+ * subdirectories of one that is skipped can still be visited.  An mtime of
+ * 0 means the directory must be walked again, and -1 that it is gone and
+ * is dropped the next time the database is written in full.
+ */
+typedef struct {
+   char     *path;         /* realpath(3) of the directory */
+   time_t    mtime;
+   int       nentries;
+   int       parent;
+   int       child;
+   int       sibling;
+} medialib_dir;
+
+/*
+ * A sort description used on the library, and the order of the records of
+ * the mapped database under it, if it's still of use (see
+ * medialib_sort_library()).
+ */
+typedef struct {
+   mi_sort_description  desc;
+   const uint32_t      *perm;
+} medialib_sort;
+
+/* how much the last load/save of the database read/wrote, and how long */
+typedef struct {
+   uint64_t    bytes;
+   double      seconds;
+} db_io_stats;
+
 typedef struct {
    /* some locations of where things are loaded/saved */
    char     *db_file;      /* file containing the database */
@@ -61,6 +233,100 @@ typedef struct {
        * easier)
        */
 
+   /*
+    * the values of the MI_CINFO_INTERNED fields, each stored once.  Those of
+    * the records of the database point into its mapping, and the others
+    * into the arena.
+    */
+   strhash    *strings;
+
+   /*
+    * every other record of the library, along with its strings, lives in
+    * the arena.  Records replaced in the library are 'retired', never
+    * changed, until medialib_reclaim() can give their memory back to it.
+    */
+   arena      *arena;
+   meta_info **retired;
+   int         nretired;
+   int         retired_capacity;
+
+   /*
+    * the mmap(2)'d database file and the records that point into it.  The
+    * cinfo of those is decoded lazily (see mi_decode()), from the string
+    * heap of the mapping.  Once all of them are, db_all_decoded is set.
+    */
+   void       *db_map;
+   size_t      db_map_size;
+   meta_info  *db_records;
+   int         db_nrecords;
+   char       *db_heap;
+   uint64_t    db_heap_size;
+   bool        db_all_decoded;
+
+   /*
+    * the sort descriptions used on the library, most recent first, whose
+    * sorted orders are kept in the database
+    */
+   medialib_sort  sorts[MEDIALIB_MAX_SORTS];
+   int            nsorts;
+
+   /* the mmap(2)'d journal and the records that point into it */
+   void       *journal_map;
+   size_t      journal_map_size;
+   meta_info  *journal_records;
+
+   /* changes to the library not yet saved, see medialib_db_save() */
+   db_change  *changes;
+   int         nchanges;
+   int         changes_capacity;
+   bool        db_needs_rewrite;  /* write in full instead of journaling */
+   db_io_stats db_load_io;
+   db_io_stats db_save_io;
+
+   /*
+    * filename -> index of the file in the library.  Built on first use by
+    * medialib_file_find() and kept up to date by the medialib_file_*
+    * routines below, except that removing a file leaves those after it
+    * where they were: any file may have moved up by as many as
+    * files_index_shift since, and a lookup corrects that.  Anything else
+    * that reorders the library (sorting it, for example) only makes the
+    * index stale, and it is rebuilt the next time a lookup notices.
+    */
+   strhash    *files_index;
+   bool        files_index_stale;
+   int         files_index_shift;
+
+   /* bumped whenever the medialib_file_* routines change the library */
+   unsigned int   generation;
+
+   /*
+    * trigram index of the text of the records of the library, by their
+    * index_id, to narrow searches down (see medialib_query_candidates()).
+    * Built on first use (all at once, or bit by bit, see
+    * medialib_index_work()) and kept up to date by the medialib_file_*
+    * routines.  A record not in it yet has an index_id of 0, and may match
+    * anything.  Records replaced or removed just stay in it, under ids no
+    * record in the library has anymore.  query_set holds the candidates of the global
+    * query, as of query_generation, narrowed down by query_tokens (and by
+    * fuzzy ones too, if query_fuzzy).
+    */
+   trigram_index *trigrams;
+   uint32_t       trigram_ids;      /* last index_id given out */
+   int            trigram_next;     /* next file to add to it */
+   unsigned int   trigram_pass;     /* library generation the pass began at */
+   bool           trigrams_done;
+   trigram_set    query_set;
+   char          *query_tokens[MI_MAX_QUERY_TOKENS];
+   int            query_ntokens;
+   bool           query_fuzzy;
+   unsigned int   query_generation;
+
+   /* directories walked by medialib_db_scan_dirs(), indexed by path */
+   medialib_dir  *dirs;
+   int            ndirs;
+   int            dirs_capacity;
+   strhash       *dirs_index;
+
    /* the playlists */
    playlist **playlists;            /* array of all playlists */
    int        nplaylists;           /* num playlists in array */
@@ -77,6 +343,53 @@ extern medialib mdb;
 void medialib_load(const char *db_file, const char *playlist_dir);
 void medialib_destroy();
 
+/*
+ * add/replace/remove files in the library (recorded for the journal).  The
+ * library takes over the meta_info given, which may be moved to its arena:
+ * it must not be used afterwards.
+ */
+void medialib_file_add(meta_info *mi);
+void medialib_file_replace(int idx, meta_info *mi);
+void medialib_file_remove(int idx);
+
+/*
+ * point references to records replaced in the library at their
+ * replacements, or also release the old ones (see medialib.c)
+ */
+void medialib_redirect(void);
+void medialib_reclaim(void);
+
+/*
+ * decode the cinfo of every record of the library, in parallel, before
+ * something that goes through them all (sorting or filtering the library)
+ */
+void medialib_decode_all(void);
+
+/*
+ * sort the library using the global sort description, which is remembered
+ * so its order is kept in the database the next time it's written in full.
+ * medialib_sorts_stale() tells if any of those remembered lack a sorted
+ * order in the database.
+ */
+void medialib_sort_library(void);
+bool medialib_sorts_stale(void);
+
+/*
+ * the records that can match the global query (see mi_may_match()), or NULL
+ * if its tokens are too short to narrow them down.  The set is only valid
+ * until the query changes.  The trigram index it needs is built first, if
+ * not done yet, or can be built beforehand a slice of about usec
+ * microseconds at a time, by medialib_index_work() (true while unfinished).
+ */
+bool medialib_index_work(long usec);
+const trigram_set *medialib_query_candidates(void);
+
+/* the one copy of a value of an MI_CINFO_INTERNED field */
+const char *medialib_intern(const char *s);
+
+/* index of a file in the library by its filename/URL, or -1 if not there */
+int medialib_file_find(const char *filename);
+
 /* add/remove playlists to/from the global media library */
 void medialib_playlist_add(playlist *p);
 void medialib_playlist_remove(int pindex);
@@ -89,9 +402,32 @@ void medialib_setup_files(const char *vitunes_dir, const char *db_file,
 void medialib_db_load(const char *db_file);
 void medialib_db_save(const char *db_file);
 
+/*
+ * medialib_db_save() in two steps: taking a snapshot of what's to be saved,
+ * and writing it, which touches nothing but the snapshot and the records it
+ * refers to, which don't change (so it can be done by another thread, see
+ * writer.h).  Writing
+ * a whole database also sorts its records by each of sorts, to add their
+ * orders.
+ */
+typedef struct {
+   char                *db_file;
+   bool                 rewrite;    /* the whole database, else journal */
+   char                *data;
+   size_t               len;
+   meta_info          **files;      /* of a whole database, in its order */
+   int                  nfiles;
+   mi_sort_description  sorts[MEDIALIB_MAX_SORTS];
+   int                  nsorts;
+} db_snapshot;
+
+bool medialib_db_snapshot(const char *db_file, db_snapshot *snap);
+int  medialib_db_snapshot_write(db_snapshot *snap);
+void medialib_db_snapshot_free(db_snapshot *snap);
+
 /* update/add files to the database */
-void medialib_db_update(bool show_skipped, bool force_update);
-void medialib_db_scan_dirs(char *dirlist[]);
+void medialib_db_update(bool show_skipped, bool force_update, int njobs);
+void medialib_db_scan_dirs(char *dirlist[], int njobs, bool force);
 
 /* debug routine for dumping db contents to stdout */
 void medialib_db_flush(FILE *f, const char *time_fmt);
@@ -28,227 +28,478 @@ const char *MI_CINFO_NAMES[] = {
    "Comment"
 };
 
+/* decodes records loaded lazily, see mi_decode() */
+void (*mi_decoder)(meta_info *mi) = NULL;
+
+const bool MI_CINFO_INTERNED[] = {
+   true,    /* Artist */
+   true,    /* Album */
+   false,   /* Title */
+   false,   /* Track */
+   true,    /* Year */
+   true,    /* Genre */
+   false,   /* Length */
+   false    /* Comment */
+};
+
+/* reset a builder to an empty meta_info, keeping its buffer */
+static void
+mi_builder_reset(mi_builder *b)
+{
+   int i;
+
+   b->mi.filename = NULL;
+   b->mi.length = 0;
+   b->mi.index_id = 0;
+   b->mi.folded = NULL;
+   b->mi.pending = NULL;
+   b->mi.last_updated = 0;
+   b->mi.is_url = false;
+   b->mi.retired = false;
+   b->mi.storage = MI_STORAGE_HEAP;
+   for (i = 0; i < MI_NUM_CINFO; i++) {
+      b->mi.cinfo[i] = NULL;
+      b->cinfo[i] = 0;
+   }
+
+   b->filename = 0;
+   b->buf[0] = '\0';
+   b->len = 1;
+}
+
+void
+mi_builder_init(mi_builder *b)
+{
+   b->size = 256;
+   if ((b->buf = malloc(b->size)) == NULL)
+      err(1, "mi_builder_init: malloc failed");
+
+   mi_builder_reset(b);
+}
+
+void
+mi_builder_free(mi_builder *b)
+{
+   free(b->buf);
+   b->buf = NULL;
+   b->len = b->size = 0;
+}
+
+/* make room for a string of len characters, returning its offset */
+static size_t
+mi_builder_alloc(mi_builder *b, size_t len)
+{
+   size_t off;
+   char  *new_buf;
+
+   while (b->len + len + 1 > b->size) {
+      b->size *= 2;
+      if ((new_buf = realloc(b->buf, b->size)) == NULL)
+         err(1, "mi_builder_alloc: realloc failed");
+      b->buf = new_buf;
+   }
+
+   off = b->len;
+   b->len += len + 1;
+   b->buf[off + len] = '\0';
+   return off;
+}
+
+/* copy the string s into the buffer of a builder, returning its offset */
+static size_t
+mi_builder_str(mi_builder *b, const char *s)
+{
+   size_t len, off;
+
+   if (s == NULL)
+      return 0;
+
+   len = strlen(s);
+   off = mi_builder_alloc(b, len);
+   memcpy(b->buf + off, s, len);
+   return off;
+}
+
+void
+mi_builder_filename(mi_builder *b, const char *filename)
+{
+   b->filename = mi_builder_str(b, filename);
+}
+
+void
+mi_builder_cinfo(mi_builder *b, int field, const char *value)
+{
+   b->cinfo[field] = mi_builder_str(b, value);
+}
+
 /*
- * Create and return a new meta_info struct.  All memory is allocated, and
- * the resulting pointer should be free(3)'d using mi_free().
+ * Create the meta_info built so far, with its strings packed right after
+ * it, and reset the builder for the next one.  The result should be
+ * free(3)'d using mi_free().
  */
 meta_info *
-mi_new(void)
+mi_builder_finish(mi_builder *b)
 {
    meta_info *mi;
-   int i;
+   char      *blob;
+   int        i;
 
-   if ((mi = malloc(sizeof(meta_info))) == NULL)
-      err(1, "mi_new: meta_info malloc failed");
+   if ((mi = malloc(sizeof(meta_info) + b->len)) == NULL)
+      err(1, "mi_builder_finish: meta_info malloc failed");
 
-   mi->filename = NULL;
-   mi->length = 0;
-   mi->last_updated = 0;
-   mi->is_url = false;
+   *mi = b->mi;
+   blob = (char *) (mi + 1);
+   memcpy(blob, b->buf, b->len);
 
+   mi->filename = (b->filename == 0 ? NULL : blob + b->filename);
    for (i = 0; i < MI_NUM_CINFO; i++)
-      mi->cinfo[i] = NULL;
+      mi->cinfo[i] = (b->cinfo[i] == 0 ? NULL : blob + b->cinfo[i]);
+   mi->storage = MI_STORAGE_HEAP;
 
+   mi_builder_reset(b);
    return mi;
 }
 
-
-/* Function to free() all memory allocated by a given meta_info struct.  */
+/*
+ * Function to free() all memory allocated by a given meta_info struct.
+ * Records that live inside the mmap(2)'d database or the library's arena
+ * are released all at once by medialib_destroy() and are left alone here.
+ */
 void
 mi_free(meta_info *mi)
 {
-   int i;
+   if (mi->storage != MI_STORAGE_HEAP)
+      return;
 
-   if (mi->filename != NULL)
-      free(mi->filename);
+   mi_unfold(mi);
+   free(mi);
+}
 
-   for (i = 0; i < MI_NUM_CINFO; i++) {
-      if (mi->cinfo[i] != NULL)
-         free(mi->cinfo[i]);
+/*
+ * The letters of U+00C0 to U+00FF (0xc3 0x80 to 0xc3 0xbf in UTF-8) without
+ * their accents, by the second byte, or '\0' for those kept as they are.
+ */
+static const char mi_fold_latin1[64] =
+   "aaaaaa\0ceeeeiiiidnooooo\0ouuuuy\0\0"
+   "aaaaaa\0ceeeeiiiidnooooo\0ouuuuy\0y";
+
+size_t
+mi_fold(const char *s, char *out)
+{
+   const unsigned char *u;
+   size_t               len;
+   char                 c;
+
+   u = (const unsigned char *) s;
+   len = 0;
+   while (*u != '\0') {
+      if (u[0] == 0xc3 && u[1] >= 0x80 && u[1] <= 0xbf
+      &&  (c = mi_fold_latin1[u[1] - 0x80]) != '\0') {
+         out[len++] = c;
+         u += 2;
+      } else if (*u >= 'A' && *u <= 'Z') {
+         out[len++] = *u++ | 0x20;
+      } else
+         out[len++] = *u++;
    }
+   out[len] = '\0';
 
-   free(mi);
+   return len;
 }
 
-/* Function to write a meta_info struct to a file stream.  */
-void
-mi_fwrite(meta_info *mi, FILE *fout)
+/*
+ * the number a field starts with (a year or track), or -1 if none, after
+ * any blanks (tracks are stored right aligned, see mi_extract())
+ */
+static int
+mi_folded_number(const char *s)
 {
-   static uint16_t lengths[MI_NUM_CINFO + 1];   /* +1 for filename */
-   int i;
+   int n;
+
+   if (s == NULL)
+      return -1;
+   while (*s == ' ' || *s == '\t')
+      s++;
+   if (!isdigit((unsigned char) *s))
+      return -1;
+
+   for (n = 0; isdigit((unsigned char) *s) && n < INT_MAX / 10 - 9; s++)
+      n = n * 10 + (*s - '0');
+
+   return n;
+}
+
+/* build the folded text of a record, see mi_folded_get() */
+static mi_folded *
+mi_folded_build(const meta_info *mi)
+{
+   mi_folded *f;
+   char      *text;
+   size_t     size;
+   int        i;
 
-   /* store all necessary numeric values in the above array */
-   lengths[0] = strlen(mi->filename);
+   mi_decode(mi);
+   size = strlen(mi->filename) + 1;
+   for (i = 0; i < MI_NUM_CINFO; i++)
+      size += (mi->cinfo[i] == NULL ? 0 : strlen(mi->cinfo[i])) + 1;
+
+   if ((f = malloc(sizeof(mi_folded) + size)) == NULL)
+      err(1, "mi_folded_build: malloc failed");
+
+   text = (char *) (f + 1);
+   f->len = mi_fold(mi->filename, text) + 1;
+   f->cinfo = f->len;
    for (i = 0; i < MI_NUM_CINFO; i++) {
       if (mi->cinfo[i] == NULL)
-         lengths[i+1] = 0;
+         text[f->len++] = '\0';
       else
-         lengths[i+1] = strlen(mi->cinfo[i]);
+         f->len += mi_fold(mi->cinfo[i], text + f->len) + 1;
+   }
+   f->year = mi_folded_number(mi->cinfo[MI_CINFO_YEAR]);
+   f->track = mi_folded_number(mi->cinfo[MI_CINFO_TRACK]);
+
+   return f;
+}
+
+/*
+ * Like mi_decode(), this fills in a record that's otherwise unchanged, so
+ * it's done on const ones too.
+ */
+const mi_folded *
+mi_folded_get(const meta_info *mi)
+{
+   if (mi->folded == NULL)
+      ((meta_info *) mi)->folded = mi_folded_build(mi);
+
+   return mi->folded;
+}
+
+void
+mi_unfold(meta_info *mi)
+{
+   free(mi->folded);
+   mi->folded = NULL;
+}
+
+size_t
+mi_size(const meta_info *mi, bool interned)
+{
+   size_t size;
+   int    i;
+
+   mi_decode(mi);
+   size = sizeof(meta_info);
+   if (mi->filename != NULL)
+      size += strlen(mi->filename) + 1;
+   for (i = 0; i < MI_NUM_CINFO; i++) {
+      if (mi->cinfo[i] != NULL && !(interned && MI_CINFO_INTERNED[i]))
+         size += strlen(mi->cinfo[i]) + 1;
    }
 
-   /* write */
-   fwrite(lengths, sizeof(lengths), 1, fout);
-   fwrite(mi->filename, sizeof(char), lengths[0], fout);
+   return size;
+}
+
+/* copy a string to *pos, advancing it, and return the copy */
+static char *
+mi_pack_str(const char *s, char **pos)
+{
+   char   *copy;
+   size_t  len;
+
+   if (s == NULL)
+      return NULL;
+
+   len = strlen(s) + 1;
+   copy = memcpy(*pos, s, len);
+   *pos += len;
+   return copy;
+}
+
+meta_info *
+mi_pack(const meta_info *mi, void *mem, int storage, bool interned)
+{
+   meta_info *copy;
+   char      *pos;
+   int        i;
+
+   mi_decode(mi);
+   copy = mem;
+   *copy = *mi;
+   pos = (char *) (copy + 1);
+
+   copy->filename = mi_pack_str(mi->filename, &pos);
    for (i = 0; i < MI_NUM_CINFO; i++) {
-      if (mi->cinfo[i] != NULL)
-         fwrite(mi->cinfo[i], sizeof(char), lengths[i+1], fout);
+      if (!(interned && MI_CINFO_INTERNED[i]))
+         copy->cinfo[i] = mi_pack_str(mi->cinfo[i], &pos);
    }
-   fwrite(&(mi->length),   sizeof(int), 1, fout);
-   fwrite(&(mi->last_updated), sizeof(time_t),   1, fout);
-   fwrite(&(mi->is_url),       sizeof(bool),     1, fout);
+   copy->index_id = 0;
+   copy->folded = NULL;
+   copy->retired = false;
+   copy->storage = storage;
 
-   fflush(fout);
+   return copy;
 }
 
-/* Function to read a meta_info struct from a file stream */
+/* Function to read a meta_info struct from a buffered file into a builder */
 void
-mi_fread(meta_info *mi, FILE *fin)
+mi_fread(mi_builder *b, bufio *in)
 {
-   static uint16_t lengths[MI_NUM_CINFO + 1];   /* +1 for filename */
+   uint16_t lengths[MI_NUM_CINFO + 1];   /* +1 for filename */
    int i;
 
    /* first read all necessary numeric values */
-   fread(lengths, sizeof(lengths), 1, fin);
-
-   /* allocate all needed space in the meta_info struct, and zero */
-   if ((mi->filename = calloc(lengths[0] + 1, sizeof(char))) == NULL)
-      err(1, "mi_fread: calloc filename failed");
-
-   bzero(mi->filename, sizeof(char) * (lengths[0] + 1));
+   bzero(lengths, sizeof(lengths));
+   bufio_read(in, lengths, sizeof(lengths));
 
+   /* make room for all of the strings, then read them in place */
+   b->filename = mi_builder_alloc(b, lengths[0]);
    for (i = 0; i < MI_NUM_CINFO; i++) {
-      if (lengths[i+1] > 0) {
-         if ((mi->cinfo[i] = calloc(lengths[i+1] + 1, sizeof(char))) == NULL)
-            err(1, "mi_fread: failed to calloc cinfo");
-
-         bzero(mi->cinfo[i], sizeof(char) * (lengths[i+1] + 1));
-      }
+      if (lengths[i+1] > 0)
+         b->cinfo[i] = mi_builder_alloc(b, lengths[i+1]);
    }
 
    /* read */
-   fread(mi->filename, sizeof(char), lengths[0], fin);
+   bufio_read(in, b->buf + b->filename, lengths[0]);
    for (i = 0; i < MI_NUM_CINFO; i++) {
       if (lengths[i+1] > 0)
-         fread(mi->cinfo[i], sizeof(char), lengths[i+1], fin);
+         bufio_read(in, b->buf + b->cinfo[i], lengths[i+1]);
    }
-   fread(&(mi->length),       sizeof(int),      1, fin);
-   fread(&(mi->last_updated), sizeof(time_t),   1, fin);
-   fread(&(mi->is_url),       sizeof(bool),     1, fin);
+   bufio_read(in, &(b->mi.length),       sizeof(int));
+   bufio_read(in, &(b->mi.last_updated), sizeof(time_t));
+   bufio_read(in, &(b->mi.is_url),       sizeof(bool));
 }
 
-/* given a number of seconds s, format a "hh:mm::ss" string */
-char *
-time2str(int s)
+/* given a number of seconds s, format a "hh:mm::ss" string into str */
+static void
+time2buf(int s, char *str, size_t size)
 {
-   static char str[255];
    int hours, minutes, seconds;
 
-   if (s <= 0)
-      return "?";
-
    hours = s / 3600;
    minutes = s % 3600 / 60;
    seconds = s % 60;
 
    if (hours > 0)
-      snprintf(str, sizeof(str), "%i:%02i:%02i", hours, minutes, seconds);
+      snprintf(str, size, "%i:%02i:%02i", hours, minutes, seconds);
    else if (minutes > 0)
-      snprintf(str, sizeof(str), "%i:%02i", minutes, seconds);
+      snprintf(str, size, "%i:%02i", minutes, seconds);
    else
-      snprintf(str, sizeof(str), "%is", seconds);
+      snprintf(str, size, "%is", seconds);
+}
+
+/* given a number of seconds s, format a "hh:mm::ss" string */
+char *
+time2str(int s)
+{
+   static char str[255];
 
+   if (s <= 0)
+      return "?";
+
+   time2buf(s, str, sizeof(str));
    return str;
 }
 
+/*
+ * TagLib's C bindings keep global state: the string encoding, and a list of
+ * every string handed out so taglib_tag_free_strings() can release them.
+ * The latter isn't safe when mi_extract() runs on several threads at once,
+ * so it is turned off and each string is released with taglib_free().
+ */
+static pthread_once_t mi_taglib_once = PTHREAD_ONCE_INIT;
+
+static void
+mi_taglib_init(void)
+{
+   taglib_set_strings_unicode(false);
+   taglib_set_string_management_enabled(false);
+}
+
+/* copy a string returned by TagLib into a builder, releasing the original */
+static void
+mi_taglib_str(mi_builder *b, int field, char *str)
+{
+   if (str == NULL)
+      errx(1, "mi_extract: TagLib returned no %s", MI_CINFO_NAMES[field]);
+
+   mi_builder_cinfo(b, field, str);
+   taglib_free(str);
+}
 
 /*
  * Extract meta-information from the provided file, returning a new
  * meta_info* struct if any information was found, NULL if no information
- * was available.
+ * was available.  This may be called from several threads at once.
  */
 meta_info *
 mi_extract(const char *filename)
 {
-   static char fullname[PATH_MAX];
+   char fullname[PATH_MAX];
+   char buf[255];
    const TagLib_AudioProperties *properties;
    TagLib_File *file;
    TagLib_Tag  *tag;
-   char *str;
-
-   /* create new, empty meta info struct */
-   meta_info *mi = mi_new();
+   mi_builder   b;
+   meta_info   *mi;
 
    /* store full filename in meta_info struct */
    bzero(fullname, sizeof(fullname));
    if (realpath(filename, fullname) == NULL)
       err(1, "mi_extract: realpath failed to resolve '%s'", filename);
 
-   if ((mi->filename = strdup(fullname)) == NULL)
-      errx(1, "mi_extract: strdup failed for '%s'", fullname);
-
    /* start extracting fields using TagLib... */
 
-   taglib_set_strings_unicode(false);
+   pthread_once(&mi_taglib_once, mi_taglib_init);
 
-   if ((file = taglib_file_new(mi->filename)) == NULL
+   if ((file = taglib_file_new(fullname)) == NULL
     || !taglib_file_is_valid(file)) {
-      mi_free(mi);
+      if (file != NULL)
+         taglib_file_free(file);
       return NULL;
    }
 
+   /* create new, empty meta info struct */
+   mi_builder_init(&b);
+   mi_builder_filename(&b, fullname);
+
    /* extract tag-info + audio properties (length) */
    tag = taglib_file_tag(file);
    properties = taglib_file_audioproperties(file);
 
    /* artist/album/title/genre */
-   if ((str = taglib_tag_artist(tag)) != NULL)
-      mi->cinfo[MI_CINFO_ARTIST] = strdup(str);
-
-   if ((str = taglib_tag_album(tag)) != NULL)
-      mi->cinfo[MI_CINFO_ALBUM] = strdup(str);
-
-   if ((str = taglib_tag_title(tag)) != NULL)
-      mi->cinfo[MI_CINFO_TITLE] = strdup(str);
-
-   if ((str = taglib_tag_genre(tag)) != NULL)
-      mi->cinfo[MI_CINFO_GENRE] = strdup(str);
-
-   if ((str = taglib_tag_comment(tag)) != NULL)
-      mi->cinfo[MI_CINFO_COMMENT] = strdup(str);
-
-   if (mi->cinfo[MI_CINFO_ARTIST] == NULL
-   ||  mi->cinfo[MI_CINFO_ALBUM] == NULL
-   ||  mi->cinfo[MI_CINFO_TITLE] == NULL
-   ||  mi->cinfo[MI_CINFO_GENRE] == NULL
-   ||  mi->cinfo[MI_CINFO_COMMENT] == NULL)
-      err(1, "mi_extract: strdup for CINFO failed");
+   mi_taglib_str(&b, MI_CINFO_ARTIST,  taglib_tag_artist(tag));
+   mi_taglib_str(&b, MI_CINFO_ALBUM,   taglib_tag_album(tag));
+   mi_taglib_str(&b, MI_CINFO_TITLE,   taglib_tag_title(tag));
+   mi_taglib_str(&b, MI_CINFO_GENRE,   taglib_tag_genre(tag));
+   mi_taglib_str(&b, MI_CINFO_COMMENT, taglib_tag_comment(tag));
 
    /* track number */
    if (taglib_tag_track(tag) > 0) {
-      if (asprintf(&(mi->cinfo[MI_CINFO_TRACK]), "%3i", taglib_tag_track(tag)) == -1)
-         err(1, "mi_extract: asprintf failed for CINFO_TRACK");
+      snprintf(buf, sizeof(buf), "%3i", taglib_tag_track(tag));
+      mi_builder_cinfo(&b, MI_CINFO_TRACK, buf);
    }
 
    /* year */
    if (taglib_tag_year(tag) > 0) {
-      if (asprintf(&(mi->cinfo[MI_CINFO_YEAR]), "%i", taglib_tag_year(tag)) == -1)
-         err(1, "mi_extract: asprintf failed for CINFO_YEAR");
+      snprintf(buf, sizeof(buf), "%i", taglib_tag_year(tag));
+      mi_builder_cinfo(&b, MI_CINFO_YEAR, buf);
    }
 
    /* playlength in seconds (will be 0 if unavailable) */
-   mi->length = taglib_audioproperties_length(properties);
-   if (mi->length > 0) {
-      if ((mi->cinfo[MI_CINFO_LENGTH] = strdup(time2str(mi->length))) == NULL)
-         err(1, "mi_extract: strdup failed for CINO_LENGTH");
+   b.mi.length = taglib_audioproperties_length(properties);
+   if (b.mi.length > 0) {
+      time2buf(b.mi.length, buf, sizeof(buf));
+      mi_builder_cinfo(&b, MI_CINFO_LENGTH, buf);
    }
 
    /* record the time we extracted this info */
-   time(&mi->last_updated);
+   time(&b.mi.last_updated);
 
    /* cleanup */
-   taglib_tag_free_strings();
    taglib_file_free(file);
 
+   mi = mi_builder_finish(&b);
+   mi_builder_free(&b);
    return mi;
 }
 
@@ -289,6 +540,12 @@ mi_query_description _mi_query;
 /* global flag to indicate if we should match against filename in queires */
 bool mi_query_match_filename;
 
+/* errors allowed in text of new queries, see meta_info.h */
+int mi_query_fuzzy;
+
+/* bumped on every change to the global query */
+static unsigned int _mi_query_generation;
+
 /* initialize the query structures */
 void
 mi_query_init()
@@ -299,8 +556,10 @@ mi_query_init()
       _mi_query.tokens[i] = NULL;
 
    mi_query_match_filename = true;
+   mi_query_fuzzy = 0;
    _mi_query.raw = NULL;
    _mi_query.ntokens = 0;
+   _mi_query.nranked = 0;
 }
 
 /* determine if a query has been set */
@@ -319,6 +578,9 @@ mi_query_clear()
    for (i = 0; i < MI_MAX_QUERY_TOKENS; i++) {
       if (_mi_query.tokens[i] != NULL) {
          free(_mi_query.tokens[i]);
+         free(_mi_query.folded[i]);
+         substr_free(&(_mi_query.patterns[i]));
+         free(_mi_query.fuzzy[i]);
          _mi_query.tokens[i] = NULL;
       }
    }
@@ -329,25 +591,176 @@ mi_query_clear()
    }
 
    _mi_query.ntokens = 0;
+   _mi_query.nranked = 0;
+   _mi_query_generation++;
+}
+
+/*
+ * Parse the value of a numeric field, with its operator, returning false
+ * if it isn't a number.  A length may be given as [h:]m:ss.
+ */
+static bool
+mi_query_parse_number(const char *s, int field, int *op, int *value)
+{
+   int groups, n;
+
+   if (strncmp(s, "<=", 2) == 0 || strncmp(s, ">=", 2) == 0) {
+      *op = (s[0] == '<' ? MI_QUERY_LE : MI_QUERY_GE);
+      s += 2;
+   } else if (s[0] == '<' || s[0] == '>' || s[0] == '=') {
+      *op = (s[0] == '<' ? MI_QUERY_LT
+          : (s[0] == '>' ? MI_QUERY_GT : MI_QUERY_EQ));
+      s++;
+   } else
+      *op = MI_QUERY_EQ;
+
+   *value = 0;
+   for (groups = 0; groups < 3; groups++) {
+      if (!isdigit((unsigned char) *s))
+         return false;
+
+      for (n = 0; isdigit((unsigned char) *s); s++) {
+         if (n > 999999)
+            return false;
+         n = n * 10 + (*s - '0');
+      }
+      *value = *value * 60 + n;
+
+      if (*s == '\0')
+         return true;
+      if (*s != ':' || field != MI_CINFO_LENGTH)
+         return false;
+      s++;
+   }
+
+   return false;
+}
+
+/*
+ * The field a token is qualified by, returning MI_QUERY_ANY if it isn't,
+ * and setting value to what follows the ':' if it is.
+ */
+static int
+mi_query_parse_field(const char *token, const char **value)
+{
+   const char *colon;
+   size_t      len;
+   int         i;
+
+   if ((colon = strchr(token, ':')) == NULL)
+      return MI_QUERY_ANY;
+
+   len = colon - token;
+   if (len == strlen("filename") && strncasecmp(token, "filename", len) == 0) {
+      *value = colon + 1;
+      return MI_QUERY_FILENAME;
+   }
+
+   for (i = 0; i < MI_NUM_CINFO; i++) {
+      if (strlen(MI_CINFO_NAMES[i]) == len
+      &&  strncasecmp(token, MI_CINFO_NAMES[i], len) == 0) {
+         *value = colon + 1;
+         return i;
+      }
+   }
+
+   return MI_QUERY_ANY;
+}
+
+/* how costly a token is to match, the order of the plan */
+static int
+mi_query_cost(int i)
+{
+   int cost;
+
+   if (_mi_query.op[i] == MI_QUERY_FUZZY)
+      cost = 4;
+   else if (_mi_query.op[i] != MI_QUERY_CONTAINS)
+      cost = (_mi_query.field[i] == MI_CINFO_LENGTH ? 0 : 1);
+   else
+      cost = (_mi_query.field[i] == MI_QUERY_ANY ? 3 : 2);
+
+   /* a token that must match rules out more than a negated one */
+   return cost * 2 + (_mi_query.match[i] ? 0 : 1);
 }
 
 /* add a token to the current query description */
 void
 mi_query_add_token(const char *token)
 {
+   const char *value;
+   size_t      len;
+   bool        fuzzy;
+   int         field, errors;
+   int         i, j;
+
    if (_mi_query.ntokens == MI_MAX_QUERY_TOKENS)
       errx(1, "mi_query_add_token: reached shamefull limit");
 
    /* match or no? */
-   if (token[0] == '!') {
-      _mi_query.match[_mi_query.ntokens] = false;
+   i = _mi_query.ntokens;
+   if (token[0] == '!'
+   ||  (token[0] == '-' && mi_query_parse_field(token + 1, &value)
+                           != MI_QUERY_ANY)) {
+      _mi_query.match[i] = false;
       token++;
    } else
-      _mi_query.match[_mi_query.ntokens] = true;
+      _mi_query.match[i] = true;
+
+   /* a field, and a number to compare or text to find */
+   value = token;
+   field = mi_query_parse_field(token, &value);
+   if ((fuzzy = (value[0] == '~')))
+      value++;
+
+   _mi_query.field[i] = field;
+   _mi_query.op[i] = MI_QUERY_CONTAINS;
+   _mi_query.value[i] = 0;
+   if (!fuzzy
+   &&  (field == MI_CINFO_TRACK || field == MI_CINFO_YEAR
+   ||   field == MI_CINFO_LENGTH)
+   &&  !mi_query_parse_number(value, field, &(_mi_query.op[i]),
+                              &(_mi_query.value[i])))
+      _mi_query.op[i] = MI_QUERY_CONTAINS;
+
+   /* copy token, and fold its text once for matching */
+   _mi_query.ntokens++;
+   _mi_query.tokens[i] = strdup(token);
+   _mi_query.folded[i] = malloc(strlen(value) + 1);
+   if (_mi_query.tokens[i] == NULL || _mi_query.folded[i] == NULL)
+      err(1, "mi_query_add_token: failed to copy token");
+
+   len = mi_fold(value, _mi_query.folded[i]);
+   _mi_query.folded_len[i] = len;
+   substr_init(&(_mi_query.patterns[i]),
+      (fuzzy && field == MI_QUERY_ANY ? value : token));
+
+   /* text may be fuzzy, if it's long enough to have an error */
+   errors = (mi_query_fuzzy > 0 ? mi_query_fuzzy
+          : (fuzzy ? MI_QUERY_FUZZY_ERRORS : 0));
+   if (errors > (int) (len / MI_QUERY_FUZZY_PER))
+      errors = (int) (len / MI_QUERY_FUZZY_PER);
+
+   _mi_query.fuzzy[i] = NULL;
+   if (_mi_query.op[i] == MI_QUERY_CONTAINS && errors > 0
+   &&  len <= BITAP_MAX_LEN) {
+      if ((_mi_query.fuzzy[i] = malloc(sizeof(bitap_pattern))) == NULL)
+         err(1, "mi_query_add_token: malloc failed");
+
+      bitap_init(_mi_query.fuzzy[i], _mi_query.folded[i], len);
+      _mi_query.op[i] = MI_QUERY_FUZZY;
+      _mi_query.value[i] = errors;
+      if (_mi_query.match[i])
+         _mi_query.nranked++;
+   }
 
-   /* copy token */
-   if ((_mi_query.tokens[_mi_query.ntokens++] = strdup(token)) == NULL)
-      err(1, "mi_query_add_token: strdup failed");
+   /* and place it in the plan, after those no more costly */
+   for (j = i; j > 0 && mi_query_cost(_mi_query.plan[j - 1])
+                         > mi_query_cost(i); j--)
+      _mi_query.plan[j] = _mi_query.plan[j - 1];
+   _mi_query.plan[j] = i;
+
+   _mi_query_generation++;
 }
 
 void
@@ -366,39 +779,129 @@ mi_query_getraw()
    return _mi_query.raw;
 }
 
-/* match a given meta_info struct against the global query */
-bool
-mi_match(const meta_info *mi)
+const mi_query_description *
+mi_query_get(void)
 {
-   bool  matches;
-   int   i, j;
+   return &_mi_query;
+}
 
-   for (i = 0; i < _mi_query.ntokens; i++) {
+unsigned int
+mi_query_generation(void)
+{
+   return _mi_query_generation;
+}
 
-      matches = false;
+/* compare a number of a record (-1 if unknown) to that of a token */
+static bool
+mi_query_compare(int n, int op, int value)
+{
+   if (n < 0)
+      return false;
+
+   switch (op) {
+      case MI_QUERY_LT:
+         return n < value;
+      case MI_QUERY_LE:
+         return n <= value;
+      case MI_QUERY_GT:
+         return n > value;
+      case MI_QUERY_GE:
+         return n >= value;
+      default:
+         return n == value;
+   }
+}
 
-      /* does the filename match? */
-      if (mi_query_match_filename) {
-         if ((strcasestr(mi->filename, _mi_query.tokens[i])) != NULL)
-            matches = true;
-      }
+/*
+ * Match a meta_info against token i of a query, folding it (in f) only if
+ * needed, returning the errors it's found with (0 unless it's fuzzy), or
+ * -1 if it isn't.  The length is compared without even decoding it (a
+ * length of 0 is unknown, as for a URL, like a missing year or track).
+ * Text is a memmem(3) or bitap_find() through (a field of) the folded
+ * text, as both sides are folded (see mi_fold()).
+ */
+static int
+mi_match_token(const mi_query_description *q, const meta_info *mi,
+   const mi_folded **f, int i)
+{
+   const char *text;
+   size_t      start, len;
+   int         field;
+
+   field = q->field[i];
+   if (q->op[i] != MI_QUERY_CONTAINS && q->op[i] != MI_QUERY_FUZZY
+   &&  field == MI_CINFO_LENGTH)
+      return mi_query_compare(mi->length > 0 ? mi->length : -1, q->op[i],
+                              q->value[i]) ? 0 : -1;
+
+   if (*f == NULL)
+      *f = mi_folded_get(mi);
+
+   if (q->op[i] != MI_QUERY_CONTAINS && q->op[i] != MI_QUERY_FUZZY)
+      return mi_query_compare(field == MI_CINFO_YEAR ? (*f)->year
+                              : (*f)->track, q->op[i],
+                              q->value[i]) ? 0 : -1;
+
+   /* where to look: everything, or just one of the fields */
+   text = MI_FOLDED_TEXT(*f);
+   if (field == MI_QUERY_ANY) {
+      start = (mi_query_match_filename ? 0 : (*f)->cinfo);
+      len = (*f)->len - start;
+   } else if (field == MI_QUERY_FILENAME) {
+      start = 0;
+      len = (*f)->cinfo - 1;
+   } else {
+      for (start = (*f)->cinfo; field > 0; field--)
+         start += strlen(text + start) + 1;
+      len = strlen(text + start);
+   }
 
-      /* do any of the CINFO fields match? */
-      for (j = 0; !matches && j < MI_NUM_CINFO; j++) {
-         if (mi->cinfo[j] == NULL)
-            continue;
+   if (q->op[i] == MI_QUERY_FUZZY)
+      return bitap_find(q->fuzzy[i], text + start, len, q->value[i]);
 
-         if ((strcasestr(mi->cinfo[j], _mi_query.tokens[i])) != NULL)
-            matches = true;
-      }
+   return memmem(text + start, len, q->folded[i],
+                 q->folded_len[i]) != NULL ? 0 : -1;
+}
 
-      if (!matches && _mi_query.match[i])
-         return false;
-      if (matches && !_mi_query.match[i])
-         return false;
+/*
+ * Match a given meta_info struct against a query, trying its tokens in the
+ * order of the plan, so the cheapest rule it out first.  Nothing is changed
+ * but the folded text of the record (see mi_folded_get()), so this can be
+ * done from several threads at once, as long as no two fold the same
+ * record, and neither the query nor mi_query_match_filename change.
+ */
+int
+mi_match_score(const mi_query_description *q, const meta_info *mi)
+{
+   const mi_folded *f;
+   int              errors, score;
+   int              i, k;
+
+   f = NULL;
+   score = 0;
+   for (k = 0; k < q->ntokens; k++) {
+      i = q->plan[k];
+      errors = mi_match_token(q, mi, &f, i);
+      if ((errors >= 0) != (bool) q->match[i])
+         return -1;
+      if (errors > 0)
+         score += errors;
    }
 
-   return true;
+   return score;
+}
+
+bool
+mi_match_query(const mi_query_description *q, const meta_info *mi)
+{
+   return mi_match_score(q, mi) >= 0;
+}
+
+/* match a given meta_info struct against the global query */
+bool
+mi_match(const meta_info *mi)
+{
+   return mi_match_query(&_mi_query, mi);
 }
 
 /*
@@ -413,7 +916,7 @@ str_match_query(const char *s)
 
    for (i = 0; i < _mi_query.ntokens; i++) {
       matches = false;
-      if (strcasestr(s, _mi_query.tokens[i]) != NULL)
+      if (substr_find(&(_mi_query.patterns[i]), s) != NULL)
          matches = true;
       if (!matches && _mi_query.match[i])
          return false;
@@ -544,6 +1047,13 @@ err:
    return 1;
 }
 
+/* copy the global sort description */
+void
+mi_sort_get(mi_sort_description *d)
+{
+   memcpy(d, &_mi_sort, sizeof(mi_sort_description));
+}
+
 /*
  * Compare two meta_info structs using the global sort description
  * Note that this function is suitable for passing to qsort(3) and the like.
@@ -553,33 +1063,319 @@ err:
 int
 mi_compare(const void *A, const void *B)
 {
-   int field;
-   int ret;
-   int i;
-
    const meta_info **a2 = (const meta_info**) A;
    const meta_info **b2 = (const meta_info**) B;
-   const meta_info *a = *a2;
-   const meta_info *b = *b2;
 
-   for (i = 0; i < _mi_sort.nfields; i++) {
-      field = _mi_sort.order[i];
+   return mi_compare_desc(*a2, *b2, &_mi_sort);
+}
+
+/* fields sorted by their numeric value, rather than as strings */
+static bool
+mi_sort_numeric(int field)
+{
+   return field == MI_CINFO_TRACK || field == MI_CINFO_YEAR
+       || field == MI_CINFO_LENGTH;
+}
+
+static long
+mi_sort_number(const meta_info *mi, int field)
+{
+   if (field == MI_CINFO_LENGTH)
+      return mi->length;
+
+   return strtol(mi->cinfo[field], NULL, 10);
+}
+
+/*
+ * Compare two meta_info structs using the given sort description, which
+ * (unlike mi_compare()) is safe to do from any thread, once both are
+ * decoded.  Files missing a field sort after those that have it, and
+ * tracks, years and lengths sort by number.
+ */
+int
+mi_compare_desc(const meta_info *a, const meta_info *b,
+   const mi_sort_description *d)
+{
+   long na, nb;
+   int  field;
+   int  ret;
+   int  i;
+
+   mi_decode(a);
+   mi_decode(b);
+   for (i = 0; i < d->nfields; i++) {
+      field = d->order[i];
 
       if (a->cinfo[field] == NULL && b->cinfo[field] == NULL)
-         return 0;
+         continue;
       if (a->cinfo[field] != NULL && b->cinfo[field] == NULL)
-         return (_mi_sort.descending[i] ? 1 : -1);
+         return (d->descending[i] ? 1 : -1);
       if (a->cinfo[field] == NULL && b->cinfo[field] != NULL)
-         return (_mi_sort.descending[i] ? -1 : 1);
+         return (d->descending[i] ? -1 : 1);
+
+      if (mi_sort_numeric(field)) {
+         na = mi_sort_number(a, field);
+         nb = mi_sort_number(b, field);
+         ret = (na > nb) - (na < nb);
+         if (ret != 0)
+            return (d->descending[i] ? -1 * ret : ret);
+         continue;
+      }
+
+      /* interned values of the library are equal only if they're the same */
+      if (a->cinfo[field] == b->cinfo[field])
+         continue;
 
       ret = strcasecmp(a->cinfo[field], b->cinfo[field]);
       if (ret != 0)
-         return (_mi_sort.descending[i] ? -1 * ret : ret);
+         return (d->descending[i] ? -1 * ret : ret);
    }
 
    return 0;
 }
 
+/*
+ * Build the sort key of a meta_info (into key, if not NULL), returning its
+ * length.  Each field of the description adds a byte saying if it's there
+ * (1) or not (2), then, if it is, either its number as 4 big-endian bytes
+ * (offset so negatives sort first), or its case-folded string ended by a
+ * 0.  The bytes of a descending field are all inverted.  Comparing two keys
+ * with memcmp(3) then gives the order of mi_compare_desc().
+ */
+static size_t
+mi_sort_key(const meta_info *mi, const mi_sort_description *d,
+   unsigned char *key)
+{
+   const unsigned char *s;
+   uint32_t             u;
+   size_t               len, start;
+   long                 n;
+   int                  field, i, j;
+
+   mi_decode(mi);
+   len = 0;
+   for (i = 0; i < d->nfields; i++) {
+      field = d->order[i];
+      start = len;
+
+      if (mi->cinfo[field] == NULL) {
+         if (key != NULL)
+            key[len] = 2;
+         len++;
+      } else if (mi_sort_numeric(field)) {
+         n = mi_sort_number(mi, field);
+         if (n > INT32_MAX)
+            n = INT32_MAX;
+         if (n < INT32_MIN)
+            n = INT32_MIN;
+
+         if (key != NULL) {
+            u = (uint32_t) n ^ 0x80000000;
+            key[len]     = 1;
+            key[len + 1] = (u >> 24) & 0xff;
+            key[len + 2] = (u >> 16) & 0xff;
+            key[len + 3] = (u >> 8) & 0xff;
+            key[len + 4] = u & 0xff;
+         }
+         len += 5;
+      } else {
+         s = (const unsigned char *) mi->cinfo[field];
+         if (key != NULL) {
+            key[len] = 1;
+            for (j = 0; s[j] != '\0'; j++)
+               key[len + 1 + j] = tolower(s[j]);
+            key[len + 1 + j] = '\0';
+         }
+         len += strlen(mi->cinfo[field]) + 2;
+      }
+
+      if (key != NULL && d->descending[i]) {
+         for (; start < len; start++)
+            key[start] = ~key[start];
+      }
+   }
+
+   return len;
+}
+
+/* a part of the files to sort, see mi_sort_perm() */
+typedef struct {
+   meta_info                 **files;
+   const mi_sort_description  *d;
+   radix_item                 *items;
+   int                         start;
+   int                         n;
+   unsigned char              *keys;
+} mi_sort_part;
+
+/* key and sort the files of a part */
+static void *
+mi_sort_part_run(void *arg)
+{
+   mi_sort_part  *part = (mi_sort_part *) arg;
+   radix_item    *items;
+   unsigned char *new_keys;
+   size_t         size, capacity;
+   int            i;
+
+   /* all of the keys go one after the other in a buffer */
+   items = part->items;
+   size = 0;
+   capacity = 64 * (size_t) part->n + 1;
+   if ((part->keys = malloc(capacity)) == NULL)
+      err(1, "mi_sort_part_run: malloc failed");
+
+   for (i = 0; i < part->n; i++) {
+      items[i].len = mi_sort_key(part->files[part->start + i], part->d, NULL);
+      items[i].idx = part->start + i;
+
+      if (size + items[i].len > capacity) {
+         capacity = 2 * capacity + items[i].len;
+         if ((new_keys = realloc(part->keys, capacity)) == NULL)
+            err(1, "mi_sort_part_run: realloc failed");
+         part->keys = new_keys;
+      }
+      mi_sort_key(part->files[part->start + i], part->d, part->keys + size);
+      size += items[i].len;
+   }
+
+   /* which is only pointed into once it stops moving */
+   size = 0;
+   for (i = 0; i < part->n; i++) {
+      items[i].key = part->keys + size;
+      size += items[i].len;
+   }
+
+   radix_sort(items, part->n);
+   return NULL;
+}
+
+/* two sorted runs to merge, see mi_sort_perm() */
+typedef struct {
+   const radix_item  *a;
+   size_t             na;
+   const radix_item  *b;
+   size_t             nb;
+   radix_item        *out;
+} mi_sort_merge;
+
+static void *
+mi_sort_merge_run(void *arg)
+{
+   mi_sort_merge *m = (mi_sort_merge *) arg;
+
+   radix_merge(m->a, m->na, m->b, m->nb, m->out);
+   return NULL;
+}
+
+/*
+ * The files are split in consecutive parts, one per thread, which are
+ * merged pairwise (again by a thread per pair) until one run is left.
+ * Parts and runs are always merged in order, with ties taken from the
+ * earlier one, so the result is the same however many threads are used.
+ */
+void
+mi_sort_perm(meta_info **files, int n, const mi_sort_description *d,
+   uint32_t *perm)
+{
+   mi_sort_part   parts[MI_SORT_MAX_THREADS];
+   mi_sort_merge  merges[MI_SORT_MAX_THREADS];
+   pthread_t      threads[MI_SORT_MAX_THREADS];
+   radix_item    *items, *tmp, *src, *dst;
+   int            bounds[MI_SORT_MAX_THREADS + 1];
+   int            nthreads, nruns, nmerges, i;
+
+   nthreads = nthreads_for(n, MI_SORT_MIN_PER_THREAD, MI_SORT_MAX_THREADS);
+   items = calloc(n + 1, sizeof(radix_item));
+   tmp = calloc(nthreads > 1 ? n + 1 : 1, sizeof(radix_item));
+   if (items == NULL || tmp == NULL)
+      err(1, "mi_sort_perm: calloc failed");
+
+   for (i = 0; i < nthreads; i++) {
+      bounds[i] = (int) ((long long) n * i / nthreads);
+      parts[i].files = files;
+      parts[i].d = d;
+      parts[i].items = items + bounds[i];
+      parts[i].start = bounds[i];
+      parts[i].n = (int) ((long long) n * (i + 1) / nthreads) - bounds[i];
+   }
+   bounds[nthreads] = n;
+
+   /* the calling thread takes the first part itself */
+   for (i = 1; i < nthreads; i++) {
+      if ((errno = pthread_create(&threads[i], NULL, mi_sort_part_run,
+                                  &parts[i])) != 0)
+         err(1, "mi_sort_perm: pthread_create failed");
+   }
+   mi_sort_part_run(&parts[0]);
+   for (i = 1; i < nthreads; i++)
+      pthread_join(threads[i], NULL);
+
+   /* merge runs pairwise, back and forth between items and tmp */
+   src = items;
+   dst = tmp;
+   for (nruns = nthreads; nruns > 1; nruns = nmerges + nruns % 2) {
+      nmerges = nruns / 2;
+      for (i = 0; i < nmerges; i++) {
+         merges[i].a = src + bounds[2 * i];
+         merges[i].na = bounds[2 * i + 1] - bounds[2 * i];
+         merges[i].b = src + bounds[2 * i + 1];
+         merges[i].nb = bounds[2 * i + 2] - bounds[2 * i + 1];
+         merges[i].out = dst + bounds[2 * i];
+      }
+      if (nruns % 2 == 1)
+         memcpy(dst + bounds[nruns - 1], src + bounds[nruns - 1],
+            (n - bounds[nruns - 1]) * sizeof(radix_item));
+
+      for (i = 1; i < nmerges; i++) {
+         if ((errno = pthread_create(&threads[i], NULL, mi_sort_merge_run,
+                                     &merges[i])) != 0)
+            err(1, "mi_sort_perm: pthread_create failed");
+      }
+      mi_sort_merge_run(&merges[0]);
+      for (i = 1; i < nmerges; i++)
+         pthread_join(threads[i], NULL);
+
+      for (i = 0; i < nmerges; i++)
+         bounds[i] = bounds[2 * i];
+      if (nruns % 2 == 1)
+         bounds[nmerges] = bounds[nruns - 1];
+      bounds[nmerges + nruns % 2] = n;
+
+      src = dst;
+      dst = (dst == tmp ? items : tmp);
+   }
+
+   for (i = 0; i < n; i++)
+      perm[i] = src[i].idx;
+
+   for (i = 0; i < nthreads; i++)
+      free(parts[i].keys);
+   free(items);
+   free(tmp);
+}
+
+void
+mi_sort_files(meta_info **files, int n, const mi_sort_description *d)
+{
+   meta_info **sorted;
+   uint32_t   *perm;
+   int         i;
+
+   perm = calloc(n + 1, sizeof(uint32_t));
+   sorted = calloc(n + 1, sizeof(meta_info*));
+   if (perm == NULL || sorted == NULL)
+      err(1, "mi_sort_files: calloc failed");
+
+   mi_sort_perm(files, n, d, perm);
+   for (i = 0; i < n; i++)
+      sorted[i] = files[perm[i]];
+   memcpy(files, sorted, n * sizeof(meta_info*));
+
+   free(sorted);
+   free(perm);
+}
+
 
 /*****************************************************************************
  * mi_display_* stuff
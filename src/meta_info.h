@@ -23,6 +23,7 @@
 #include <limits.h>
 #include <err.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdbool.h> 
 #include <stdint.h>
 #include <stdio.h>
@@ -30,12 +31,19 @@
 #include <string.h>
 #include <strings.h>
 #include <time.h>
+#include <unistd.h>
 
 /* non-baes includes (just TagLib) */
 #include <tag_c.h>
 
 #include "debug.h"
 #include "enums.h"
+#include "util/bitap.h"
+#include "util/bufio.h"
+#include "util/nthreads.h"
+#include "util/radix.h"
+#include "util/substr.h"
+#include "util/trigram.h"
 
 /* the character-info fields.  used for all meta-info that's shown */
 #define MI_NUM_CINFO     8
@@ -48,15 +56,52 @@
 #define MI_CINFO_LENGTH  6
 #define MI_CINFO_COMMENT 7
 
-/* struct used to represent all meta information from a given file */
+/* where the memory of a meta_info lives (see mi_free) */
+#define MI_STORAGE_HEAP  0    /* a single malloc(3)'d block, see mi_builder */
+#define MI_STORAGE_DB    1    /* part of the mmap(2)'d database, owns nothing */
+#define MI_STORAGE_ARENA 2    /* allocated from the library's arena */
+
+/*
+ * struct used to represent all meta information from a given file.  Its
+ * strings are never allocated on their own: they either point into the
+ * database (MI_STORAGE_DB) or into a packed blob of strings that follows
+ * the struct in the same allocation (MI_STORAGE_HEAP, see mi_builder).
+ *
+ * The cinfo array of a record of the database is only decoded the first
+ * time it's needed: until then, 'pending' points to where it's decoded
+ * from, and anything reading cinfo must call mi_decode() first.
+ *
+ * A record of the library that is in its trigram index (see medialib.h)
+ * has a non-zero index_id there.  Copies of a record must not keep it, nor
+ * its folded text (see mi_folded()).
+ */
+struct mi_folded;
 typedef struct {
    char       *filename;               /* filename of file itself */
    char       *cinfo[MI_NUM_CINFO];    /* character meta info array */
+   const void *pending;                /* cinfo not decoded yet if set */
    int         length;                 /* play length in seconds */
+   uint32_t    index_id;               /* in the library's trigram index */
+   struct mi_folded *folded;           /* text to match, NULL until built */
    time_t      last_updated;           /* last time info was extracted */
    bool        is_url;                 /* if this is a url */
+   bool        retired;                /* replaced in the library */
+   int         storage;                /* one of MI_STORAGE_* above */
 } meta_info;
 
+/*
+ * Decode the cinfo array of a meta_info, if it's still pending, through
+ * mi_decoder (set by whoever loads records lazily, see medialib.c).  This
+ * fills in a record that's otherwise unchanged, so it's done on const ones
+ * too.
+ */
+extern void (*mi_decoder)(meta_info *mi);
+#define mi_decode(mi) \
+   do { \
+      if ((mi)->pending != NULL) \
+         mi_decoder((meta_info *) (mi)); \
+   } while (0)
+
 /*
  * XXX Note in the above that the playlength is stored both numerically
  * in the member 'length' and as a character string in the cinfo array
@@ -66,13 +111,76 @@ typedef struct {
 /* array of human-readable names of each CINFO member */
 extern const char *MI_CINFO_NAMES[MI_NUM_CINFO];
 
-/* create/destroy meta_info structs */
-meta_info *mi_new(void);
+/*
+ * the CINFO members whose values repeat a lot, and are shared between the
+ * records of the library rather than copied into each (see medialib.h)
+ */
+extern const bool MI_CINFO_INTERNED[MI_NUM_CINFO];
+
+/*
+ * Used to build a meta_info in a single allocation.  The strings are
+ * copied into a buffer as they are set, and mi_builder_finish() allocates
+ * the meta_info and its strings at once.  The numeric fields are set in
+ * the 'mi' member directly.  As in the database, offset 0 of the buffer is
+ * a '\0' and means NULL.
+ */
+typedef struct {
+   meta_info   mi;
+   size_t      filename;               /* offsets into buf */
+   size_t      cinfo[MI_NUM_CINFO];
+   char       *buf;
+   size_t      len;
+   size_t      size;
+} mi_builder;
+
+void mi_builder_init(mi_builder *b);
+void mi_builder_free(mi_builder *b);
+void mi_builder_filename(mi_builder *b, const char *filename);
+void mi_builder_cinfo(mi_builder *b, int field, const char *value);
+meta_info *mi_builder_finish(mi_builder *b);
+
+/* destroy meta_info structs */
 void mi_free(meta_info *info);
 
-/* read/write meta_info structs to a file */
-void mi_fwrite(meta_info *mi, FILE *fout);
-void mi_fread(meta_info *mi,  FILE *fin);
+/*
+ * The text a query is matched against, folded (see mi_fold()): the
+ * filename and each of the cinfo, in that order, each followed by a '\0'
+ * (an empty one for a NULL cinfo), so one search goes through all of them
+ * but a match never spans two.  It's built the first time it's needed and
+ * kept with the record, and so must be dropped, with mi_unfold(), if the
+ * record is ever changed in place.
+ */
+typedef struct mi_folded {
+   size_t      len;      /* of the text that follows, with the '\0's */
+   size_t      cinfo;    /* where in it the cinfo start */
+   int         year;     /* the numbers the year/track start with, or -1 */
+   int         track;
+} mi_folded;
+#define MI_FOLDED_TEXT(f)  ((const char *) ((f) + 1))
+
+const mi_folded *mi_folded_get(const meta_info *mi);
+void mi_unfold(meta_info *mi);
+
+/*
+ * Fold a string for matching: lower case, with the accents of the latin-1
+ * letters (in UTF-8) taken off.  out must have room for strlen(s) + 1
+ * bytes, as folding never makes a string longer.  Returns the length of
+ * the folded string.
+ */
+size_t mi_fold(const char *s, char *out);
+
+/*
+ * Copy a meta_info, with its strings packed right after it, into mi_size()
+ * bytes of memory allocated elsewhere (an arena, for example).  If interned
+ * is set, the MI_CINFO_INTERNED fields are not copied: they must already
+ * point to strings that outlive the copy.
+ */
+size_t mi_size(const meta_info *mi, bool interned);
+meta_info *mi_pack(const meta_info *mi, void *mem, int storage,
+   bool interned);
+
+/* read meta_info structs from a file (DB_VERSION 2 format) */
+void mi_fread(mi_builder *b, bufio *in);
 
 /* used to extract meta info from a media file */
 meta_info* mi_extract(const char *filename);
@@ -105,18 +213,70 @@ void mi_sanitize(meta_info *mi);
  * given meta_info against this global query description.
  ****************************************************************************/
 
+/*
+ * Each token is either plain text, found anywhere in a record (its
+ * filename too, if mi_query_match_filename is set), or qualified by the
+ * name of a field, "field:value", as in
+ *
+ *    artist:beatles year:>=1965 length:<5:00 !genre:live
+ *
+ * The text of a qualified token must be found in that field (one of
+ * MI_CINFO_NAMES, or "filename").  The track, year and length take a
+ * number instead, compared with =, <, <=, > or >= (= if none is given),
+ * where a length is in seconds or [h:]m:ss.  A value that isn't such a
+ * number is just text to find in the field.  A token is negated by a '!'
+ * or, if it's qualified, a '-' before it.
+ *
+ * Text is found approximately, with a few typos (see bitap.h), if it
+ * starts with a '~' ("~beatls", "artist:~beatls") or mi_query_fuzzy is
+ * set.  It's then allowed an error per MI_QUERY_FUZZY_PER letters, up to
+ * mi_query_fuzzy (or MI_QUERY_FUZZY_ERRORS, for a '~' when it isn't set),
+ * and must be no longer than BITAP_MAX_LEN.  mi_match_score() tells how
+ * many errors a record matched with, which filters rank their results by.
+ *
+ * As each token is added it's parsed once, and placed in the plan, the
+ * order tokens are tried in by mi_match(): numbers before text, a field
+ * before all of them, fuzzy text last, and tokens that must match before
+ * negated ones.
+ */
+#define MI_QUERY_ANY       -1               /* field of plain text */
+#define MI_QUERY_FILENAME  MI_NUM_CINFO
+
+#define MI_QUERY_CONTAINS  0                /* operators */
+#define MI_QUERY_EQ        1
+#define MI_QUERY_LT        2
+#define MI_QUERY_LE        3
+#define MI_QUERY_GT        4
+#define MI_QUERY_GE        5
+#define MI_QUERY_FUZZY     6                /* value is the errors allowed */
+
+#define MI_QUERY_FUZZY_PER      4
+#define MI_QUERY_FUZZY_ERRORS   2
+
 /* structure used to describe what to match meta_info's against */
 #define MI_MAX_QUERY_TOKENS   255
 typedef struct {
-   char *tokens[MI_MAX_QUERY_TOKENS];
-   char  match[MI_MAX_QUERY_TOKENS];
-   int   ntokens;
-   char *raw;  /* a copy of the original, un-tokenized query */
+   char           *tokens[MI_MAX_QUERY_TOKENS];    /* without the '!' */
+   char           *folded[MI_MAX_QUERY_TOKENS];    /* text, see mi_fold() */
+   size_t          folded_len[MI_MAX_QUERY_TOKENS];
+   substr_pattern  patterns[MI_MAX_QUERY_TOKENS];  /* of each token */
+   bitap_pattern  *fuzzy[MI_MAX_QUERY_TOKENS];     /* of fuzzy text */
+   char            match[MI_MAX_QUERY_TOKENS];
+   int             field[MI_MAX_QUERY_TOKENS];     /* MI_CINFO_*, or above */
+   int             op[MI_MAX_QUERY_TOKENS];        /* MI_QUERY_* above */
+   int             value[MI_MAX_QUERY_TOKENS];     /* number compared to */
+   int             plan[MI_MAX_QUERY_TOKENS];      /* tokens in order */
+   int             ntokens;
+   int             nranked;  /* fuzzy tokens that must match */
+   char           *raw;  /* a copy of the original, un-tokenized query */
 } mi_query_description;
 
 /* flag to indicate if we should include filename when matching */
 extern bool mi_query_match_filename;
 
+/* errors allowed in all text of new queries, 0 to find it exactly */
+extern int mi_query_fuzzy;
+
 /* initialize, set, and clear global query description */
 void mi_query_init();
 bool mi_query_isset();
@@ -126,10 +286,35 @@ void mi_query_add_token(const char *token);
 void mi_query_setraw(const char *query);
 const char *mi_query_getraw();
 
+/* the tokens of the global query, and a count of the changes made to it */
+const mi_query_description *mi_query_get(void);
+unsigned int mi_query_generation(void);
+
 /* match a given meta_info/string against the global query description */
 bool mi_match(const meta_info *mi);
 bool str_match_query(const char *s);
 
+/*
+ * Match a meta_info against a given query, such as mi_query_get(), which
+ * several threads may do at once (see meta_info.c and playlist_filter()).
+ */
+bool mi_match_query(const mi_query_description *q, const meta_info *mi);
+
+/*
+ * The same, but telling how well it matches: the errors of its fuzzy text
+ * in all, or -1 if it doesn't match.
+ */
+int mi_match_score(const mi_query_description *q, const meta_info *mi);
+
+/*
+ * Can a meta_info match the global query, given the candidates of it in
+ * the library's trigram index (NULL if it couldn't narrow them down)?  If
+ * not, mi_match() is certain to be false; if so, mi_match() must tell.
+ */
+#define mi_may_match(candidates, mi) \
+   ((candidates) == NULL || (mi)->index_id == 0 \
+   || TRIGRAM_MAY_MATCH(candidates, (mi)->index_id))
+
 
 /*****************************************************************************
  * Functions used to sort meta_info's.  These work by setting-up a global
@@ -148,14 +333,43 @@ typedef struct {
    int   nfields;
 } mi_sort_description;
 
-/* initialize, set, and clear global sort description */
+/*
+ * Version of the order mi_compare() sorts in, to be bumped whenever it
+ * changes, since the database keeps sorted orders (see
+ * medialib_sort_library()).
+ */
+#define MI_SORT_VERSION 2
+
+/* the threads a sort is split among, see nthreads_for() */
+#define MI_SORT_MIN_PER_THREAD   32768
+#define MI_SORT_MAX_THREADS      64
+
+/* initialize, set, get, and clear global sort description */
 void mi_sort_init();
 void mi_sort_clear();
 int  mi_sort_set(const char *str, const char **errmsg);
+void mi_sort_get(mi_sort_description *d);
 
 /* compare two meta_info's using the global sort description */
 int  mi_compare(const void *a, const void *b);
 
+/* compare two meta_info's using a given sort description */
+int  mi_compare_desc(const meta_info *a, const meta_info *b,
+   const mi_sort_description *d);
+
+/*
+ * Sort an array of meta_info's by a sort description, in the order of
+ * mi_compare_desc() (and stable), or fill perm with the indices of the
+ * files in that order instead.  These build a binary key of each file
+ * that sorts with memcmp(3) (see mi_sort_key()), and radix sort those, so
+ * the many comparisons of qsort(3) are avoided.  Large arrays are split in
+ * parts that are keyed and sorted by threads of their own, then merged.
+ * The files must already be decoded (see mi_decode()).
+ */
+void mi_sort_files(meta_info **files, int n, const mi_sort_description *d);
+void mi_sort_perm(meta_info **files, int n, const mi_sort_description *d,
+   uint32_t *perm);
+
 
 /*****************************************************************************
  * Functions to control how to display meta_info's to the screen.  These
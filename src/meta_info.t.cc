@@ -0,0 +1,94 @@
+#include <gtest/gtest.h>
+
+extern "C" {
+#  include "meta_info.h"
+};
+
+/* a record as mi_extract() would make it */
+static meta_info *
+record(const char *title, const char *track, const char *year, int length)
+{
+   static mi_builder b;
+   static bool       init = false;
+
+   if (!init) {
+      mi_builder_init(&b);
+      init = true;
+   }
+   mi_builder_filename(&b, "/music/some/song.mp3");
+   mi_builder_cinfo(&b, MI_CINFO_TITLE, title);
+   if (track != NULL)
+      mi_builder_cinfo(&b, MI_CINFO_TRACK, track);
+   if (year != NULL)
+      mi_builder_cinfo(&b, MI_CINFO_YEAR, year);
+   b.mi.length = length;
+   return mi_builder_finish(&b);
+}
+
+static bool
+matches(const meta_info *mi, const char *token)
+{
+   bool m;
+
+   mi_query_clear();
+   mi_query_add_token(token);
+   m = mi_match(mi);
+   mi_query_clear();
+   return m;
+}
+
+TEST(meta_info, TestPaddedTrack)
+{
+   meta_info *mi = record("Help!", "  5", "1965", 138);
+
+   mi_query_init();
+   ASSERT_TRUE(matches(mi, "track:5"));
+   ASSERT_TRUE(matches(mi, "track:<10"));
+   ASSERT_FALSE(matches(mi, "track:12"));
+   ASSERT_TRUE(matches(mi, "year:1965"));
+   mi_free(mi);
+}
+
+TEST(meta_info, TestColonIsText)
+{
+   meta_info *mi = record("Union Song", NULL, NULL, 0);
+   meta_info *part = record("Part 1: Overture", NULL, NULL, 0);
+
+   /* only a field name before a colon qualifies a token */
+   mi_query_init();
+   ASSERT_FALSE(matches(mi, "re:union"));
+   ASSERT_FALSE(matches(mi, "part1:"));
+   ASSERT_TRUE(matches(part, "part 1:"));
+   ASSERT_TRUE(matches(part, "title:1: over"));
+   mi_free(mi);
+   mi_free(part);
+}
+
+TEST(meta_info, TestUnknownLength)
+{
+   meta_info *mi = record("Some Stream", NULL, NULL, 0);
+   meta_info *song = record("Some Song", NULL, NULL, 200);
+
+   mi_query_init();
+   ASSERT_FALSE(matches(mi, "length:<5:00"));
+   ASSERT_FALSE(matches(mi, "length:<=300"));
+   ASSERT_TRUE(matches(mi, "!length:<5:00"));
+   ASSERT_TRUE(matches(song, "length:<5:00"));
+   mi_free(mi);
+   mi_free(song);
+}
+
+TEST(meta_info, TestBuiltRecordIsDecoded)
+{
+   mi_builder  b;
+   meta_info  *mi;
+
+   /* as for a builder on the stack, like mi_extract()'s */
+   memset(&b, 0xff, sizeof(b));
+   mi_builder_init(&b);
+   mi_builder_filename(&b, "/music/some/song.mp3");
+   mi = mi_builder_finish(&b);
+   mi_builder_free(&b);
+   ASSERT_TRUE(NULL == mi->pending);
+   mi_free(mi);
+}
@@ -39,6 +39,7 @@ player_get_field2show(const meta_info *mi)
                               MI_CINFO_TITLE };
 
    /* determine which cinfo item to show */
+   mi_decode(mi);
    if (time(NULL) - last_updated >= 3) {
       last_updated = time(NULL);
       index = (index + 1) % 3;
@@ -83,9 +84,11 @@ void
 paint_status_bar()
 {
    static char scratchpad[500];
+   char        match[64];
    char       *focusName;
    int         percent;
    int         w;
+   int         i, n;
 
    w = getmaxx(stdscr);
 
@@ -106,9 +109,15 @@ paint_status_bar()
    else
       percent = 100 * (ui.active->voffset + ui.active->crow + 1) / ui.active->nrows;
 
+   /* which match of the last search the cursor is on, if any */
+   match[0] = '\0';
+   if (search_position(&i, &n))
+      snprintf(match, sizeof(match), "match %d of %d  ", i, n);
+
    /* build the string to print */
    snprintf(scratchpad, sizeof(scratchpad),
-      "[%s%s%s] %6d,%-3d %3d%%",
+      "%s[%s%s%s] %6d,%-3d %3d%%",
+      match,
       focusName,
       (ui.active == ui.library ? "" : ":"),
       (ui.active == ui.library ? "" : viewing_playlist->name),
@@ -284,185 +293,217 @@ paint_library()
    wrefresh(ui.library->cwin);
 }
 
-/* paint the playlist window */
-void
-paint_playlist()
+/* paint a single row of the playlist window */
+static void
+paint_playlist_row(int row)
 {
    playlist   *plist;
    bool        hasinfo;
    bool        visual;
    char       *str;
-   int         findex, row, col, colwidth;
+   int         findex, col, colwidth;
    int         xoff, hoff, strhoff;
    int         cattr;
 
-
-   showing_file_info = false;
    plist = viewing_playlist;
 
-   werase(ui.playlist->cwin);
+   /* get index of file to show */
+   findex = row + ui.playlist->voffset;
 
-   for (row = 0; row < ui.playlist->h; row++) {
+   /* determine if visual mode row */
+   visual = false;
+   if (visual_mode_start != -1 && ui.active == ui.playlist) {
+      if (visual_mode_start <= findex && findex <= ui.active->voffset + ui.active->crow)
+         visual = true;
+      if (ui.active->voffset + ui.active->crow <= findex && findex <= visual_mode_start)
+         visual = true;
+   }
 
-      /* get index of file to show */
-      findex = row + ui.playlist->voffset;
+   /* apply row attributes */
+    wattron(ui.playlist->cwin, COLOR_PAIR(colors.playlist));
 
-      /* determine if visual mode row */
-      visual = false;
-      if (visual_mode_start != -1 && ui.active == ui.playlist) {
-         if (visual_mode_start <= findex && findex <= ui.active->voffset + ui.active->crow)
-            visual = true;
-         if (ui.active->voffset + ui.active->crow <= findex && findex <= visual_mode_start)
-            visual = true;
-      }
+   if (plist == playing_playlist && findex == player_info.qidx)
+      wattron(ui.playlist->cwin, COLOR_PAIR(colors.playing_playlist));
 
-      /* apply row attributes */
-       wattron(ui.playlist->cwin, COLOR_PAIR(colors.playlist));
+   if ((row == ui.playlist->crow && ui.active == ui.playlist) || visual) {
+      if (findex == player_info.qidx)
+         wattron(ui.playlist->cwin, A_REVERSE);
+      else
+         wattron(ui.playlist->cwin, COLOR_PAIR(colors.current_active));
+   }
 
-      if (plist == playing_playlist && findex == player_info.qidx)
-         wattron(ui.playlist->cwin, COLOR_PAIR(colors.playing_playlist));
+   if (row == ui.playlist->crow && ui.active != ui.playlist)
+      wattron(ui.playlist->cwin, COLOR_PAIR(colors.current_inactive));
 
-      if ((row == ui.playlist->crow && ui.active == ui.playlist) || visual) {
-         if (findex == player_info.qidx)
-            wattron(ui.playlist->cwin, A_REVERSE);
-         else
-            wattron(ui.playlist->cwin, COLOR_PAIR(colors.current_active));
-      }
+   if (findex >= plist->nfiles)
+      wattron(ui.playlist->cwin, COLOR_PAIR(colors.tildas_playlist));
 
-      if (row == ui.playlist->crow && ui.active != ui.playlist)
-         wattron(ui.playlist->cwin, COLOR_PAIR(colors.current_inactive));
+   /* draw the row */
+   if (findex >= plist->nfiles)
+      mvwprintw(ui.playlist->cwin, row, 0, "~");
+   else {
+      /* this acheives the A_REVERSE attribute spanning the entire row */
+      mvwprintw(ui.playlist->cwin, row, 0,
+         num2fmt(ui.playlist->w, LEFT), " ");
+
+      /* does the file have any meta-info? */
+      mi_decode(plist->files[findex]);
+      hasinfo = false;
+      for (col = 0; col < mi_display.nfields; col++) {
+         if (plist->files[findex]->cinfo[mi_display.order[col]] != NULL)
+            hasinfo = true;
+      }
 
-      if (findex >= plist->nfiles)
-         wattron(ui.playlist->cwin, COLOR_PAIR(colors.tildas_playlist));
+      /* if there's no meta info, just show filename */
+      if (!hasinfo) {
+         mvwprintw(ui.playlist->cwin, row, 0, num2fmt(ui.playlist->w, LEFT),
+            plist->files[findex]->filename);
+      } else {
 
-      /* draw the row */
-      if (findex >= plist->nfiles)
-         mvwprintw(ui.playlist->cwin, row, 0, "~");
-      else {
-         /* this acheives the A_REVERSE attribute spanning the entire row */
-         mvwprintw(ui.playlist->cwin, row, 0,
-            num2fmt(ui.playlist->w, LEFT), " ");
-
-         /* does the file have any meta-info? */
-         hasinfo = false;
+         /* loop through all fields of file and display each ... */
+         xoff = 0;
+         hoff = ui.playlist->hoffset;
          for (col = 0; col < mi_display.nfields; col++) {
-            if (plist->files[findex]->cinfo[mi_display.order[col]] != NULL)
-               hasinfo = true;
-         }
 
-         /* if there's no meta info, just show filename */
-         if (!hasinfo) {
-            mvwprintw(ui.playlist->cwin, row, 0, num2fmt(ui.playlist->w, LEFT),
-               plist->files[findex]->filename);
-         } else {
-
-            /* loop through all fields of file and display each ... */
-            xoff = 0;
-            hoff = ui.playlist->hoffset;
-            for (col = 0; col < mi_display.nfields; col++) {
-
-               /* is horizontal offset big enough to skip this field? */
-               if (hoff >= mi_display.widths[col]) {
-                  hoff -= mi_display.widths[col];
-                  continue;
-               }
+            /* is horizontal offset big enough to skip this field? */
+            if (hoff >= mi_display.widths[col]) {
+               hoff -= mi_display.widths[col];
+               continue;
+            }
 
-               /* field shown off the screen? */
-               if (xoff >= ui.playlist->w)
-                  continue;
-
-               /* get string to show (str) */
-               str = plist->files[findex]->cinfo[mi_display.order[col]];
-
-               /* determine horizontal offset (strhoff) to apply to str */
-               strhoff = 0;
-               if (str != NULL) {
-                  if (mi_display.align[col] == LEFT) {
-                     if (hoff > (int)strlen(str))
-                        strhoff = strlen(str);
-                     else
-                        strhoff = hoff;
-                  } else {
-                     if ((int)strlen(str) > mi_display.widths[col])
-                        strhoff = hoff;
-                     else if (hoff < mi_display.widths[col] - (int)strlen(str))
-                        strhoff = 0;
-                     else
-                        strhoff = hoff - (mi_display.widths[col] - strlen(str));
-
-                     if (strhoff > (int)strlen(str))
-                        strhoff = strlen(str);
-                  }
-               }
+            /* field shown off the screen? */
+            if (xoff >= ui.playlist->w)
+               continue;
 
-               if ((row == ui.playlist->crow && ui.active == ui.playlist) || visual) {
-                  if (findex == player_info.qidx)
-                     wattron(ui.playlist->cwin, A_REVERSE);
-                  else
-                     wattron(ui.playlist->cwin, COLOR_PAIR(colors.current_active));
-               }
+            /* get string to show (str) */
+            str = plist->files[findex]->cinfo[mi_display.order[col]];
 
-               /* apply column attribute (only if file is NOT playing) */
-               cattr = COLOR_PAIR(colors.cinfos[mi_display.order[col]]);
-               if ((plist != playing_playlist || findex != player_info.qidx)
-               && colors.cinfos_set[mi_display.order[col]]) {
-                  if ((row == ui.playlist->crow && ui.active == ui.playlist) || visual)
-                     wattron(ui.playlist->cwin, COLOR_PAIR(colors.current_active));
+            /* determine horizontal offset (strhoff) to apply to str */
+            strhoff = 0;
+            if (str != NULL) {
+               if (mi_display.align[col] == LEFT) {
+                  if (hoff > (int)strlen(str))
+                     strhoff = strlen(str);
                   else
-                     wattron(ui.playlist->cwin, cattr);
-               }
+                     strhoff = hoff;
+               } else {
+                  if ((int)strlen(str) > mi_display.widths[col])
+                     strhoff = hoff;
+                  else if (hoff < mi_display.widths[col] - (int)strlen(str))
+                     strhoff = 0;
+                  else
+                     strhoff = hoff - (mi_display.widths[col] - strlen(str));
 
-               /* determine width of this field */
-               colwidth = mi_display.widths[col] - hoff;
-               if (xoff + colwidth > ui.playlist->w)
-                  colwidth = ui.playlist->w - xoff;
+                  if (strhoff > (int)strlen(str))
+                     strhoff = strlen(str);
+               }
+            }
 
-               /* print the column */
-               mvwprintw(ui.playlist->cwin, row, xoff,
-                  num2fmt(colwidth, mi_display.align[col]),
-                  (str == NULL ? " " : str + strhoff));
+            if ((row == ui.playlist->crow && ui.active == ui.playlist) || visual) {
+               if (findex == player_info.qidx)
+                  wattron(ui.playlist->cwin, A_REVERSE);
+               else
+                  wattron(ui.playlist->cwin, COLOR_PAIR(colors.current_active));
+            }
 
-               /* un-apply column attribute */
-               if ((row == ui.playlist->crow && ui.active == ui.playlist) || visual) {
-                  if (findex == player_info.qidx)
-                     wattroff(ui.playlist->cwin, A_REVERSE);
-                  else
-                     wattroff(ui.playlist->cwin, COLOR_PAIR(colors.current_active));
-               }
+            /* apply column attribute (only if file is NOT playing) */
+            cattr = COLOR_PAIR(colors.cinfos[mi_display.order[col]]);
+            if ((plist != playing_playlist || findex != player_info.qidx)
+            && colors.cinfos_set[mi_display.order[col]]) {
+               if ((row == ui.playlist->crow && ui.active == ui.playlist) || visual)
+                  wattron(ui.playlist->cwin, COLOR_PAIR(colors.current_active));
+               else
+                  wattron(ui.playlist->cwin, cattr);
+            }
 
-               if ((plist != playing_playlist || findex != player_info.qidx)
-               && colors.cinfos_set[mi_display.order[col]]) {
-                  if ((row == ui.playlist->crow && ui.active == ui.playlist) || visual)
-                     wattroff(ui.playlist->cwin, COLOR_PAIR(colors.current_active));
-                  else
-                     wattroff(ui.playlist->cwin, cattr);
-                  wattron(ui.playlist->cwin, COLOR_PAIR(colors.playlist));
-               }
+            /* determine width of this field */
+            colwidth = mi_display.widths[col] - hoff;
+            if (xoff + colwidth > ui.playlist->w)
+               colwidth = ui.playlist->w - xoff;
+
+            /* print the column */
+            mvwprintw(ui.playlist->cwin, row, xoff,
+               num2fmt(colwidth, mi_display.align[col]),
+               (str == NULL ? " " : str + strhoff));
+
+            /* un-apply column attribute */
+            if ((row == ui.playlist->crow && ui.active == ui.playlist) || visual) {
+               if (findex == player_info.qidx)
+                  wattroff(ui.playlist->cwin, A_REVERSE);
+               else
+                  wattroff(ui.playlist->cwin, COLOR_PAIR(colors.current_active));
+            }
 
-               xoff += 1 + colwidth; /* +1 for space between columns */
-               hoff = 0;
+            if ((plist != playing_playlist || findex != player_info.qidx)
+            && colors.cinfos_set[mi_display.order[col]]) {
+               if ((row == ui.playlist->crow && ui.active == ui.playlist) || visual)
+                  wattroff(ui.playlist->cwin, COLOR_PAIR(colors.current_active));
+               else
+                  wattroff(ui.playlist->cwin, cattr);
+               wattron(ui.playlist->cwin, COLOR_PAIR(colors.playlist));
             }
+
+            xoff += 1 + colwidth; /* +1 for space between columns */
+            hoff = 0;
          }
       }
+   }
 
-      /* un-apply row attributes */
-      if (findex >= plist->nfiles)
-         wattroff(ui.playlist->cwin, COLOR_PAIR(colors.tildas_playlist));
+   /* un-apply row attributes */
+   if (findex >= plist->nfiles)
+      wattroff(ui.playlist->cwin, COLOR_PAIR(colors.tildas_playlist));
 
-      if ((row == ui.playlist->crow && ui.active == ui.playlist) || visual) {
-         if (findex == player_info.qidx)
-            wattroff(ui.playlist->cwin, A_REVERSE);
-         else
-            wattroff(ui.playlist->cwin, COLOR_PAIR(colors.current_active));
-      }
+   if ((row == ui.playlist->crow && ui.active == ui.playlist) || visual) {
+      if (findex == player_info.qidx)
+         wattroff(ui.playlist->cwin, A_REVERSE);
+      else
+         wattroff(ui.playlist->cwin, COLOR_PAIR(colors.current_active));
+   }
+
+   if (row == ui.playlist->crow && ui.active != ui.playlist)
+      wattroff(ui.playlist->cwin, COLOR_PAIR(colors.current_inactive));
 
-      if (row == ui.playlist->crow && ui.active != ui.playlist)
-         wattroff(ui.playlist->cwin, COLOR_PAIR(colors.current_inactive));
+   if (plist == playing_playlist && findex == player_info.qidx)
+      wattroff(ui.playlist->cwin, COLOR_PAIR(colors.playing_playlist));
+
+   wattroff(ui.playlist->cwin, COLOR_PAIR(colors.playlist));
+}
+
+/* paint the playlist window */
+void
+paint_playlist()
+{
+   int row;
 
-      if (plist == playing_playlist && findex == player_info.qidx)
-         wattroff(ui.playlist->cwin, COLOR_PAIR(colors.playing_playlist));
+   showing_file_info = false;
+
+   werase(ui.playlist->cwin);
+   for (row = 0; row < ui.playlist->h; row++)
+      paint_playlist_row(row);
+
+   wrefresh(ui.playlist->cwin);
+}
+
+/*
+ * Repaint only the rows of the playlist window showing the files start..end
+ * (inclusive) of the viewing playlist, if any of them are visible.
+ */
+void
+paint_playlist_rows(int start, int end)
+{
+   int row, findex;
+
+   if (showing_file_info)
+      return;
+
+   for (row = 0; row < ui.playlist->h; row++) {
+      findex = row + ui.playlist->voffset;
+      if (findex < start || findex > end)
+         continue;
 
-      wattroff(ui.playlist->cwin, COLOR_PAIR(colors.playlist));
+      wmove(ui.playlist->cwin, row, 0);
+      wclrtoeol(ui.playlist->cwin);
+      paint_playlist_row(row);
    }
 
    wrefresh(ui.playlist->cwin);
@@ -512,6 +553,7 @@ paint_playlist_file_info(const meta_info *m)
    row += nrows + 1;
 
    /* paint meta-info */
+   mi_decode(m);
    mvwprintw(ui.playlist->cwin, row++, 0, "Meta-Information:");
    for (i = 0; i < MI_NUM_CINFO; i++) {
       mvwprintw(ui.playlist->cwin, row++, 0, "%10s: \"%s\"",
@@ -74,6 +74,7 @@ void paint_status_bar();
 void paint_player();
 void paint_library();
 void paint_playlist();
+void paint_playlist_rows(int start, int end);
 void paint_borders();
 void paint_all();
 
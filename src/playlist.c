@@ -54,6 +54,7 @@ playlist_new(void)
    p->history  = playlist_history_new();
    p->hist_present = -1;
    p->needs_saving = false;
+   playlist_changed(p);
 
    return p;
 }
@@ -121,14 +122,15 @@ playlist_files_add(playlist *p, meta_info **f, int start, int size, bool record)
       playlist_increase_capacity(p);
 
    /* push everything after start back size places */
-   for (i = p->nfiles + size; i > start; i--)
-      p->files[i] = p->files[i - size];
+   for (i = p->nfiles - 1; i >= start; i--)
+      p->files[i + size] = p->files[i];
 
    /* add the files */
    for (i = 0; i < size; i++)
       p->files[start + i] = f[i];
 
    p->nfiles += size;
+   playlist_changed(p);
 
    /* update the history for this playlist */
    if (record) {
@@ -166,7 +168,7 @@ playlist_files_remove(playlist *p, int start, int size, bool record)
       p->files[i] = p->files[i + size];
 
    p->nfiles -= size;
-
+   playlist_changed(p);
 }
 
 /* Replaces the file at a given index in a playlist with a new file */
@@ -177,6 +179,15 @@ playlist_file_replace(playlist *p, int index, meta_info *newEntry)
       errx(1, "playlist_file_replace: index %d out of range", index);
 
    p->files[index] = newEntry;
+   playlist_changed(p);
+}
+
+void
+playlist_changed(playlist *p)
+{
+   static unsigned int generations = 0;
+
+   p->generation = ++generations;
 }
 
 /* Used with bsearch to find playlist entry by filename. */
@@ -203,6 +214,7 @@ playlist *
 playlist_load(const char *filename, meta_info **db, int ndb)
 {
    meta_info *mi, **mit;
+   mi_builder b;
    FILE *fin;
    char *period;
    char  entry[PATH_MAX + 1];
@@ -223,6 +235,7 @@ playlist_load(const char *filename, meta_info **db, int ndb)
    *period = '\0';
 
    /* read each line from the file and copy into playlist object */
+   mi_builder_init(&b);
    while (fgets(entry, PATH_MAX, fin) != NULL) {
       /* sanitize */
       entry[strcspn(entry, "\n")] = '\0';
@@ -235,10 +248,8 @@ playlist_load(const char *filename, meta_info **db, int ndb)
          playlist_files_append(p, &mi, 1, false);
       } else {            /* file does NOT exist in DB */
          /* create empty meta-info object with just the file name */
-         mi = mi_new();
-         mi->filename = strdup(entry);
-         if (mi->filename == NULL)
-            err(1, "playlist_load: failed to strdup filename");
+         mi_builder_filename(&b, entry);
+         mi = mi_builder_finish(&b);
 
          /* add new record to the db and link it to the playlist */
          playlist_files_append(p, &mi, 1, false);
@@ -246,31 +257,68 @@ playlist_load(const char *filename, meta_info **db, int ndb)
             p->name, entry);
       }
    }
+   mi_builder_free(&b);
 
    fclose(fin);
    return p;
 }
 
 /*
- * Save a playlist to file.  The filename used is whatever is in the
- * playlist.
+ * Write the given files as a playlist file.  They're written to a temporary
+ * file that is then rename(2)'d over the playlist, so it's never left half
+ * written.  Only the filenames of the files are used.  Returns -1 (with errno
+ * set) on failure.
  */
-void
-playlist_save(const playlist *p)
+int
+playlist_write(const char *filename, meta_info **files, int nfiles)
 {
-   FILE *fout;
-   int   i;
+   struct stat  sb;
+   mode_t       mode;
+   bufio        out;
+   char        *tmp_file;
+   int          fd, i, ret;
+
+   if (asprintf(&tmp_file, "%s.XXXXXX", filename) == -1)
+      err(1, "playlist_write: asprintf failed");
+
+   if ((fd = mkstemp(tmp_file)) == -1) {
+      free(tmp_file);
+      return -1;
+   }
 
-   if ((fout = fopen(p->filename, "w")) == NULL)
-      err(1, "playlist_save: failed to open playlist \"%s\"", p->filename);
+   /* keep the mode of an existing playlist */
+   mode = (stat(filename, &sb) == 0 ? sb.st_mode & 07777 : 0644);
 
    /* write each song to file */
-   for (i = 0; i < p->nfiles; i++) {
-      if (fprintf(fout, "%s\n", p->files[i]->filename) == -1)
-         err(1, "playlist_save: failed to record playlist \"%s\"", p->filename);
+   bufio_init(&out, fd, BUFIO_SIZE);
+   for (i = 0; i < nfiles; i++) {
+      bufio_write(&out, files[i]->filename, strlen(files[i]->filename));
+      bufio_write(&out, "\n", 1);
+   }
+
+   ret = 0;
+   if (bufio_flush(&out) == -1 || fchmod(fd, mode) == -1 || fsync(fd) == -1
+   ||  close(fd) == -1 || rename(tmp_file, filename) == -1) {
+      i = errno;
+      unlink(tmp_file);
+      errno = i;
+      ret = -1;
    }
 
-   fclose(fout);
+   bufio_free(&out);
+   free(tmp_file);
+   return ret;
+}
+
+/*
+ * Save a playlist to file.  The filename used is whatever is in the
+ * playlist.
+ */
+void
+playlist_save(const playlist *p)
+{
+   if (playlist_write(p->filename, p->files, p->nfiles) == -1)
+      err(1, "playlist_save: failed to record playlist \"%s\"", p->filename);
 }
 
 /*
@@ -288,6 +336,121 @@ playlist_delete(playlist *p)
    playlist_free(p);
 }
 
+/* a part of a playlist being filtered, see playlist_filter() */
+typedef struct {
+   const playlist             *p;
+   const mi_query_description *q;
+   const trigram_set          *candidates;
+   bool                        m;
+   int                         thread;   /* which of nthreads this is */
+   int                         nthreads;
+   int                         start;
+   int                         n;
+   meta_info                 **files;    /* the results, of this part */
+   int                        *scores;   /* of each, if they're ranked */
+   int                         nfiles;
+} playlist_filter_part;
+
+/* the one of n threads to fold a record, see playlist_filter() */
+#define PLAYLIST_FILTER_FOLDER(mi, n) \
+   ((int) (((uintptr_t) (mi) / sizeof(meta_info)) % (n)))
+
+static void *
+playlist_filter_fold(void *arg)
+{
+   playlist_filter_part *part = (playlist_filter_part *) arg;
+   const meta_info      *mi;
+   int                   i;
+
+   for (i = 0; i < part->p->nfiles; i++) {
+      mi = part->p->files[i];
+      if (PLAYLIST_FILTER_FOLDER(mi, part->nthreads) == part->thread
+      &&  mi->folded == NULL)
+         mi_folded_get(mi);
+   }
+
+   return NULL;
+}
+
+static void *
+playlist_filter_run(void *arg)
+{
+   playlist_filter_part *part = (playlist_filter_part *) arg;
+   const meta_info      *mi;
+   int                   i, score;
+
+   if ((part->files = calloc(part->n + 1, sizeof(meta_info*))) == NULL)
+      err(1, "playlist_filter_run: calloc failed");
+   if (part->m && part->q->nranked > 0
+   &&  (part->scores = calloc(part->n + 1, sizeof(int))) == NULL)
+      err(1, "playlist_filter_run: calloc failed");
+
+   for (i = part->start; i < part->start + part->n; i++) {
+      mi = part->p->files[i];
+      score = (mi_may_match(part->candidates, mi)
+            ? mi_match_score(part->q, mi) : -1);
+      if ((score >= 0) != part->m)
+         continue;
+
+      if (part->scores != NULL)
+         part->scores[part->nfiles] = score;
+      part->files[part->nfiles++] = part->p->files[i];
+   }
+
+   return NULL;
+}
+
+/* run fn on each part, one thread each, the calling thread taking the first */
+static void
+playlist_filter_threads(void *(*fn)(void *), playlist_filter_part *parts,
+   int nthreads)
+{
+   pthread_t threads[PLAYLIST_FILTER_MAX_THREADS];
+   int       i;
+
+   for (i = 1; i < nthreads; i++) {
+      if ((errno = pthread_create(&threads[i], NULL, fn, &parts[i])) != 0)
+         err(1, "playlist_filter: pthread_create failed");
+   }
+   fn(&parts[0]);
+   for (i = 1; i < nthreads; i++)
+      pthread_join(threads[i], NULL);
+}
+
+/* order files by their scores, fewest errors first, the rest as they were */
+static void
+playlist_filter_rank(meta_info **files, const int *scores, int n)
+{
+   meta_info **ranked;
+   int        *starts;
+   int         i, most;
+
+   most = 0;
+   for (i = 0; i < n; i++) {
+      if (scores[i] > most)
+         most = scores[i];
+   }
+   if (most == 0)
+      return;
+
+   starts = calloc(most + 2, sizeof(int));
+   ranked = calloc(n, sizeof(meta_info*));
+   if (starts == NULL || ranked == NULL)
+      err(1, "playlist_filter_rank: calloc failed");
+
+   /* a counting sort, as scores are small */
+   for (i = 0; i < n; i++)
+      starts[scores[i] + 1]++;
+   for (i = 1; i <= most; i++)
+      starts[i] += starts[i - 1];
+   for (i = 0; i < n; i++)
+      ranked[starts[scores[i]]++] = files[i];
+
+   memcpy(files, ranked, n * sizeof(meta_info*));
+   free(ranked);
+   free(starts);
+}
+
 /*
  * Filter a playlist.  After a query string is setup using the meta_info
  * function "mi_query_set(..)" function, this function can be used to
@@ -299,24 +462,86 @@ playlist_delete(playlist *p)
  *
  * The 'm' parameter controls if records matching should be returned
  * (m = true) or if records not matching should be returned (m=false)
+ *
+ * The files are split in consecutive parts, one per thread, each matched
+ * against the (unchanging) global query into results of its own, which
+ * are then put together in order.  Matching a record may decode and fold
+ * it (see mi_folded_get()), which two threads must never do to the same
+ * record at once, and the same record may well be in two parts.  So the
+ * threads first fold all records not yet folded, each only those it's the
+ * PLAYLIST_FILTER_FOLDER of, before any are matched.
+ *
+ * If the query has fuzzy text (see meta_info.h), the records matching it
+ * are then ranked by mi_match_score().
  */
 playlist *
-playlist_filter(const playlist *p, bool m)
+playlist_filter(const playlist *p, bool m, const trigram_set *candidates)
 {
-   playlist *results;
-   int       i;
+   playlist_filter_part  parts[PLAYLIST_FILTER_MAX_THREADS];
+   playlist             *results;
+   meta_info           **files;
+   int                  *scores;
+   int                   nthreads, nfiles, i;
 
    if (!mi_query_isset())
       return NULL;
-   
+
+   nthreads = nthreads_for(p->nfiles, PLAYLIST_FILTER_MIN_PER_THREAD,
+      PLAYLIST_FILTER_MAX_THREADS);
+   for (i = 0; i < nthreads; i++) {
+      parts[i].p = p;
+      parts[i].q = mi_query_get();
+      parts[i].candidates = candidates;
+      parts[i].m = m;
+      parts[i].thread = i;
+      parts[i].nthreads = nthreads;
+      parts[i].start = (int) ((long long) p->nfiles * i / nthreads);
+      parts[i].n = (int) ((long long) p->nfiles * (i + 1) / nthreads)
+                 - parts[i].start;
+      parts[i].files = NULL;
+      parts[i].scores = NULL;
+      parts[i].nfiles = 0;
+   }
+
+   if (nthreads > 1)
+      playlist_filter_threads(playlist_filter_fold, parts, nthreads);
+   playlist_filter_threads(playlist_filter_run, parts, nthreads);
+
+   /* put the results together, after those of the first part */
+   nfiles = 0;
+   for (i = 0; i < nthreads; i++)
+      nfiles += parts[i].nfiles;
+
+   files = realloc(parts[0].files,
+      (nfiles + PLAYLIST_CHUNK_SIZE) * sizeof(meta_info*));
+   if (files == NULL)
+      err(1, "playlist_filter: realloc failed");
+   scores = parts[0].scores;
+   if (scores != NULL
+   &&  (scores = realloc(scores, (nfiles + 1) * sizeof(int))) == NULL)
+      err(1, "playlist_filter: realloc failed");
+
    results = playlist_new();
-   for (i = 0; i < p->nfiles; i++) {
-      if (mi_match(p->files[i])) {
-         if (m)  playlist_files_append(results, &(p->files[i]), 1, false);
-      } else {
-         if (!m) playlist_files_append(results, &(p->files[i]), 1, false);
-      }
+   free(results->files);
+   results->files = files;
+   results->nfiles = parts[0].nfiles;
+   results->capacity = nfiles + PLAYLIST_CHUNK_SIZE;
+   for (i = 1; i < nthreads; i++) {
+      memcpy(results->files + results->nfiles, parts[i].files,
+         parts[i].nfiles * sizeof(meta_info*));
+      if (scores != NULL)
+         memcpy(scores + results->nfiles, parts[i].scores,
+            parts[i].nfiles * sizeof(int));
+      results->nfiles += parts[i].nfiles;
+      free(parts[i].files);
+      free(parts[i].scores);
+   }
+
+   if (scores != NULL) {
+      playlist_filter_rank(results->files, scores, results->nfiles);
+      free(scores);
    }
+   playlist_changed(results);
 
    return results;
 }
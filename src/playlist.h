@@ -27,15 +27,22 @@
 #include <glob.h>
 #include <stdio.h>
 #include <libgen.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 #include "debug.h"
 #include "meta_info.h"
+#include "util/nthreads.h"
 
 #define PLAYLIST_CHUNK_SIZE   100
 #define DEFAULT_HISTORY_SIZE  100
+
+/* the threads a filter is split among, see nthreads_for() */
+#define PLAYLIST_FILTER_MIN_PER_THREAD   65536
+#define PLAYLIST_FILTER_MAX_THREADS      64
+
 extern int history_size;
 
 typedef struct {
@@ -58,6 +65,7 @@ typedef struct {
    meta_info **files;
    int         nfiles;     /* number of files in the playlist */
    int         capacity;   /* current size malloc()'d for the files */
+   unsigned int generation; /* changes with the files, see playlist_changed() */
 
    /* history of the playlist */
    playlist_changeset   **history;        /* complete history */
@@ -92,13 +100,28 @@ void playlist_files_append(playlist *p, meta_info **f, int size, bool);
 void playlist_files_remove(playlist *p, int start, int size, bool);
 void playlist_file_replace(playlist *p, int index, meta_info *newEntry);
 
+/*
+ * Note that the files of a playlist changed (the functions above do so
+ * themselves, but anything re-ordering the files array directly, like a
+ * sort, must call this).  Each change gives the playlist a generation no
+ * other playlist has had, so what's computed from a playlist can be kept
+ * for as long as its address and generation are the same.
+ */
+void playlist_changed(playlist *p);
+
 /* load/save/delete playlists from/to/from filesystem */
 playlist *playlist_load(const char *filename, meta_info **db, int ndb);
 void playlist_save(const playlist *p);
+int playlist_write(const char *filename, meta_info **files, int nfiles);
 void playlist_delete(playlist *p);
 
-/* filter a playlist to all records matching/not-matching a given string */
-playlist *playlist_filter(const playlist *p, bool m);
+/*
+ * filter a playlist to all records matching/not-matching the global query,
+ * only checking those that are candidates (see mi_may_match()), on several
+ * threads if there are many
+ */
+playlist *playlist_filter(const playlist *p, bool m,
+   const trigram_set *candidates);
 
 /* retrieve all playlist files in a given directory and return number found */
 int retrieve_playlist_filenames(const char *dirname, char ***files);
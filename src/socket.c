@@ -13,6 +13,7 @@
  * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/types.h>
@@ -34,6 +35,11 @@ sock_send_msg(const char *msg)
    socklen_t            addr_len;
 
 
+   if(strlen(msg) > SOCK_MSG_MAX) {
+      errno = EMSGSIZE;
+      return -1;
+   }
+
    if((ret = socket(AF_UNIX, SOCK_DGRAM, 0)) == -1)
       return -1;
 
@@ -95,9 +101,9 @@ sock_recv_msg(int sock, char *msg, size_t msg_len)
 void
 sock_recv_and_exec(int sock)
 {
-   char   msg[64];
+   char   msg[SOCK_MSG_MAX + 1];
 
-   if(sock_recv_msg(sock, msg, sizeof(msg)) == -1)
+   if(sock_recv_msg(sock, msg, SOCK_MSG_MAX) == -1)
       return;
 
    if(!strcmp(msg, VITUNES_RUNNING))
@@ -20,6 +20,9 @@
 
 #define VITUNES_RUNNING "WHOWASPHONE?"
 
+/* longest message (a command, such as a filter with a long query) */
+#define SOCK_MSG_MAX    1024
+
 /*
  * send (null terminated) msg to vitunes. Returns 0 on success,
  * -1 on errors.
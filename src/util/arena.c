@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "arena.h"
+
+/* chunk headers are padded so the memory after them stays aligned */
+#define ARENA_HEADER    ARENA_ROUND(sizeof(arena_chunk))
+
+arena *
+arena_new(void)
+{
+   arena *a;
+
+   if ((a = (arena *) calloc(1, sizeof(arena))) == NULL)
+      err(1, "%s: calloc failed", __FUNCTION__);
+
+   return a;
+}
+
+void
+arena_free(arena *a)
+{
+   arena_chunk *c, *next;
+
+   for (c = a->chunks; c != NULL; c = next) {
+      next = c->next;
+      free(c);
+   }
+
+   free(a);
+}
+
+void *
+arena_alloc(arena *a, size_t size)
+{
+   arena_chunk *c;
+   arena_block *b;
+   size_t       sclass, chunk_size;
+
+   size = ARENA_ROUND(size == 0 ? 1 : size);
+   a->allocated += size;
+
+   /* reuse a released block of the same size, if there is one */
+   sclass = size / ARENA_ALIGN - 1;
+   if (sclass < ARENA_FREE_CLASSES && (b = a->free[sclass]) != NULL) {
+      a->free[sclass] = b->next;
+      return b;
+   }
+
+   /* start a new chunk if the current one is full */
+   c = a->chunks;
+   if (c == NULL || c->used + size > c->size) {
+      chunk_size = ARENA_CHUNK_SIZE;
+      if (size > chunk_size - ARENA_HEADER)
+         chunk_size = ARENA_HEADER + size;
+
+      if ((c = (arena_chunk *) malloc(chunk_size)) == NULL)
+         err(1, "%s: malloc failed", __FUNCTION__);
+
+      c->size = chunk_size;
+      c->used = ARENA_HEADER;
+
+      /* a big block gets a chunk of its own, behind the current one */
+      if (a->chunks != NULL && chunk_size > ARENA_CHUNK_SIZE) {
+         c->next = a->chunks->next;
+         a->chunks->next = c;
+      } else {
+         c->next = a->chunks;
+         a->chunks = c;
+      }
+   }
+
+   c->used += size;
+   return (char *) c + c->used - size;
+}
+
+void
+arena_release(arena *a, void *p, size_t size)
+{
+   arena_block *b;
+   size_t       sclass;
+
+   size = ARENA_ROUND(size == 0 ? 1 : size);
+   a->allocated -= size;
+
+   sclass = size / ARENA_ALIGN - 1;
+   if (sclass >= ARENA_FREE_CLASSES)
+      return;
+
+   b = (arena_block *) p;
+   b->next = a->free[sclass];
+   a->free[sclass] = b;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "../compat/compat.h"
+
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * A bump allocator: memory is carved out of large chunks and released all
+ * at once by arena_free().  Blocks can also be given back one at a time
+ * with arena_release(), which keeps them on a free-list by size so that a
+ * later arena_alloc() of the same size can reuse them.
+ */
+#define ARENA_ALIGN         16
+#define ARENA_CHUNK_SIZE    (64 * 1024)
+#define ARENA_FREE_CLASSES  64    /* sizes up to 64 * ARENA_ALIGN are reused */
+
+/* the size of the block actually used for an allocation of n bytes */
+#define ARENA_ROUND(n)  (((n) + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1))
+
+typedef struct arena_chunk {
+   struct arena_chunk   *next;
+   size_t                size;
+   size_t                used;
+} arena_chunk;
+
+typedef struct arena_block {
+   struct arena_block   *next;
+} arena_block;
+
+typedef struct {
+   arena_chunk   *chunks;   /* the current chunk is the first */
+   arena_block   *free[ARENA_FREE_CLASSES];
+   size_t         allocated;
+} arena;
+
+/* create/destroy an arena, releasing everything allocated from it */
+arena *arena_new(void);
+void arena_free(arena *a);
+
+/* allocate size bytes, aligned to ARENA_ALIGN */
+void *arena_alloc(arena *a, size_t size);
+
+/* give back a block, along with the size it was allocated with */
+void arena_release(arena *a, void *p, size_t size);
+
+#endif
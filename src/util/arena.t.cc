@@ -0,0 +1,64 @@
+#include <gtest/gtest.h>
+#include <stdint.h>
+
+extern "C" {
+#  include "arena.c"
+};
+
+TEST(arena, TestAlignment)
+{
+   arena *a = arena_new();
+   int i;
+
+   for (i = 1; i < 100; i++) {
+      char *p = (char *) arena_alloc(a, i);
+      ASSERT_EQ(0u, (uintptr_t) p % ARENA_ALIGN);
+      memset(p, 'x', i);
+   }
+   arena_free(a);
+}
+
+TEST(arena, TestManyChunks)
+{
+   arena *a = arena_new();
+   char  *p[10000];
+   int    i;
+
+   for (i = 0; i < 10000; i++) {
+      p[i] = (char *) arena_alloc(a, 100);
+      snprintf(p[i], 100, "%d", i);
+   }
+   for (i = 0; i < 10000; i++)
+      ASSERT_EQ(i, atoi(p[i]));
+   arena_free(a);
+}
+
+TEST(arena, TestBigBlock)
+{
+   arena *a = arena_new();
+   char  *small = (char *) arena_alloc(a, 10);
+   char  *big = (char *) arena_alloc(a, 3 * ARENA_CHUNK_SIZE);
+   char  *next = (char *) arena_alloc(a, 10);
+
+   memset(big, 'x', 3 * ARENA_CHUNK_SIZE);
+   /* the current chunk keeps being used after a big block */
+   ASSERT_EQ(small + ARENA_ALIGN, next);
+   arena_free(a);
+}
+
+TEST(arena, TestReleaseReuses)
+{
+   arena *a = arena_new();
+   void  *p = arena_alloc(a, 40);
+   void  *q;
+
+   arena_release(a, p, 40);
+   ASSERT_EQ(0u, a->allocated);
+
+   /* a different size class doesn't get it, the same one does */
+   q = arena_alloc(a, 100);
+   ASSERT_NE(p, q);
+   q = arena_alloc(a, 33);
+   ASSERT_EQ(p, q);
+   arena_free(a);
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "bitap.h"
+
+void
+bitap_init(bitap_pattern *p, const char *s, size_t len)
+{
+   size_t i;
+
+   memset(p->masks, 0, sizeof(p->masks));
+   for (i = 0; i < len; i++)
+      p->masks[(unsigned char) s[i]] |= (uint64_t) 1 << i;
+
+   memcpy(p->pattern, s, len);
+   p->len = len;
+}
+
+/*
+ * Can the pattern be in the text with k errors?  Split in k + 1 pieces,
+ * one of them must be there as it is, which memmem(3) finds quickly.
+ */
+static bool
+bitap_may_find(const bitap_pattern *p, const char *text, size_t len, int k)
+{
+   size_t start, end;
+   int    piece;
+
+   for (piece = 0; piece <= k; piece++) {
+      start = p->len * piece / (k + 1);
+      end = p->len * (piece + 1) / (k + 1);
+      if (memmem(text, len, p->pattern + start, end - start) != NULL)
+         return true;
+   }
+
+   return false;
+}
+
+/*
+ * Bit i of r[d] is set while the first i + 1 bytes of the pattern end at
+ * the byte of text just read, with d errors or less.  Reading byte c, that
+ * is so if the first i were so before and pattern[i] is c, or, with one
+ * error more, if the first i were before (c replaced pattern[i]), the first
+ * i + 1 were (c is extra) or the first i are now (pattern[i] is missing).
+ * As r[d] has all the bits of r[d - 1], r[k] tells if it's found at all,
+ * and once found with d errors, only fewer than d matter any more.
+ */
+int
+bitap_find(const bitap_pattern *p, const char *text, size_t len, int k)
+{
+   uint64_t r[BITAP_MAX_ERRORS + 1];
+   uint64_t mask, found, before, old;
+   size_t   i;
+   int      best, d;
+
+   if (k > BITAP_MAX_ERRORS)
+      k = BITAP_MAX_ERRORS;
+   if ((size_t) k >= p->len)
+      k = (int) p->len - 1;
+   if (k > 0 && !bitap_may_find(p, text, len, k))
+      return -1;
+
+   /* before any text, only the first d bytes can be missing */
+   for (d = 0; d <= k; d++)
+      r[d] = ((uint64_t) 1 << d) - 1;
+
+   found = (uint64_t) 1 << (p->len - 1);
+   best = -1;
+   for (i = 0; i < len; i++) {
+      if (text[i] == '\0') {
+         for (d = 0; d <= k; d++)
+            r[d] = ((uint64_t) 1 << d) - 1;
+         continue;
+      }
+
+      mask = p->masks[(unsigned char) text[i]];
+      before = r[0];
+      r[0] = ((r[0] << 1) | 1) & mask;
+      for (d = 1; d <= k; d++) {
+         old = r[d];
+         r[d] = (((old << 1) | 1) & mask)
+              | ((before | r[d - 1]) << 1) | before | 1;
+         before = old;
+      }
+
+      if ((r[k] & found) == 0)
+         continue;
+
+      for (d = 0; (r[d] & found) == 0; d++)
+         continue;
+      best = d;
+      if (best == 0)
+         break;
+      k = d - 1;
+   }
+
+   return best;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef BITAP_H
+#define BITAP_H
+
+#include "../compat/compat.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Approximate substring search, the bit-parallel (bitap) algorithm of Wu
+ * and Manber: the fewest errors (characters inserted, deleted, or replaced,
+ * the Levenshtein distance) with which a pattern is found anywhere in a
+ * text.  Each bit of a word stands for a prefix of the pattern, so a text
+ * is gone through a byte at a time, with a handful of word operations per
+ * error allowed, however long the pattern.  Texts without an exact piece
+ * of the pattern, which any match with few errors must have, are skipped.
+ *
+ * Bytes are compared as they are, so both sides should already be folded
+ * (see mi_fold()).  A '\0' in the text ends one piece of it and starts
+ * another, and a match never spans two.
+ */
+#define BITAP_MAX_LEN      64    /* bytes of a pattern, the bits of a word */
+#define BITAP_MAX_ERRORS   4
+
+typedef struct {
+   uint64_t   masks[256];   /* bit i of masks[c] set if pattern[i] is c */
+   char       pattern[BITAP_MAX_LEN];
+   size_t     len;
+} bitap_pattern;
+
+/* setup a pattern of 1 to BITAP_MAX_LEN bytes */
+void bitap_init(bitap_pattern *p, const char *s, size_t len);
+
+/*
+ * The fewest errors, up to k (and less than the length of the pattern),
+ * with which the pattern is in len bytes of text, or -1 if it isn't.
+ */
+int bitap_find(const bitap_pattern *p, const char *text, size_t len, int k);
+
+#endif
@@ -0,0 +1,110 @@
+#include <gtest/gtest.h>
+
+extern "C" {
+#  include "bitap.c"
+};
+
+static int
+find(const char *pattern, const char *text, int k)
+{
+   static bitap_pattern p;
+
+   bitap_init(&p, pattern, strlen(pattern));
+   return bitap_find(&p, text, strlen(text), k);
+}
+
+/* the fewest errors the obvious way (Sellers), to check against */
+static int
+naive(const char *pattern, const char *text, size_t len, int k)
+{
+   int    prev[BITAP_MAX_LEN + 1], cur[BITAP_MAX_LEN + 1];
+   int    best, cost;
+   size_t i, j, m = strlen(pattern);
+
+   for (j = 0; j <= m; j++)
+      prev[j] = j;
+
+   best = prev[m];
+   for (i = 0; i < len; i++) {
+      if (text[i] == '\0') {
+         for (j = 0; j <= m; j++)
+            prev[j] = j;
+         continue;
+      }
+
+      cur[0] = 0;
+      for (j = 1; j <= m; j++) {
+         cost = prev[j - 1] + (pattern[j - 1] != text[i]);
+         cost = std::min(cost, prev[j] + 1);
+         cost = std::min(cost, cur[j - 1] + 1);
+         cur[j] = cost;
+      }
+      memcpy(prev, cur, sizeof(cur));
+      best = std::min(best, cur[m]);
+   }
+
+   return (best <= k ? best : -1);
+}
+
+TEST(bitap, TestErrors)
+{
+   ASSERT_EQ(0, find("beatles", "the beatles", 2));
+   ASSERT_EQ(1, find("beatls", "the beatles", 2));      /* missing */
+   ASSERT_EQ(1, find("beattles", "the beatles", 2));    /* extra */
+   ASSERT_EQ(1, find("beatlas", "the beatles", 2));     /* replaced */
+   ASSERT_EQ(2, find("baetles", "the beatles", 2));     /* swapped */
+   ASSERT_EQ(-1, find("baetles", "the beatles", 1));
+   ASSERT_EQ(-1, find("stones", "the beatles", 2));
+   ASSERT_EQ(0, find("a", "xyza", 3));
+}
+
+TEST(bitap, TestPieces)
+{
+   static const char text[] = "beat\0les";
+   bitap_pattern p;
+
+   /* a match never spans two pieces of the text */
+   bitap_init(&p, "beatles", 7);
+   ASSERT_EQ(-1, bitap_find(&p, text, sizeof(text) - 1, 2));
+   ASSERT_EQ(3, bitap_find(&p, text, sizeof(text) - 1, 3));
+   ASSERT_EQ(3, naive("beatles", text, sizeof(text) - 1, 3));
+}
+
+TEST(bitap, TestLongest)
+{
+   char pattern[BITAP_MAX_LEN + 1], text[200];
+
+   memset(pattern, 'a', BITAP_MAX_LEN);
+   pattern[BITAP_MAX_LEN] = '\0';
+   memset(text, 'b', sizeof(text) - 1);
+   text[sizeof(text) - 1] = '\0';
+   memcpy(text + 50, pattern, BITAP_MAX_LEN);
+   text[70] = 'c';
+   ASSERT_EQ(1, find(pattern, text, 4));
+}
+
+TEST(bitap, TestRandom)
+{
+   char   pattern[16], text[64];
+   size_t m, n, i;
+   int    k, t;
+
+   srandom(1);
+   for (t = 0; t < 20000; t++) {
+      m = 1 + random() % 12;
+      n = random() % 40;
+      for (i = 0; i < m; i++)
+         pattern[i] = "abc"[random() % 3];
+      for (i = 0; i < n; i++)
+         text[i] = "abc\0"[random() % 4];
+      pattern[m] = text[n] = '\0';
+      k = random() % (BITAP_MAX_ERRORS + 1);
+      if ((size_t) k >= m)
+         k = m - 1;
+
+      bitap_pattern p;
+      bitap_init(&p, pattern, m);
+      ASSERT_EQ(naive(pattern, text, n, k), bitap_find(&p, text, n, k))
+         << pattern << " in " << n << " bytes, k " << k;
+   }
+}
@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "bufio.h"
+
+void
+bufio_init(bufio *b, int fd, size_t size)
+{
+   memset(b, 0, sizeof(bufio));
+   if ((b->buf = (char *) malloc(size)) == NULL)
+      err(1, "%s: malloc failed", __FUNCTION__);
+
+   b->fd = fd;
+   b->size = size;
+}
+
+void
+bufio_free(bufio *b)
+{
+   free(b->buf);
+   b->buf = NULL;
+}
+
+/* write(2) all of len bytes, or record the failure */
+static int
+bufio_write_fd(bufio *b, const char *data, size_t len)
+{
+   ssize_t n;
+
+   while (len > 0) {
+      if ((n = write(b->fd, data, len)) == -1) {
+         if (errno == EINTR)
+            continue;
+
+         b->error = errno;
+         return -1;
+      }
+
+      data += n;
+      len -= n;
+      b->bytes += n;
+      b->calls++;
+   }
+
+   return 0;
+}
+
+void
+bufio_write(bufio *b, const void *data, size_t len)
+{
+   const char *p;
+   size_t      n;
+
+   if (b->error != 0)
+      return;
+
+   /* in memory, just make room */
+   if (b->fd == -1) {
+      if (b->len + len > b->size) {
+         n = b->size * 2;
+         while (n < b->len + len)
+            n *= 2;
+         if ((p = (const char *) realloc(b->buf, n)) == NULL)
+            err(1, "%s: realloc failed", __FUNCTION__);
+         b->buf = (char *) p;
+         b->size = n;
+      }
+
+      memcpy(b->buf + b->len, data, len);
+      b->len += len;
+      b->bytes += len;
+      return;
+   }
+
+   /* big writes go straight to the file, once what's buffered is out */
+   if (len >= b->size) {
+      if (bufio_flush(b) == 0)
+         bufio_write_fd(b, (const char *) data, len);
+      return;
+   }
+
+   p = (const char *) data;
+   while (len > 0) {
+      n = b->size - b->len;
+      if (n > len)
+         n = len;
+
+      memcpy(b->buf + b->len, p, n);
+      b->len += n;
+      p += n;
+      len -= n;
+
+      if (b->len == b->size && bufio_flush(b) == -1)
+         return;
+   }
+}
+
+void
+bufio_zero(bufio *b, size_t len)
+{
+   static const char zeros[64] = { 0 };
+   size_t n;
+
+   while (len > 0) {
+      n = (len < sizeof(zeros) ? len : sizeof(zeros));
+      bufio_write(b, zeros, n);
+      len -= n;
+   }
+}
+
+int
+bufio_flush(bufio *b)
+{
+   if (b->fd == -1)
+      return 0;
+
+   if (b->error == 0 && bufio_write_fd(b, b->buf, b->len) == 0)
+      b->len = 0;
+
+   if (b->error != 0) {
+      errno = b->error;
+      return -1;
+   }
+
+   return 0;
+}
+
+size_t
+bufio_read(bufio *b, void *data, size_t len)
+{
+   ssize_t n;
+   size_t  done, avail;
+
+   done = 0;
+   while (done < len) {
+      /* refill the buffer when it's empty */
+      if (b->pos == b->len) {
+         if (b->eof || b->error != 0)
+            break;
+
+         if ((n = read(b->fd, b->buf, b->size)) == -1) {
+            if (errno == EINTR)
+               continue;
+
+            b->error = errno;
+            break;
+         }
+
+         b->calls++;
+         if (n == 0) {
+            b->eof = true;
+            break;
+         }
+
+         b->bytes += n;
+         b->pos = 0;
+         b->len = n;
+      }
+
+      avail = b->len - b->pos;
+      if (avail > len - done)
+         avail = len - done;
+
+      memcpy((char *) data + done, b->buf + b->pos, avail);
+      b->pos += avail;
+      done += avail;
+   }
+
+   return done;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef BUFIO_H
+#define BUFIO_H
+
+#include "../compat/compat.h"
+
+#include <err.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Block-buffered reading/writing of a file descriptor, for files that are
+ * read or written from start to end (such as the database).  Data is moved
+ * through a large buffer with as few read(2)/write(2) calls as possible, and
+ * writes larger than the buffer skip it entirely.
+ *
+ * Like stdio, errors are sticky: once a read or write fails, later ones do
+ * nothing, and the failure is reported by bufio_flush() (for writers) or the
+ * error member (for readers).  Each bufio also counts the bytes it moved, to
+ * report throughput.
+ *
+ * A writer with no file (an fd of -1) keeps all that's written in memory
+ * instead, growing its buffer as needed: buf and len then hold the data.
+ */
+#define BUFIO_SIZE   (1024 * 1024)
+
+typedef struct {
+   int             fd;
+   char           *buf;
+   size_t          size;
+   size_t          len;       /* bytes in buf */
+   size_t          pos;       /* next byte of buf to read */
+   uint64_t        bytes;     /* moved to/from fd so far */
+   int             calls;     /* read(2)/write(2) calls so far */
+   int             error;     /* errno of the first failure, or 0 */
+   bool            eof;
+} bufio;
+
+/* setup/free a bufio of the given buffer size (the fd is not closed) */
+void bufio_init(bufio *b, int fd, size_t size);
+void bufio_free(bufio *b);
+
+/* buffer len bytes (or len zero bytes) for writing */
+void bufio_write(bufio *b, const void *data, size_t len);
+void bufio_zero(bufio *b, size_t len);
+
+/* write all that's buffered, returning -1 (with errno set) on failure */
+int bufio_flush(bufio *b);
+
+/* read up to len bytes, returning how many were read */
+size_t bufio_read(bufio *b, void *data, size_t len);
+
+#endif
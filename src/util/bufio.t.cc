@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+#include <fcntl.h>
+
+extern "C" {
+#  include "bufio.c"
+};
+
+static int
+tmpfd(void)
+{
+   char path[] = "/tmp/bufio.t.XXXXXX";
+   int  fd = mkstemp(path);
+
+   unlink(path);
+   return fd;
+}
+
+TEST(bufio, TestWriteRead)
+{
+   static char data[100000];
+   static char back[100000];
+   bufio b;
+   int   fd = tmpfd();
+   int   i;
+
+   for (i = 0; i < (int) sizeof(data); i++)
+      data[i] = i % 251;
+
+   /* small writes are gathered into a few write(2)s */
+   bufio_init(&b, fd, 4096);
+   for (i = 0; i < (int) sizeof(data); i += 100)
+      bufio_write(&b, data + i, 100);
+   ASSERT_EQ(0, bufio_flush(&b));
+   ASSERT_EQ(sizeof(data), b.bytes);
+   ASSERT_EQ((int) ((sizeof(data) + 4095) / 4096), b.calls);
+   bufio_free(&b);
+
+   lseek(fd, 0, SEEK_SET);
+   bufio_init(&b, fd, 4096);
+   for (i = 0; i < (int) sizeof(back); i += 1000)
+      ASSERT_EQ(1000u, bufio_read(&b, back + i, 1000));
+   ASSERT_EQ(0u, bufio_read(&b, back, 1));
+   ASSERT_TRUE(b.eof);
+   ASSERT_EQ(0, b.error);
+   ASSERT_EQ(0, memcmp(data, back, sizeof(data)));
+   bufio_free(&b);
+   close(fd);
+}
+
+TEST(bufio, TestBigWriteSkipsBuffer)
+{
+   static char data[10000];
+   char  back[10010];
+   bufio b;
+   int   fd = tmpfd();
+
+   memset(data, 'x', sizeof(data));
+   bufio_init(&b, fd, 1024);
+   bufio_write(&b, "abc", 3);
+   bufio_write(&b, data, sizeof(data));
+   bufio_zero(&b, 7);
+   ASSERT_EQ(0, bufio_flush(&b));
+   ASSERT_EQ(3, b.calls);
+   bufio_free(&b);
+
+   ASSERT_EQ((ssize_t) sizeof(back), pread(fd, back, sizeof(back), 0));
+   ASSERT_EQ(0, memcmp(back, "abcxxx", 6));
+   ASSERT_EQ('x', back[10002]);
+   ASSERT_EQ('\0', back[10003]);
+   ASSERT_EQ('\0', back[10009]);
+   close(fd);
+}
+
+TEST(bufio, TestErrorIsSticky)
+{
+   bufio b;
+   int   fd = open("/dev/null", O_RDONLY);
+
+   bufio_init(&b, fd, 16);
+   bufio_write(&b, "0123456789abcdef", 16);
+   ASSERT_NE(0, b.error);
+   bufio_write(&b, "x", 1);
+   ASSERT_EQ(-1, bufio_flush(&b));
+   ASSERT_EQ(EBADF, errno);
+   bufio_free(&b);
+   close(fd);
+}
+
+TEST(bufio, TestMemory)
+{
+   static char data[5000];
+   bufio b;
+   int   i;
+
+   for (i = 0; i < (int) sizeof(data); i++)
+      data[i] = i % 7;
+
+   bufio_init(&b, -1, 16);
+   bufio_write(&b, data, 10);
+   bufio_write(&b, data + 10, sizeof(data) - 10);
+   ASSERT_EQ(0, bufio_flush(&b));
+   ASSERT_EQ(sizeof(data), b.len);
+   ASSERT_EQ(sizeof(data), b.bytes);
+   ASSERT_EQ(0, b.calls);
+   ASSERT_EQ(0, memcmp(data, b.buf, sizeof(data)));
+   bufio_free(&b);
+}
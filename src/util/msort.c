@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "msort.h"
+
+/* insertion sort the n elements at base, using tmp for one element */
+static void
+msort_insertion(char *base, size_t n, size_t size, msort_cmp cmp, void *arg,
+   char *tmp)
+{
+   size_t i, j;
+
+   for (i = 1; i < n; i++) {
+      j = i;
+      if (cmp(base + (j - 1) * size, base + j * size, arg) <= 0)
+         continue;
+
+      memcpy(tmp, base + i * size, size);
+      while (j > 0 && cmp(base + (j - 1) * size, tmp, arg) > 0) {
+         memcpy(base + j * size, base + (j - 1) * size, size);
+         j--;
+      }
+      memcpy(base + j * size, tmp, size);
+   }
+}
+
+/* merge the sorted runs [0, mid) and [mid, n) of src into dst */
+static void
+msort_merge(const char *src, char *dst, size_t mid, size_t n, size_t size,
+   msort_cmp cmp, void *arg)
+{
+   size_t i, j, k;
+
+   /* already in order, so just copy */
+   if (cmp(src + (mid - 1) * size, src + mid * size, arg) <= 0) {
+      memcpy(dst, src, n * size);
+      return;
+   }
+
+   i = 0;
+   j = mid;
+   k = 0;
+   while (i < mid && j < n) {
+      /* ties take from the left, which is what keeps it stable */
+      if (cmp(src + j * size, src + i * size, arg) < 0)
+         memcpy(dst + k++ * size, src + j++ * size, size);
+      else
+         memcpy(dst + k++ * size, src + i++ * size, size);
+   }
+   memcpy(dst + k * size, src + i * size, (mid - i) * size);
+   k += mid - i;
+   memcpy(dst + k * size, src + j * size, (n - j) * size);
+}
+
+void
+msort(void *base, size_t n, size_t size, msort_cmp cmp, void *arg)
+{
+   char   *buf, *src, *dst, *swap;
+   size_t  i, width, mid, len;
+
+   if (n < 2)
+      return;
+
+   if ((buf = (char *) malloc(n * size)) == NULL)
+      err(1, "%s: malloc failed", __FUNCTION__);
+
+   for (i = 0; i < n; i += MSORT_RUN)
+      msort_insertion((char *) base + i * size,
+         (n - i < MSORT_RUN ? n - i : MSORT_RUN), size, cmp, arg, buf);
+
+   src = (char *) base;
+   dst = buf;
+   for (width = MSORT_RUN; width < n; width *= 2) {
+      for (i = 0; i < n; i += 2 * width) {
+         len = (n - i < 2 * width ? n - i : 2 * width);
+         mid = (len < width ? len : width);
+         if (mid == len)
+            memcpy(dst + i * size, src + i * size, len * size);
+         else
+            msort_merge(src + i * size, dst + i * size, mid, len, size,
+               cmp, arg);
+      }
+      swap = src;
+      src = dst;
+      dst = swap;
+   }
+
+   if (src != (char *) base)
+      memcpy(base, src, n * size);
+
+   free(buf);
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef MSORT_H
+#define MSORT_H
+
+#include "../compat/compat.h"
+
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * A stable merge sort, like mergesort(3) but portable, and with a context
+ * argument passed through to the comparison function (like qsort_r(3), but
+ * the same everywhere).  Without it, comparisons can't be made against
+ * anything but globals, so sorts couldn't run on more than one thread.
+ *
+ * Short runs are insertion sorted first, then merged back and forth between
+ * the array and a temporary one of the same size.
+ */
+#define MSORT_RUN  16
+
+typedef int (*msort_cmp)(const void *a, const void *b, void *arg);
+
+void msort(void *base, size_t n, size_t size, msort_cmp cmp, void *arg);
+
+#endif
@@ -0,0 +1,58 @@
+#include <gtest/gtest.h>
+
+extern "C" {
+#  include "msort.c"
+};
+
+typedef struct {
+   int key;
+   int seq;
+} item;
+
+static int
+item_cmp(const void *a, const void *b, void *arg)
+{
+   const item *x = (const item *) a;
+   const item *y = (const item *) b;
+
+   (*(int *) arg)++;
+   return x->key - y->key;
+}
+
+TEST(msort, TestSortsAndIsStable)
+{
+   static item items[10007];
+   int  ncmp = 0;
+   int  n, i;
+
+   for (n = 0; n <= (int) (sizeof(items) / sizeof(item)); n += 1 + n / 3) {
+      for (i = 0; i < n; i++) {
+         items[i].key = (i * 7919) % 101;
+         items[i].seq = i;
+      }
+
+      msort(items, n, sizeof(item), item_cmp, &ncmp);
+      for (i = 1; i < n; i++) {
+         ASSERT_LE(items[i - 1].key, items[i].key);
+         if (items[i - 1].key == items[i].key)
+            ASSERT_LT(items[i - 1].seq, items[i].seq);
+      }
+   }
+   ASSERT_GT(ncmp, 0);
+}
+
+TEST(msort, TestSortedInputIsCheap)
+{
+   static item items[4096];
+   int  ncmp = 0;
+   int  i;
+
+   for (i = 0; i < 4096; i++)
+      items[i].key = items[i].seq = i;
+
+   /* one comparison per element to insert, and one per merge */
+   msort(items, 4096, sizeof(item), item_cmp, &ncmp);
+   ASSERT_LT(ncmp, 2 * 4096);
+   for (i = 0; i < 4096; i++)
+      ASSERT_EQ(i, items[i].seq);
+}
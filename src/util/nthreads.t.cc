@@ -0,0 +1,24 @@
+#include <gtest/gtest.h>
+
+extern "C" {
+#  include "nthreads.c"
+};
+
+TEST(nthreads, TestFewItems)
+{
+   ASSERT_EQ(1, nthreads_for(0, 100, 64));
+   ASSERT_EQ(1, nthreads_for(99, 100, 64));
+}
+
+TEST(nthreads, TestLimits)
+{
+   long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+   int  n;
+
+   n = nthreads_for(1000000, 1, 64);
+   ASSERT_LE(n, 64);
+   ASSERT_LE(n, ncpu < 1 ? 1 : ncpu);
+   ASSERT_GE(n, 1);
+   ASSERT_EQ(1, nthreads_for(1000000, 1, 1));
+   ASSERT_LE(nthreads_for(300, 100, 64), 3);
+}
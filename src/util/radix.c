@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "radix.h"
+
+/* a group of items still to be sorted, whose keys agree before depth */
+typedef struct {
+   size_t start;
+   size_t n;
+   size_t depth;
+   size_t block;     /* of the bytes in the caches of its items */
+} radix_group;
+
+/* compare two items by their keys from a given depth on, for msort() */
+static int
+radix_cmp(const void *a, const void *b, void *arg)
+{
+   const radix_item *x = (const radix_item *) a;
+   const radix_item *y = (const radix_item *) b;
+   size_t            depth = *(size_t *) arg;
+   size_t            len;
+   int               ret;
+
+   len = (x->len < y->len ? x->len : y->len);
+   if (len > depth && (ret = memcmp(x->key + depth, y->key + depth,
+                                    len - depth)) != 0)
+      return ret;
+
+   return (x->len > y->len) - (x->len < y->len);
+}
+
+/*
+ * Bucket of an item at a depth: 0 once its key ends, else its byte + 1,
+ * taken from the cache (which holds the bytes of the block of RADIX_CACHE
+ * the depth is in).
+ */
+#define RADIX_BUCKET(item, depth) \
+   ((depth) < (item)->len ? (item)->cache[(depth) % RADIX_CACHE] + 1 : 0)
+
+/* cache the given block of bytes of the keys of n items */
+static void
+radix_fill(radix_item *a, size_t n, size_t block)
+{
+   size_t i, start, len;
+
+   start = block * RADIX_CACHE;
+   for (i = 0; i < n; i++) {
+      len = 0;
+      if (a[i].len > start)
+         len = a[i].len - start;
+      if (len > RADIX_CACHE)
+         len = RADIX_CACHE;
+      memcpy(a[i].cache, a[i].key + start, len);
+   }
+}
+
+/*
+ * Number of bytes from depth on that the keys of all n items share, which
+ * mostly takes a byte per item to find out (when there are none).
+ */
+static size_t
+radix_prefix(const radix_item *a, size_t n, size_t depth)
+{
+   size_t i, len, prefix;
+
+   prefix = (a[0].len > depth ? a[0].len - depth : 0);
+   for (i = 1; i < n && prefix > 0; i++) {
+      len = 0;
+      while (len < prefix && depth + len < a[i].len
+      &&     a[i].key[depth + len] == a[0].key[depth + len])
+         len++;
+      prefix = len;
+   }
+
+   return prefix;
+}
+
+void
+radix_sort(radix_item *items, size_t n)
+{
+   radix_group *stack, *new_stack, g;
+   radix_item  *tmp, *a;
+   size_t       count[257], pos[257];
+   size_t       nstack, capacity, i, b;
+
+   if (n < 2)
+      return;
+
+   capacity = 64;
+   tmp = (radix_item *) malloc(n * sizeof(radix_item));
+   stack = (radix_group *) malloc(capacity * sizeof(radix_group));
+   if (tmp == NULL || stack == NULL)
+      err(1, "%s: malloc failed", __FUNCTION__);
+
+   stack[0].start = 0;
+   stack[0].n = n;
+   stack[0].depth = 0;
+   stack[0].block = 0;
+   nstack = 1;
+   radix_fill(items, n, 0);
+
+   while (nstack > 0) {
+      g = stack[--nstack];
+      a = items + g.start;
+
+      if (g.n < RADIX_CUTOFF) {
+         msort(a, g.n, sizeof(radix_item), radix_cmp, &g.depth);
+         continue;
+      }
+
+      /* skip over the bytes all of the group share */
+      g.depth += radix_prefix(a, g.n, g.depth);
+      if (g.depth / RADIX_CACHE != g.block) {
+         g.block = g.depth / RADIX_CACHE;
+         radix_fill(a, g.n, g.block);
+      }
+
+      memset(count, 0, sizeof(count));
+      for (i = 0; i < g.n; i++)
+         count[RADIX_BUCKET(&a[i], g.depth)]++;
+
+      /* all of the keys ended, so they're all equal */
+      if (count[0] == g.n)
+         continue;
+
+      /* distribute, keeping the order within each bucket */
+      pos[0] = 0;
+      for (b = 1; b < 257; b++)
+         pos[b] = pos[b - 1] + count[b - 1];
+      for (i = 0; i < g.n; i++)
+         tmp[pos[RADIX_BUCKET(&a[i], g.depth)]++] = a[i];
+      memcpy(a, tmp, g.n * sizeof(radix_item));
+
+      /* the keys that ended are equal and done, the others go on */
+      for (b = 1; b < 257; b++) {
+         if (count[b] < 2)
+            continue;
+
+         if (nstack == capacity) {
+            capacity *= 2;
+            new_stack = (radix_group *) realloc(stack,
+               capacity * sizeof(radix_group));
+            if (new_stack == NULL)
+               err(1, "%s: realloc failed", __FUNCTION__);
+            stack = new_stack;
+         }
+
+         stack[nstack].start = g.start + pos[b] - count[b];
+         stack[nstack].n = count[b];
+         stack[nstack].depth = g.depth + 1;
+         stack[nstack].block = g.block;
+         nstack++;
+      }
+   }
+
+   free(stack);
+   free(tmp);
+}
+
+void
+radix_merge(const radix_item *a, size_t na, const radix_item *b, size_t nb,
+   radix_item *out)
+{
+   size_t depth = 0;
+
+   while (na > 0 && nb > 0) {
+      if (radix_cmp(b, a, &depth) < 0) {
+         *out++ = *b++;
+         nb--;
+      } else {
+         *out++ = *a++;
+         na--;
+      }
+   }
+
+   memcpy(out, a, na * sizeof(radix_item));
+   memcpy(out + na, b, nb * sizeof(radix_item));
+}
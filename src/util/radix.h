@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef RADIX_H
+#define RADIX_H
+
+#include "../compat/compat.h"
+
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "msort.h"
+
+/*
+ * A stable most-significant-digit radix sort of items by binary keys, in
+ * the order memcmp(3) gives (a key that is a prefix of another sorts first).
+ * Each pass distributes the items by one byte of their keys, skipping bytes
+ * that all of them share, and groups smaller than RADIX_CUTOFF are finished
+ * with msort() instead.  The keys aren't copied: they must stay put until
+ * the sort is done.  Each item caches RADIX_CACHE bytes of its key, so
+ * most passes don't have to reach for the keys themselves.
+ */
+#define RADIX_CUTOFF  32
+#define RADIX_CACHE   8
+
+typedef struct {
+   const unsigned char  *key;
+   uint32_t              len;
+   uint32_t              idx;     /* for the caller, not looked at */
+   unsigned char         cache[RADIX_CACHE];
+} radix_item;
+
+void radix_sort(radix_item *items, size_t n);
+
+/*
+ * Merge the sorted items of a and b into out, those of a going first when
+ * their keys are equal (so sorting parts of an array with radix_sort() and
+ * merging them keeps it stable).
+ */
+void radix_merge(const radix_item *a, size_t na, const radix_item *b,
+   size_t nb, radix_item *out);
+
+#endif
@@ -0,0 +1,85 @@
+#include <gtest/gtest.h>
+
+extern "C" {
+#  include "radix.c"
+};
+
+/* n keys of a few letters, with long shared prefixes and empty ones */
+static void
+make_keys(radix_item *items, char (*keys)[16], int n)
+{
+   int i, j, len;
+
+   srand(1);
+   for (i = 0; i < n; i++) {
+      len = rand() % 12;
+      for (j = 0; j < len; j++)
+         keys[i][j] = (j < 4 ? 'x' : 'a' + rand() % 3);
+      items[i].key = (const unsigned char *) keys[i];
+      items[i].len = len;
+      items[i].idx = i;
+   }
+}
+
+TEST(radix, TestSortsLikeMemcmpAndIsStable)
+{
+   static radix_item items[20000];
+   static char       keys[20000][16];
+   const radix_item *x, *y;
+   size_t            len;
+   int               n, i, cmp;
+
+   for (n = 0; n <= 20000; n += 1 + n) {
+      make_keys(items, keys, n);
+      radix_sort(items, n);
+
+      for (i = 1; i < n; i++) {
+         x = &items[i - 1];
+         y = &items[i];
+         len = (x->len < y->len ? x->len : y->len);
+         cmp = memcmp(x->key, y->key, len);
+         if (cmp == 0)
+            cmp = (int) x->len - (int) y->len;
+
+         ASSERT_LE(cmp, 0);
+         if (cmp == 0)
+            ASSERT_LT(x->idx, y->idx);
+      }
+   }
+}
+
+TEST(radix, TestEqualKeys)
+{
+   static radix_item items[1000];
+   int i;
+
+   for (i = 0; i < 1000; i++) {
+      items[i].key = (const unsigned char *) "same";
+      items[i].len = (i % 2 ? 4 : 0);
+      items[i].idx = i;
+   }
+
+   radix_sort(items, 1000);
+   for (i = 0; i < 500; i++) {
+      ASSERT_EQ(2u * i, items[i].idx);
+      ASSERT_EQ(2u * i + 1, items[500 + i].idx);
+   }
+}
+
+TEST(radix, TestMergeIsStable)
+{
+   static radix_item items[5000], out[5000];
+   static char       keys[5000][16];
+   int               i;
+
+   /* two sorted halves, merged like one sorted whole */
+   make_keys(items, keys, 5000);
+   radix_sort(items, 2000);
+   radix_sort(items + 2000, 3000);
+   radix_merge(items, 2000, items + 2000, 3000, out);
+
+   make_keys(items, keys, 5000);
+   radix_sort(items, 5000);
+   for (i = 0; i < 5000; i++)
+      ASSERT_EQ(items[i].idx, out[i].idx);
+}
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "strhash.h"
+
+#define STRHASH_MIN_CAPACITY  16
+
+/* FNV-1a */
+static unsigned long
+strhash_hash(const char *key)
+{
+   unsigned long hash = 2166136261UL;
+
+   while (*key != '\0') {
+      hash ^= (unsigned char) *key++;
+      hash *= 16777619UL;
+   }
+
+   return hash;
+}
+
+/* find the slot of a key, or the empty slot where it would go */
+static size_t
+strhash_slot(const strhash *h, const char *key)
+{
+   size_t i;
+
+   i = strhash_hash(key) & (h->capacity - 1);
+   while (h->entries[i].key != NULL && strcmp(h->entries[i].key, key) != 0)
+      i = (i + 1) & (h->capacity - 1);
+
+   return i;
+}
+
+/* (re)allocate a table with the given capacity and re-insert all entries */
+static void
+strhash_resize(strhash *h, size_t capacity)
+{
+   strhash_entry *old;
+   size_t         old_capacity, i, slot;
+
+   old = h->entries;
+   old_capacity = h->capacity;
+
+   h->entries = (strhash_entry *) calloc(capacity, sizeof(strhash_entry));
+   if (h->entries == NULL)
+      err(1, "%s: calloc failed", __FUNCTION__);
+   h->capacity = capacity;
+
+   for (i = 0; i < old_capacity; i++) {
+      if (old[i].key != NULL) {
+         slot = strhash_slot(h, old[i].key);
+         h->entries[slot] = old[i];
+      }
+   }
+
+   free(old);
+}
+
+strhash *
+strhash_new(size_t size_hint)
+{
+   strhash *h;
+   size_t   capacity;
+
+   /* keep the table at most half full */
+   capacity = STRHASH_MIN_CAPACITY;
+   while (capacity < size_hint * 2)
+      capacity *= 2;
+
+   if ((h = (strhash *) malloc(sizeof(strhash))) == NULL)
+      err(1, "%s: malloc failed", __FUNCTION__);
+
+   h->entries = NULL;
+   h->capacity = 0;
+   h->nentries = 0;
+   strhash_resize(h, capacity);
+   return h;
+}
+
+void
+strhash_free(strhash *h)
+{
+   free(h->entries);
+   free(h);
+}
+
+void
+strhash_clear(strhash *h)
+{
+   memset(h->entries, 0, h->capacity * sizeof(strhash_entry));
+   h->nentries = 0;
+}
+
+void
+strhash_set(strhash *h, const char *key, int value)
+{
+   size_t slot;
+
+   if ((h->nentries + 1) * 2 > h->capacity)
+      strhash_resize(h, h->capacity * 2);
+
+   slot = strhash_slot(h, key);
+   if (h->entries[slot].key == NULL)
+      h->nentries++;
+
+   h->entries[slot].key = key;
+   h->entries[slot].value = value;
+}
+
+strhash_entry *
+strhash_get(const strhash *h, const char *key)
+{
+   size_t slot;
+
+   slot = strhash_slot(h, key);
+   if (h->entries[slot].key == NULL)
+      return NULL;
+
+   return &(h->entries[slot]);
+}
+
+bool
+strhash_remove(strhash *h, const char *key)
+{
+   size_t hole, i, home, mask;
+
+   mask = h->capacity - 1;
+   hole = strhash_slot(h, key);
+   if (h->entries[hole].key == NULL)
+      return false;
+
+   /*
+    * Shift back any following entries of the same run that can move into
+    * the hole, so lookups never need tombstones.
+    */
+   i = hole;
+   for (;;) {
+      i = (i + 1) & mask;
+      if (h->entries[i].key == NULL)
+         break;
+
+      home = strhash_hash(h->entries[i].key) & mask;
+      if (((i - home) & mask) >= ((i - hole) & mask)) {
+         h->entries[hole] = h->entries[i];
+         hole = i;
+      }
+   }
+
+   h->entries[hole].key = NULL;
+   h->entries[hole].value = 0;
+   h->nentries--;
+   return true;
+}
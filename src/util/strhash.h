@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef STRHASH_H
+#define STRHASH_H
+
+#include "../compat/compat.h"
+
+#include <err.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * A hash table mapping strings to integers, using open addressing with
+ * linear probing.  Keys are NOT copied: the caller owns them and must keep
+ * them alive (and unchanged) for as long as they are in the table.
+ */
+typedef struct {
+   const char  *key;
+   int          value;
+} strhash_entry;
+
+typedef struct {
+   strhash_entry  *entries;
+   size_t          capacity;   /* always a power of two */
+   size_t          nentries;
+} strhash;
+
+/* create/destroy a table, with room for at least size_hint entries */
+strhash *strhash_new(size_t size_hint);
+void strhash_free(strhash *h);
+
+/* remove all entries, keeping the table's memory */
+void strhash_clear(strhash *h);
+
+/*
+ * Insert a key, or if an equal key is already present, replace both its
+ * key pointer and its value.
+ */
+void strhash_set(strhash *h, const char *key, int value);
+
+/*
+ * find the entry of a key, or NULL if not present.  Its value may be
+ * changed in place, until the table is next changed.
+ */
+strhash_entry *strhash_get(const strhash *h, const char *key);
+
+/* remove a key, returning true if it was present */
+bool strhash_remove(strhash *h, const char *key);
+
+#endif
@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+
+extern "C" {
+#  include "strhash.c"
+};
+
+TEST(strhash, TestEmpty)
+{
+   strhash *h = strhash_new(0);
+   ASSERT_TRUE(NULL == strhash_get(h, "foo"));
+   ASSERT_EQ(false, strhash_remove(h, "foo"));
+   ASSERT_EQ(0u, h->nentries);
+   strhash_free(h);
+}
+
+TEST(strhash, TestSetGet)
+{
+   strhash *h = strhash_new(0);
+   strhash_set(h, "foo", 1);
+   strhash_set(h, "bar", 2);
+   ASSERT_EQ(1, strhash_get(h, "foo")->value);
+   ASSERT_EQ(2, strhash_get(h, "bar")->value);
+   ASSERT_TRUE(NULL == strhash_get(h, "baz"));
+   ASSERT_EQ(2u, h->nentries);
+   strhash_free(h);
+}
+
+TEST(strhash, TestReplaceKeepsLatestKey)
+{
+   char first[] = "foo";
+   char second[] = "foo";
+   strhash *h = strhash_new(0);
+
+   strhash_set(h, first, 1);
+   strhash_set(h, second, 2);
+   ASSERT_EQ(1u, h->nentries);
+   ASSERT_EQ(2, strhash_get(h, "foo")->value);
+   ASSERT_EQ(second, strhash_get(h, "foo")->key);
+   strhash_free(h);
+}
+
+TEST(strhash, TestChangeValueInPlace)
+{
+   strhash *h = strhash_new(0);
+   strhash_set(h, "foo", 1);
+   strhash_set(h, "bar", 2);
+   strhash_get(h, "foo")->value = 3;
+   ASSERT_EQ(3, strhash_get(h, "foo")->value);
+   ASSERT_EQ(2, strhash_get(h, "bar")->value);
+   strhash_free(h);
+}
+
+TEST(strhash, TestGrowAndRemove)
+{
+   static char keys[1000][16];
+   strhash *h = strhash_new(0);
+   int i;
+
+   for (i = 0; i < 1000; i++) {
+      snprintf(keys[i], sizeof(keys[i]), "/music/%d.mp3", i);
+      strhash_set(h, keys[i], i);
+   }
+   ASSERT_EQ(1000u, h->nentries);
+
+   /* remove every third key and make sure the rest are still found */
+   for (i = 0; i < 1000; i += 3)
+      ASSERT_EQ(true, strhash_remove(h, keys[i]));
+
+   for (i = 0; i < 1000; i++) {
+      if (i % 3 == 0)
+         ASSERT_TRUE(NULL == strhash_get(h, keys[i]));
+      else
+         ASSERT_EQ(i, strhash_get(h, keys[i])->value);
+   }
+   strhash_free(h);
+}
+
+TEST(strhash, TestClear)
+{
+   strhash *h = strhash_new(100);
+   strhash_set(h, "foo", 1);
+   strhash_clear(h);
+   ASSERT_EQ(0u, h->nentries);
+   ASSERT_TRUE(NULL == strhash_get(h, "foo"));
+   strhash_free(h);
+}
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Microbenchmark of substr_find() against strcasestr(3), matching tokens
+ * against the filename and fields of a synthetic library of a million
+ * records, the way mi_match() does.  Run by "make bench".
+ */
+
+#include "substr.h"
+
+#include <stdio.h>
+#include <strings.h>
+#include <sys/time.h>
+
+#define BENCH_ROWS    1000000
+#define BENCH_FIELDS  9          /* the filename and the 8 cinfo */
+
+static const char *bench_words[] = {
+   "love", "Night", "blue", "The", "heart", "Road", "fire", "rain",
+   "Dream", "song", "home", "light", "dance", "Moon", "river", "gold"
+};
+
+/* the tokens timed: common, rare, and not there at all */
+static const char *bench_tokens[] = {
+   "the", "dream", "artist 4242", "LIVE at", "e", "zq"
+};
+
+static unsigned int bench_seed = 1;
+
+static unsigned int
+bench_rand(void)
+{
+   bench_seed = bench_seed * 1103515245 + 12345;
+   return bench_seed >> 8;
+}
+
+static const char *
+bench_word(void)
+{
+   return bench_words[bench_rand() % 16];
+}
+
+/* one long block of NUL-terminated strings, BENCH_FIELDS per row */
+static char **
+bench_rows(void)
+{
+   char   **rows, *buf;
+   size_t   size, len;
+   int      i;
+
+   size = (size_t) BENCH_ROWS * 160;
+   rows = (char **) malloc((size_t) BENCH_ROWS * BENCH_FIELDS * sizeof(char*));
+   buf = (char *) malloc(size);
+   if (rows == NULL || buf == NULL)
+      err(1, "%s: malloc failed", __FUNCTION__);
+
+   len = 0;
+   for (i = 0; i < BENCH_ROWS * BENCH_FIELDS; i++) {
+      rows[i] = buf + len;
+      switch (i % BENCH_FIELDS) {
+      case 0:
+         len += sprintf(buf + len, "/music/Artist %u/%s %s/%02u %s.mp3",
+            bench_rand() % 5000, bench_word(), bench_word(),
+            bench_rand() % 20, bench_word());
+         break;
+      case 1:
+         len += sprintf(buf + len, "Artist %u", bench_rand() % 5000);
+         break;
+      case 2:
+      case 3:
+         len += sprintf(buf + len, "%s of %s", bench_word(), bench_word());
+         break;
+      case 4:
+         len += sprintf(buf + len, "%u", bench_rand() % 20);
+         break;
+      case 5:
+         len += sprintf(buf + len, "%u", 1950 + bench_rand() % 70);
+         break;
+      case 6:
+         len += sprintf(buf + len, "Rock");
+         break;
+      case 7:
+         len += sprintf(buf + len, "%u:%02u", bench_rand() % 9,
+            bench_rand() % 60);
+         break;
+      default:
+         len += sprintf(buf + len, "%s", "");
+      }
+      len++;
+   }
+
+   return rows;
+}
+
+static double
+bench_now(void)
+{
+   struct timeval tv;
+
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int
+main(void)
+{
+   substr_pattern   p;
+   char           **rows;
+   double           start, libc, ours;
+   int              t, i, j, nlibc, nours;
+
+   rows = bench_rows();
+   printf("%-14s %10s %10s %10s %8s\n", "token", "matches", "strcasestr",
+      "substr", "speedup");
+
+   for (t = 0; t < (int) (sizeof(bench_tokens) / sizeof(char*)); t++) {
+      nlibc = nours = 0;
+
+      start = bench_now();
+      for (i = 0; i < BENCH_ROWS; i++) {
+         for (j = 0; j < BENCH_FIELDS; j++) {
+            if (strcasestr(rows[i * BENCH_FIELDS + j], bench_tokens[t])) {
+               nlibc++;
+               break;
+            }
+         }
+      }
+      libc = bench_now() - start;
+
+      start = bench_now();
+      substr_init(&p, bench_tokens[t]);
+      for (i = 0; i < BENCH_ROWS; i++) {
+         for (j = 0; j < BENCH_FIELDS; j++) {
+            if (substr_find(&p, rows[i * BENCH_FIELDS + j]) != NULL) {
+               nours++;
+               break;
+            }
+         }
+      }
+      substr_free(&p);
+      ours = bench_now() - start;
+
+      if (nlibc != nours)
+         errx(1, "\"%s\": strcasestr matched %d rows, substr %d",
+            bench_tokens[t], nlibc, nours);
+
+      printf("%-14s %10d %8.1fms %8.1fms %7.1fx\n", bench_tokens[t], nours,
+         libc * 1e3, ours * 1e3, libc / ours);
+   }
+
+   free(rows[0]);
+   free(rows);
+   return 0;
+}
@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "substr.h"
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#  if defined(__x86_64__) && defined(__GNUC__)
+#     include <immintrin.h>
+#     define SUBSTR_AVX2
+#  endif
+#endif
+
+#ifdef SUBSTR_AVX2
+/* set by substr_init(), so it's never written while searching */
+static bool substr_has_avx2 = false;
+#endif
+
+#define SUBSTR_LOWER(c) \
+   ((c) >= 'A' && (c) <= 'Z' ? (c) | 0x20 : (c))
+
+#define SUBSTR_IS_ALPHA(c) \
+   (((c) | 0x20) >= 'a' && ((c) | 0x20) <= 'z')
+
+void
+substr_init(substr_pattern *p, const char *s)
+{
+   size_t i;
+
+   p->len = strlen(s);
+   if ((p->folded = (char *) malloc(p->len + 1)) == NULL)
+      err(1, "%s: malloc failed", __FUNCTION__);
+
+   for (i = 0; i <= p->len; i++)
+      p->folded[i] = SUBSTR_LOWER((unsigned char) s[i]);
+
+   p->first = p->folded[0];
+   p->last = p->folded[p->len == 0 ? 0 : p->len - 1];
+   p->first_case = SUBSTR_IS_ALPHA(p->first) ? 0x20 : 0;
+   p->last_case = SUBSTR_IS_ALPHA(p->last) ? 0x20 : 0;
+
+#ifdef SUBSTR_AVX2
+   substr_has_avx2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
+void
+substr_free(substr_pattern *p)
+{
+   free(p->folded);
+   p->folded = NULL;
+}
+
+/* does the pattern (but its first and last bytes) match at s? */
+static bool
+substr_match_middle(const substr_pattern *p, const unsigned char *s)
+{
+   size_t i;
+
+   for (i = 1; i + 1 < p->len; i++) {
+      if (SUBSTR_LOWER(s[i]) != (unsigned char) p->folded[i])
+         return false;
+   }
+
+   return true;
+}
+
+/*
+ * The first place in s[0, end) that the pattern starts at (with at least
+ * p->len bytes of s from there), one at a time.
+ */
+static const char *
+substr_find_bytes(const substr_pattern *p, const unsigned char *s,
+   size_t start, size_t end)
+{
+   size_t i;
+
+   for (i = start; i < end; i++) {
+      if ((s[i] | p->first_case) == p->first
+      &&  (s[i + p->len - 1] | p->last_case) == p->last
+      &&  substr_match_middle(p, s + i))
+         return (const char *) (s + i);
+   }
+
+   return NULL;
+}
+
+#ifdef SUBSTR_AVX2
+/* the same, 32 at a time, from *start on (which it advances) */
+__attribute__((target("avx2")))
+static const char *
+substr_find_avx2(const substr_pattern *p, const unsigned char *s,
+   size_t *start, size_t end)
+{
+   __m256i  first, last, first_case, last_case, a, b;
+   unsigned mask;
+   size_t   i;
+   int      bit;
+
+   first = _mm256_set1_epi8((char) p->first);
+   last = _mm256_set1_epi8((char) p->last);
+   first_case = _mm256_set1_epi8((char) p->first_case);
+   last_case = _mm256_set1_epi8((char) p->last_case);
+
+   for (i = *start; i + 32 <= end; i += 32) {
+      a = _mm256_loadu_si256((const __m256i *) (s + i));
+      b = _mm256_loadu_si256((const __m256i *) (s + i + p->len - 1));
+      a = _mm256_cmpeq_epi8(_mm256_or_si256(a, first_case), first);
+      b = _mm256_cmpeq_epi8(_mm256_or_si256(b, last_case), last);
+      mask = (unsigned) _mm256_movemask_epi8(_mm256_and_si256(a, b));
+
+      while (mask != 0) {
+         bit = __builtin_ctz(mask);
+         if (substr_match_middle(p, s + i + bit))
+            return (const char *) (s + i + bit);
+         mask &= mask - 1;
+      }
+   }
+
+   *start = i;
+   return NULL;
+}
+#endif
+
+#ifdef __SSE2__
+/* the same, 16 at a time */
+static const char *
+substr_find_sse2(const substr_pattern *p, const unsigned char *s,
+   size_t *start, size_t end)
+{
+   __m128i  first, last, first_case, last_case, a, b;
+   unsigned mask;
+   size_t   i;
+   int      bit;
+
+   first = _mm_set1_epi8((char) p->first);
+   last = _mm_set1_epi8((char) p->last);
+   first_case = _mm_set1_epi8((char) p->first_case);
+   last_case = _mm_set1_epi8((char) p->last_case);
+
+   for (i = *start; i + 16 <= end; i += 16) {
+      a = _mm_loadu_si128((const __m128i *) (s + i));
+      b = _mm_loadu_si128((const __m128i *) (s + i + p->len - 1));
+      a = _mm_cmpeq_epi8(_mm_or_si128(a, first_case), first);
+      b = _mm_cmpeq_epi8(_mm_or_si128(b, last_case), last);
+      mask = (unsigned) _mm_movemask_epi8(_mm_and_si128(a, b));
+
+      while (mask != 0) {
+         bit = __builtin_ctz(mask);
+         if (substr_match_middle(p, s + i + bit))
+            return (const char *) (s + i + bit);
+         mask &= mask - 1;
+      }
+   }
+
+   *start = i;
+   return NULL;
+}
+#endif
+
+const char *
+substr_find(const substr_pattern *p, const char *s)
+{
+   const unsigned char *u;
+   const char          *found;
+   size_t               len, start, end;
+
+   if (p->len == 0)
+      return s;
+
+   len = strlen(s);
+   if (len < p->len)
+      return NULL;
+
+   /* the places the pattern could start at: it must fit in s from there */
+   u = (const unsigned char *) s;
+   start = 0;
+   end = len - p->len + 1;
+   found = NULL;
+
+#ifdef SUBSTR_AVX2
+   if (substr_has_avx2 && end >= 32)
+      found = substr_find_avx2(p, u, &start, end);
+#endif
+#ifdef __SSE2__
+   if (found == NULL && end - start >= 16)
+      found = substr_find_sse2(p, u, &start, end);
+#endif
+   if (found == NULL)
+      found = substr_find_bytes(p, u, start, end);
+
+   return found;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SUBSTR_H
+#define SUBSTR_H
+
+#include "../compat/compat.h"
+
+#include <err.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * ASCII case-insensitive substring search, for matching the same string
+ * against many others (as a query is against the whole library).  Unlike
+ * strcasestr(3), it ignores the locale: only A-Z and a-z are the same.
+ *
+ * The pattern is folded once, up front.  Searching then looks for where
+ * both its first and last bytes are, 16 (SSE2) or 32 (AVX2, if the CPU has
+ * it) places at a time, and compares the rest only there.  Other machines
+ * do the same a byte at a time.
+ */
+typedef struct {
+   char           *folded;    /* the pattern, lower case */
+   size_t          len;
+   unsigned char   first;     /* folded first/last bytes */
+   unsigned char   last;
+   unsigned char   first_case;   /* 0x20 if first/last are letters, else 0 */
+   unsigned char   last_case;
+} substr_pattern;
+
+/* setup/free a pattern */
+void substr_init(substr_pattern *p, const char *s);
+void substr_free(substr_pattern *p);
+
+/* the first place a pattern is in s, ignoring case, or NULL */
+const char *substr_find(const substr_pattern *p, const char *s);
+
+#endif
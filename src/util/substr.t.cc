@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+
+extern "C" {
+#  include "substr.c"
+};
+
+static const char *
+find(const char *pattern, const char *s)
+{
+   static substr_pattern p;
+   const char *found;
+
+   substr_init(&p, pattern);
+   found = substr_find(&p, s);
+   substr_free(&p);
+   return found;
+}
+
+/* the obvious way, to check against */
+static const char *
+naive(const char *pattern, const char *s)
+{
+   size_t i, j, n = strlen(pattern), len = strlen(s);
+
+   for (i = 0; i + n <= len; i++) {
+      for (j = 0; j < n; j++) {
+         if (SUBSTR_LOWER((unsigned char) s[i + j])
+         !=  SUBSTR_LOWER((unsigned char) pattern[j]))
+            break;
+      }
+      if (j == n)
+         return s + i;
+   }
+   return NULL;
+}
+
+TEST(substr, TestBasics)
+{
+   const char *s = "The Beatles - Abbey Road";
+
+   ASSERT_EQ(s, find("", s));
+   ASSERT_EQ(s, find("the", s));
+   ASSERT_EQ(s + 4, find("BEATLES", s));
+   ASSERT_EQ(s + 20, find("road", s));
+   ASSERT_EQ(s + 23, find("D", s));
+   ASSERT_EQ(NULL, find("roads", s));
+   ASSERT_EQ(NULL, find("x", ""));
+
+   /* only letters fold: '@' isn't '`', nor are bytes past ASCII */
+   ASSERT_EQ(NULL, find("@", "`"));
+   ASSERT_EQ(NULL, find("[x", "{X"));
+   ASSERT_EQ(NULL, find("\xc3\xa9", "\xc3\x89"));
+   ASSERT_NE((const char *) NULL, find("caf\xc3\xa9", "CAF\xc3\xa9!"));
+}
+
+TEST(substr, TestAgainstNaive)
+{
+   static const char alphabet[] = "abAB@`[{ \xe9";
+   char     s[200], pattern[8];
+   unsigned seed = 7;
+   int      i, j, len, n;
+
+   /* long enough for the vector loops, and every alignment of matches */
+   for (i = 0; i < 20000; i++) {
+      len = (seed = seed * 1103515245 + 12345) % 150;
+      for (j = 0; j < len; j++)
+         s[j] = alphabet[((seed = seed * 1103515245 + 12345) >> 16) % 10];
+      s[len] = '\0';
+
+      n = 1 + ((seed = seed * 1103515245 + 12345) >> 16) % 4;
+      for (j = 0; j < n; j++)
+         pattern[j] = alphabet[((seed = seed * 1103515245 + 12345) >> 16) % 10];
+      pattern[n] = '\0';
+
+      ASSERT_EQ(naive(pattern, s), find(pattern, s)) << pattern << " in " << s;
+   }
+}
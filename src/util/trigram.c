@@ -0,0 +1,302 @@
+/*
+ * Copyright (c) 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "trigram.h"
+
+/* a trigram of the case-folded bytes at s, never 0 */
+#define TRIGRAM_OF(s) \
+   (((uint32_t) tolower((unsigned char) (s)[0]) << 16) \
+  | ((uint32_t) tolower((unsigned char) (s)[1]) << 8) \
+  |  (uint32_t) tolower((unsigned char) (s)[2]))
+
+static size_t
+trigram_hash(uint32_t trigram)
+{
+   return (size_t) (trigram * 2654435761u);
+}
+
+/* the list of a trigram, or the free slot it would go in */
+static trigram_list *
+trigram_slot(const trigram_index *t, uint32_t trigram)
+{
+   size_t i;
+
+   i = trigram_hash(trigram) & (t->capacity - 1);
+   while (t->lists[i].trigram != 0 && t->lists[i].trigram != trigram)
+      i = (i + 1) & (t->capacity - 1);
+
+   return &(t->lists[i]);
+}
+
+static void
+trigram_grow(trigram_index *t)
+{
+   trigram_list *old, *slot;
+   size_t        old_capacity, i;
+
+   old = t->lists;
+   old_capacity = t->capacity;
+
+   t->capacity *= 2;
+   t->lists = (trigram_list *) calloc(t->capacity, sizeof(trigram_list));
+   if (t->lists == NULL)
+      err(1, "%s: calloc failed", __FUNCTION__);
+
+   for (i = 0; i < old_capacity; i++) {
+      if (old[i].trigram == 0)
+         continue;
+      slot = trigram_slot(t, old[i].trigram);
+      *slot = old[i];
+   }
+
+   free(old);
+}
+
+trigram_index *
+trigram_new(void)
+{
+   trigram_index *t;
+
+   if ((t = (trigram_index *) calloc(1, sizeof(trigram_index))) == NULL)
+      err(1, "%s: calloc failed", __FUNCTION__);
+
+   t->capacity = 1024;
+   t->lists = (trigram_list *) calloc(t->capacity, sizeof(trigram_list));
+   if (t->lists == NULL)
+      err(1, "%s: calloc failed", __FUNCTION__);
+
+   return t;
+}
+
+void
+trigram_free(trigram_index *t)
+{
+   size_t i;
+
+   for (i = 0; i < t->capacity; i++)
+      free(t->lists[i].ids);
+   free(t->lists);
+   free(t);
+}
+
+/* append an id to a list, as the varint of its distance from the last */
+static void
+trigram_list_add(trigram_list *l, uint32_t id)
+{
+   unsigned char *ids;
+   uint32_t       delta;
+
+   if (l->size + 5 > l->capacity) {
+      l->capacity = (l->capacity == 0 ? 8 : l->capacity * 2);
+      if ((ids = (unsigned char *) realloc(l->ids, l->capacity)) == NULL)
+         err(1, "%s: realloc failed", __FUNCTION__);
+      l->ids = ids;
+   }
+
+   delta = id - l->last;
+   while (delta >= 0x80) {
+      l->ids[l->size++] = (delta & 0x7f) | 0x80;
+      delta >>= 7;
+   }
+   l->ids[l->size++] = delta;
+
+   l->last = id;
+   l->count++;
+}
+
+void
+trigram_add(trigram_index *t, uint32_t id, const char *text)
+{
+   trigram_list *l;
+   uint32_t      trigram;
+   size_t        i, len;
+
+   if (id >= t->nids)
+      t->nids = id + 1;
+
+   len = strlen(text);
+   for (i = 0; i + 3 <= len; i++) {
+      trigram = TRIGRAM_OF(text + i);
+      l = trigram_slot(t, trigram);
+
+      /* an id is listed once, however many times it has the trigram */
+      if (l->trigram == trigram && l->count > 0 && l->last == id)
+         continue;
+
+      if (l->trigram == 0) {
+         if ((t->nlists + 1) * 2 > t->capacity) {
+            trigram_grow(t);
+            l = trigram_slot(t, trigram);
+         }
+         l->trigram = trigram;
+         t->nlists++;
+      }
+
+      trigram_list_add(l, id);
+   }
+}
+
+void
+trigram_set_init(const trigram_index *t, trigram_set *set)
+{
+   set->nids = t->nids;
+   if ((set->bits = (unsigned char *) malloc(t->nids / 8 + 1)) == NULL)
+      err(1, "%s: malloc failed", __FUNCTION__);
+
+   memset(set->bits, 0xff, t->nids / 8 + 1);
+}
+
+void
+trigram_set_free(trigram_set *set)
+{
+   free(set->bits);
+   set->bits = NULL;
+   set->nids = 0;
+}
+
+/* set the bits of the ids in a list (that are in the set to begin with) */
+static void
+trigram_list_mark(const trigram_list *l, const trigram_set *set,
+   unsigned char *bits)
+{
+   uint32_t id, delta;
+   uint32_t i, shift;
+
+   id = 0;
+   i = 0;
+   while (i < l->size) {
+      delta = 0;
+      shift = 0;
+      do {
+         delta |= (uint32_t) (l->ids[i] & 0x7f) << shift;
+         shift += 7;
+      } while (l->ids[i++] & 0x80);
+
+      id += delta;
+      if (id < set->nids)
+         bits[id / 8] |= set->bits[id / 8] & (1 << (id % 8));
+   }
+}
+
+bool
+trigram_narrow(const trigram_index *t, const char *s, trigram_set *set)
+{
+   const trigram_list *l;
+   unsigned char      *bits;
+   uint32_t            trigram;
+   size_t              i, len, nbytes;
+
+   len = strlen(s);
+   if (len < 3)
+      return false;
+
+   nbytes = set->nids / 8 + 1;
+   if ((bits = (unsigned char *) malloc(nbytes)) == NULL)
+      err(1, "%s: malloc failed", __FUNCTION__);
+
+   /* keep only the ids in the list of each trigram in turn */
+   for (i = 0; i + 3 <= len; i++) {
+      trigram = TRIGRAM_OF(s + i);
+      l = trigram_slot(t, trigram);
+
+      memset(bits, 0, nbytes);
+      if (l->trigram == trigram)
+         trigram_list_mark(l, set, bits);
+
+      memcpy(set->bits, bits, nbytes);
+   }
+
+   free(bits);
+   return true;
+}
+
+/* count each id in a list (that is in the set), up to 255 */
+static void
+trigram_list_count(const trigram_list *l, const trigram_set *set,
+   unsigned char *counts)
+{
+   uint32_t id, delta;
+   uint32_t i, shift;
+
+   id = 0;
+   i = 0;
+   while (i < l->size) {
+      delta = 0;
+      shift = 0;
+      do {
+         delta |= (uint32_t) (l->ids[i] & 0x7f) << shift;
+         shift += 7;
+      } while (l->ids[i++] & 0x80);
+
+      id += delta;
+      if (id < set->nids && TRIGRAM_MAY_MATCH(set, id) && counts[id] < 255)
+         counts[id]++;
+   }
+}
+
+bool
+trigram_narrow_approx(const trigram_index *t, const char *s, int k,
+   trigram_set *set)
+{
+   const trigram_list *l;
+   unsigned char      *counts;
+   uint32_t           *trigrams;
+   uint32_t            trigram, id;
+   size_t              i, j, len, ntrigrams;
+   int                 least;
+
+   len = strlen(s);
+   if (len < 3)
+      return false;
+
+   if ((trigrams = (uint32_t *) malloc((len - 2) * sizeof(uint32_t))) == NULL)
+      err(1, "%s: malloc failed", __FUNCTION__);
+
+   /* the different trigrams of s */
+   ntrigrams = 0;
+   for (i = 0; i + 3 <= len; i++) {
+      trigram = TRIGRAM_OF(s + i);
+      for (j = 0; j < ntrigrams && trigrams[j] != trigram; j++)
+         continue;
+      if (j == ntrigrams)
+         trigrams[ntrigrams++] = trigram;
+   }
+
+   least = (int) ntrigrams - 3 * k;
+   if (least < 1 || least > 255) {
+      free(trigrams);
+      return false;
+   }
+
+   if ((counts = (unsigned char *) calloc(set->nids + 1, 1)) == NULL)
+      err(1, "%s: calloc failed", __FUNCTION__);
+
+   for (i = 0; i < ntrigrams; i++) {
+      l = trigram_slot(t, trigrams[i]);
+      if (l->trigram == trigrams[i])
+         trigram_list_count(l, set, counts);
+   }
+
+   /* keep only the ids with enough of them */
+   for (id = 0; id < set->nids; id++) {
+      if (counts[id] < least)
+         set->bits[id / 8] &= ~(1 << (id % 8));
+   }
+
+   free(counts);
+   free(trigrams);
+   return true;
+}
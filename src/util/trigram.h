@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef TRIGRAM_H
+#define TRIGRAM_H
+
+#include "../compat/compat.h"
+
+#include <ctype.h>
+#include <err.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * An inverted index of the trigrams (three consecutive bytes, case-folded)
+ * of the text of documents, numbered by the caller from 1 up.  It narrows
+ * a substring search down to the documents that have every trigram of the
+ * string, which must then still be checked: having all of them doesn't
+ * mean they're in the right order, or in the same piece of text.
+ *
+ * Documents are only ever added, in increasing order of id, and each id's
+ * text never changes.  A document that goes away is just never asked
+ * about again (so its id must not be reused).  Each trigram keeps the ids
+ * of its documents as a list of varint deltas, which mostly takes a byte
+ * per id.
+ */
+typedef struct {
+   uint32_t        trigram;   /* the three bytes, or 0 if the slot is free */
+   uint32_t        count;     /* ids in the list */
+   uint32_t        last;      /* last id added */
+   uint32_t        size;      /* bytes used of ids */
+   uint32_t        capacity;
+   unsigned char  *ids;
+} trigram_list;
+
+typedef struct {
+   trigram_list   *lists;
+   size_t          capacity;  /* always a power of two */
+   size_t          nlists;
+   uint32_t        nids;      /* one more than the largest id added */
+} trigram_index;
+
+/*
+ * The documents a search may match, as a bitmap of ids.  Those added after
+ * it was made (nids and up) are all taken to match.
+ */
+typedef struct {
+   unsigned char  *bits;
+   uint32_t        nids;
+} trigram_set;
+
+#define TRIGRAM_MAY_MATCH(set, id) \
+   ((id) >= (set)->nids || ((set)->bits[(id) / 8] >> ((id) % 8)) & 1)
+
+/* create/destroy an index */
+trigram_index *trigram_new(void);
+void trigram_free(trigram_index *t);
+
+/* add (a piece of) the text of a document, id being the largest so far */
+void trigram_add(trigram_index *t, uint32_t id, const char *text);
+
+/* make a set of all documents so far, or free one */
+void trigram_set_init(const trigram_index *t, trigram_set *set);
+void trigram_set_free(trigram_set *set);
+
+/*
+ * Narrow a set to the documents with every trigram of s, returning false
+ * (leaving it untouched) if s is too short to have any.
+ */
+bool trigram_narrow(const trigram_index *t, const char *s, trigram_set *set);
+
+/*
+ * Narrow a set to the documents s may be in with up to k errors (see
+ * bitap.h): each error changes at most three of its trigrams, so they
+ * have all but 3k of its different trigrams.  Returns false (leaving the
+ * set untouched) if s has too few for that to narrow anything.
+ */
+bool trigram_narrow_approx(const trigram_index *t, const char *s, int k,
+   trigram_set *set);
+
+#endif
@@ -0,0 +1,126 @@
+#include <gtest/gtest.h>
+
+extern "C" {
+#  include "trigram.c"
+};
+
+static const char *docs[] = {
+   NULL,
+   "The Beatles",
+   "Abbey Road",
+   "BEATLES FOR SALE",
+   "eat the beat",
+   "Help!"
+};
+#define NDOCS ((uint32_t) (sizeof(docs) / sizeof(docs[0])))
+
+static trigram_index *
+build(void)
+{
+   trigram_index *t = trigram_new();
+   uint32_t       id;
+
+   for (id = 1; id < NDOCS; id++)
+      trigram_add(t, id, docs[id]);
+   return t;
+}
+
+TEST(trigram, TestNarrowIsCaseInsensitive)
+{
+   trigram_index *t = build();
+   trigram_set    set;
+
+   trigram_set_init(t, &set);
+   ASSERT_EQ(NDOCS, set.nids);
+   ASSERT_TRUE(trigram_narrow(t, "bEaTl", &set));
+   ASSERT_TRUE(TRIGRAM_MAY_MATCH(&set, 1));
+   ASSERT_FALSE(TRIGRAM_MAY_MATCH(&set, 2));
+   ASSERT_TRUE(TRIGRAM_MAY_MATCH(&set, 3));
+   ASSERT_FALSE(TRIGRAM_MAY_MATCH(&set, 4));
+   ASSERT_FALSE(TRIGRAM_MAY_MATCH(&set, 5));
+
+   /* later ids aren't known to the set, so may match */
+   ASSERT_TRUE(TRIGRAM_MAY_MATCH(&set, NDOCS));
+   trigram_set_free(&set);
+   trigram_free(t);
+}
+
+TEST(trigram, TestNarrowIsSuperset)
+{
+   trigram_index *t = build();
+   trigram_set    set;
+
+   /* each string narrows further; doc 4 has both, just not together */
+   trigram_set_init(t, &set);
+   ASSERT_TRUE(trigram_narrow(t, "beat", &set));
+   ASSERT_TRUE(trigram_narrow(t, "the", &set));
+   ASSERT_FALSE(TRIGRAM_MAY_MATCH(&set, 2));
+   ASSERT_TRUE(TRIGRAM_MAY_MATCH(&set, 1));
+   ASSERT_FALSE(TRIGRAM_MAY_MATCH(&set, 3));
+   ASSERT_TRUE(TRIGRAM_MAY_MATCH(&set, 4));
+   trigram_set_free(&set);
+
+   /* too short to narrow, or in nothing */
+   trigram_set_init(t, &set);
+   ASSERT_FALSE(trigram_narrow(t, "be", &set));
+   ASSERT_TRUE(TRIGRAM_MAY_MATCH(&set, 2));
+   ASSERT_TRUE(trigram_narrow(t, "xyz", &set));
+   ASSERT_FALSE(TRIGRAM_MAY_MATCH(&set, 1));
+   ASSERT_FALSE(TRIGRAM_MAY_MATCH(&set, 5));
+   trigram_set_free(&set);
+   trigram_free(t);
+}
+
+TEST(trigram, TestManyIds)
+{
+   trigram_index *t = trigram_new();
+   trigram_set    set;
+   char           text[32];
+   uint32_t       id;
+
+   /* big gaps between ids, and enough trigrams to grow the table */
+   for (id = 1; id < 200000; id += 7) {
+      snprintf(text, sizeof(text), "song %u", id);
+      trigram_add(t, id, text);
+      trigram_add(t, id, id % 2 ? "odd" : "even");
+   }
+
+   trigram_set_init(t, &set);
+   ASSERT_TRUE(trigram_narrow(t, "12345", &set));
+   ASSERT_TRUE(trigram_narrow(t, "ODD", &set));
+   for (id = 1; id < 200000; id += 7) {
+      snprintf(text, sizeof(text), "%u", id);
+      ASSERT_EQ(strstr(text, "12345") != NULL && id % 2 == 1,
+                (bool) TRIGRAM_MAY_MATCH(&set, id)) << id;
+   }
+   trigram_set_free(&set);
+   trigram_free(t);
+}
+
+TEST(trigram, TestNarrowApprox)
+{
+   trigram_index *t = build();
+   trigram_set    set;
+
+   /* "beatels" has 2 of its 5 trigrams left after an error at most */
+   trigram_set_init(t, &set);
+   ASSERT_TRUE(trigram_narrow_approx(t, "beatels", 1, &set));
+   ASSERT_TRUE(TRIGRAM_MAY_MATCH(&set, 1));
+   ASSERT_FALSE(TRIGRAM_MAY_MATCH(&set, 2));
+   ASSERT_TRUE(TRIGRAM_MAY_MATCH(&set, 3));
+   ASSERT_TRUE(TRIGRAM_MAY_MATCH(&set, 4));
+   ASSERT_FALSE(TRIGRAM_MAY_MATCH(&set, 5));
+
+   /* with no errors it's as narrow as can be */
+   ASSERT_TRUE(trigram_narrow_approx(t, "Beatles", 0, &set));
+   ASSERT_TRUE(TRIGRAM_MAY_MATCH(&set, 1));
+   ASSERT_FALSE(TRIGRAM_MAY_MATCH(&set, 4));
+   trigram_set_free(&set);
+
+   /* too many errors to rule anything out */
+   trigram_set_init(t, &set);
+   ASSERT_FALSE(trigram_narrow_approx(t, "beatles", 2, &set));
+   ASSERT_TRUE(TRIGRAM_MAY_MATCH(&set, 2));
+   trigram_set_free(&set);
+   trigram_free(t);
+}
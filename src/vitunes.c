@@ -17,6 +17,8 @@
 #include "vitunes.h"
 #include "config.h"     /* NOTE: must be after vitunes.h */
 #include "socket.h"
+#include "watch.h"
+#include "writer.h"
 
 /*****************************************************************************
  * GLOBALS, EXPORTED
@@ -86,6 +88,7 @@ main(int argc, char *argv[])
    int            previous_command;
    int            input;
    int            sock = -1;
+   int            maxfd;
    fd_set         fds;
    struct passwd *pw;
 
@@ -170,7 +173,7 @@ main(int argc, char *argv[])
    }
 
    /* apply default sort to library */
-   qsort(mdb.library->files, mdb.library->nfiles, sizeof(meta_info*), mi_compare);
+   medialib_sort_library();
 
    /* start media player child */
    player_init(player_backend, paint_message, paint_error);
@@ -193,6 +196,15 @@ main(int argc, char *argv[])
    /* initial painting of the display */
    paint_all();
 
+   /* save playlists & the database in the background from now on */
+   writer_start();
+
+   /* keep the sorted orders of the library in the database up to date */
+   if (medialib_sorts_stale()) {
+      mdb.db_needs_rewrite = true;
+      writer_save_db();
+   }
+
    /* -----------------------------------------------------------------------
     * begin input loop
     * -------------------------------------------------------------------- */
@@ -209,10 +221,23 @@ main(int argc, char *argv[])
 
       FD_ZERO(&fds);
       FD_SET(0, &fds);
-      if(sock > 0)
+      maxfd = 0;
+      if(sock > 0) {
          FD_SET(sock, &fds);
+         maxfd = sock;
+      }
+      if(watch_fd() > 0) {
+         FD_SET(watch_fd(), &fds);
+         if (watch_fd() > maxfd)
+            maxfd = watch_fd();
+      }
+      if(writer_fd() > 0) {
+         FD_SET(writer_fd(), &fds);
+         if (writer_fd() > maxfd)
+            maxfd = writer_fd();
+      }
       errno = 0;
-      if(select((sock > 0 ? sock : 0) + 1, &fds, NULL, NULL, &tv) == -1) {
+      if(select(maxfd + 1, &fds, NULL, NULL, &tv) == -1) {
          if(errno == 0 || errno == EINTR)
             continue;
          break;
@@ -223,6 +248,12 @@ main(int argc, char *argv[])
             sock_recv_and_exec(sock);
       }
 
+      if(watch_fd() > 0 && FD_ISSET(watch_fd(), &fds))
+         watch_process();
+
+      if(writer_fd() > 0 && FD_ISSET(writer_fd(), &fds))
+         writer_process();
+
       if(FD_ISSET(0, &fds)) {
          /* handle any available input */
          if ((input = getch()) && input != ERR) {
@@ -242,10 +273,13 @@ main(int argc, char *argv[])
 
    ui_destroy();
    player_destroy();
+   watch_stop();
+   writer_stop();
    medialib_destroy();
 
    mi_query_clear();
    ybuffer_free();
+   search_forget();
    toggleset_free();
 
    /* do we have any odd cause for quitting? */
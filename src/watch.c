@@ -0,0 +1,430 @@
+/*
+ * Copyright (c) 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "watch.h"
+
+#ifdef COMPAT_HAVE_INOTIFY
+#  include <sys/inotify.h>
+
+/* events watched for on each directory */
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM \
+                    | IN_MOVED_TO | IN_ONLYDIR)
+
+static int      inotify_fd = -1;
+static char   **watch_dirs = NULL;       /* directory of each descriptor */
+static int      watch_dirs_size = 0;
+static strhash *watch_dirs_index = NULL; /* directory -> descriptor */
+static bool     watch_warned_limit;
+
+/* changes made while handling a batch of events */
+static int      watch_added, watch_updated, watch_removed;
+
+
+/*****************************************************************************
+ * Keeping the visible playlist in sync with the library
+ ****************************************************************************/
+
+static void
+watch_ui_added(int idx)
+{
+   if (viewing_playlist != mdb.library)
+      return;
+
+   ui.playlist->nrows = mdb.library->nfiles;
+   paint_playlist_rows(idx, idx);
+}
+
+static void
+watch_ui_replaced(int idx)
+{
+   if (viewing_playlist == mdb.library)
+      paint_playlist_rows(idx, idx);
+}
+
+static void
+watch_ui_removed(int idx)
+{
+   /* keep the playing file where it is */
+   if (playing_playlist == mdb.library) {
+      if (mdb.library->nfiles == 0) {
+         player_stop();
+         playing_playlist = NULL;
+      } else if (player_info.qidx > idx
+             ||  player_info.qidx >= mdb.library->nfiles)
+         player_info.qidx--;
+   }
+
+   if (viewing_playlist != mdb.library)
+      return;
+
+   ui.playlist->nrows = mdb.library->nfiles;
+
+   /* removed above the window, so everything shown just moved up one */
+   if (idx < ui.playlist->voffset) {
+      ui.playlist->voffset--;
+      return;
+   }
+
+   /* keep the cursor on the same file, or the last one */
+   if (idx < ui.playlist->voffset + ui.playlist->crow)
+      ui.playlist->crow--;
+   if (ui.playlist->voffset + ui.playlist->crow >= ui.playlist->nrows)
+      ui.playlist->crow = ui.playlist->nrows - ui.playlist->voffset - 1;
+   if (ui.playlist->crow < 0) {
+      ui.playlist->voffset = 0;
+      ui.playlist->crow = 0;
+      paint_playlist();
+      return;
+   }
+
+   paint_playlist_rows(idx, INT_MAX);
+}
+
+
+/*****************************************************************************
+ * Applying changes to the library
+ ****************************************************************************/
+
+/* a file was created/modified/moved in: (re-)extract it */
+static void
+watch_file_changed(const char *path)
+{
+   struct stat  sb;
+   meta_info   *mi;
+   char         fullname[PATH_MAX];
+   int          idx;
+
+   /* it may already be gone again, a later event will say so */
+   if (realpath(path, fullname) == NULL || stat(fullname, &sb) == -1
+   ||  !S_ISREG(sb.st_mode))
+      return;
+
+   if ((mi = mi_extract(fullname)) != NULL)
+      mi_sanitize(mi);
+
+   idx = medialib_file_find(fullname);
+   if (idx == -1 && mi != NULL) {
+      medialib_file_add(mi);
+      watch_ui_added(mdb.library->nfiles - 1);
+      watch_added++;
+   } else if (idx != -1 && mi != NULL) {
+      medialib_file_replace(idx, mi);
+      watch_ui_replaced(idx);
+      watch_updated++;
+   } else if (idx != -1) {
+      medialib_file_remove(idx);
+      watch_ui_removed(idx);
+      watch_removed++;
+   }
+}
+
+/* a file was deleted/moved out */
+static void
+watch_file_removed(const char *path)
+{
+   int idx;
+
+   if ((idx = medialib_file_find(path)) == -1)
+      return;
+
+   medialib_file_remove(idx);
+   watch_ui_removed(idx);
+   watch_removed++;
+}
+
+/* start watching a directory, if not already */
+static void
+watch_dir_add(const char *dir)
+{
+   char  **new_dirs;
+   int     wd, i;
+
+   if (strhash_get(watch_dirs_index, dir) != NULL)
+      return;
+
+   if ((wd = inotify_add_watch(inotify_fd, dir, WATCH_EVENTS)) == -1) {
+      if (errno == ENOSPC && !watch_warned_limit) {
+         paint_error("watch: too many directories (see max_user_watches)");
+         watch_warned_limit = true;
+      }
+      return;
+   }
+
+   if (wd >= watch_dirs_size) {
+      new_dirs = realloc(watch_dirs, (wd + 1) * 2 * sizeof(char*));
+      if (new_dirs == NULL)
+         err(1, "watch_dir_add: realloc failed");
+
+      for (i = watch_dirs_size; i < (wd + 1) * 2; i++)
+         new_dirs[i] = NULL;
+
+      watch_dirs = new_dirs;
+      watch_dirs_size = (wd + 1) * 2;
+   }
+
+   /* another path to a directory already watched */
+   if (watch_dirs[wd] != NULL)
+      return;
+
+   if ((watch_dirs[wd] = strdup(dir)) == NULL)
+      err(1, "watch_dir_add: strdup failed");
+   strhash_set(watch_dirs_index, watch_dirs[wd], wd);
+}
+
+/* forget about a descriptor that's no longer watched */
+static void
+watch_dir_forget(int wd)
+{
+   if (wd < 0 || wd >= watch_dirs_size || watch_dirs[wd] == NULL)
+      return;
+
+   strhash_remove(watch_dirs_index, watch_dirs[wd]);
+   free(watch_dirs[wd]);
+   watch_dirs[wd] = NULL;
+}
+
+/* a directory was created/moved in: watch it, and add all files within */
+static void
+watch_dir_created(const char *path)
+{
+   FTS    *fts;
+   FTSENT *ftsent;
+   char   *paths[2];
+   char    fullname[PATH_MAX];
+
+   paths[0] = (char *) path;
+   paths[1] = NULL;
+   if ((fts = fts_open(paths, FTS_LOGICAL | FTS_NOCHDIR, NULL)) == NULL)
+      return;
+
+   while ((ftsent = fts_read(fts)) != NULL) {
+      if (ftsent->fts_info == FTS_D) {
+         if (realpath(ftsent->fts_accpath, fullname) != NULL)
+            watch_dir_add(fullname);
+      } else if (ftsent->fts_info == FTS_F)
+         watch_file_changed(ftsent->fts_accpath);
+   }
+
+   fts_close(fts);
+}
+
+/*
+ * A directory was moved out: drop all files beneath it, and stop watching
+ * it and the directories beneath it (their watches move along with them).
+ */
+static void
+watch_dir_removed(const char *path)
+{
+   size_t len;
+   int    i;
+
+   len = strlen(path);
+   for (i = mdb.library->nfiles - 1; i >= 0; i--) {
+      if (strncmp(mdb.library->files[i]->filename, path, len) == 0
+      &&  mdb.library->files[i]->filename[len] == '/') {
+         medialib_file_remove(i);
+         watch_ui_removed(i);
+         watch_removed++;
+      }
+   }
+
+   for (i = 0; i < watch_dirs_size; i++) {
+      if (watch_dirs[i] != NULL && strncmp(watch_dirs[i], path, len) == 0
+      && (watch_dirs[i][len] == '/' || watch_dirs[i][len] == '\0')) {
+         inotify_rm_watch(inotify_fd, i);
+         watch_dir_forget(i);
+      }
+   }
+}
+
+
+/*****************************************************************************
+ * The public interface
+ ****************************************************************************/
+
+int
+watch_start(void)
+{
+   char  dir[PATH_MAX];
+   char *slash;
+   int   i;
+
+   if (inotify_fd != -1)
+      return 0;
+
+   if ((inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1)
+      return -1;
+
+   watch_dirs_index = strhash_new(0);
+   watch_warned_limit = false;
+
+   /*
+    * watch every directory "vitunes -e add" walked, roots and directories
+    * of nothing but subdirectories too, so new ones dropped in are noticed
+    */
+   for (i = 0; i < mdb.ndirs; i++) {
+      if (mdb.dirs[i].mtime != -1)
+         watch_dir_add(mdb.dirs[i].path);
+   }
+
+   /* and that of every file, for files added before directories were kept */
+   for (i = 0; i < mdb.library->nfiles; i++) {
+      if (mdb.library->files[i]->is_url)
+         continue;
+
+      strlcpy(dir, mdb.library->files[i]->filename, sizeof(dir));
+      if ((slash = strrchr(dir, '/')) == NULL || slash == dir)
+         continue;
+
+      *slash = '\0';
+      watch_dir_add(dir);
+   }
+
+   return 0;
+}
+
+void
+watch_stop(void)
+{
+   int i;
+
+   if (inotify_fd == -1)
+      return;
+
+   close(inotify_fd);
+   inotify_fd = -1;
+
+   for (i = 0; i < watch_dirs_size; i++)
+      free(watch_dirs[i]);
+   free(watch_dirs);
+   strhash_free(watch_dirs_index);
+
+   watch_dirs = NULL;
+   watch_dirs_size = 0;
+   watch_dirs_index = NULL;
+}
+
+bool
+watch_running(void)
+{
+   return inotify_fd != -1;
+}
+
+int
+watch_fd(void)
+{
+   return inotify_fd;
+}
+
+void
+watch_process(void)
+{
+   union {
+      struct inotify_event  event;
+      char                  buf[WATCH_BUFFER_SIZE];
+   } events;
+   struct inotify_event *ev;
+   char                  path[PATH_MAX];
+   ssize_t               len, pos;
+   bool                  overflow;
+
+   if (inotify_fd == -1)
+      return;
+
+   watch_added = watch_updated = watch_removed = 0;
+   overflow = false;
+
+   while ((len = read(inotify_fd, events.buf, sizeof(events.buf))) > 0) {
+      for (pos = 0; pos < len;
+           pos += sizeof(struct inotify_event) + ev->len) {
+         ev = (struct inotify_event *) (events.buf + pos);
+
+         if (ev->mask & IN_Q_OVERFLOW)
+            overflow = true;
+         if (ev->mask & IN_IGNORED)
+            watch_dir_forget(ev->wd);
+
+         if (ev->len == 0 || ev->wd < 0 || ev->wd >= watch_dirs_size
+         ||  watch_dirs[ev->wd] == NULL)
+            continue;
+
+         snprintf(path, sizeof(path), "%s/%s", watch_dirs[ev->wd], ev->name);
+
+         if (ev->mask & IN_ISDIR) {
+            if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+               watch_dir_created(path);
+            else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+               watch_dir_removed(path);
+         } else {
+            if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+               watch_file_changed(path);
+            else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+               watch_file_removed(path);
+         }
+      }
+   }
+
+   /* the other playlists show the new records of updated files too */
+   if (watch_updated > 0) {
+      medialib_redirect();
+      if (viewing_playlist != mdb.library)
+         paint_playlist();
+   }
+
+   if (watch_added + watch_updated + watch_removed > 0) {
+      writer_save_db();
+      paint_message("library: %d added, %d updated, %d removed",
+         watch_added, watch_updated, watch_removed);
+   }
+
+   if (overflow)
+      paint_error("watch: events were lost, use ':reload db' to catch up");
+}
+
+#else
+
+/* without inotify(7) there's nothing to watch with */
+
+int
+watch_start(void)
+{
+   errno = ENOSYS;
+   return -1;
+}
+
+void
+watch_stop(void)
+{
+}
+
+bool
+watch_running(void)
+{
+   return false;
+}
+
+int
+watch_fd(void)
+{
+   return -1;
+}
+
+void
+watch_process(void)
+{
+}
+
+#endif
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Watching the directories of the library for changes, using inotify(7),
+ * so files added/modified/removed there are reflected in the library (and
+ * database) of a running vitunes without a rescan.
+ *
+ * The directories watched are those walked by "vitunes -e add" (see
+ * medialib_dir) and those containing any file in the library, plus any
+ * created within them later.  Each batch of events is applied
+ * through mi_extract() and the medialib_file_* routines, the changes
+ * appended to the database journal, and only the affected rows of the
+ * playlist window repainted.  New files are added to the end of the library.
+ */
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "compat/compat.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fts.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "medialib.h"
+#include "meta_info.h"
+#include "paint.h"
+#include "player/player.h"
+#include "util/strhash.h"
+#include "vitunes.h"
+#include "writer.h"
+
+/* size of the buffer events are read into */
+#define WATCH_BUFFER_SIZE  (64 * 1024)
+
+/*
+ * Start/stop watching the directories of the library.  watch_start()
+ * returns 0 on success, -1 (with errno set) if watching isn't possible.
+ */
+int  watch_start(void);
+void watch_stop(void);
+
+/* is the library being watched? */
+bool watch_running(void);
+
+/* descriptor to select(2) on for events, -1 if not watching */
+int  watch_fd(void);
+
+/* read and apply all pending events */
+void watch_process(void);
+
+#endif
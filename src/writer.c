@@ -0,0 +1,349 @@
+/*
+ * Copyright (c) 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "writer.h"
+
+/* a snapshot to be written */
+typedef struct writer_job {
+   bool                 is_db;
+   char                *filename;   /* of a playlist */
+   meta_info          **files;
+   int                  nfiles;
+   db_snapshot          snap;       /* of the database */
+   int                  error;      /* errno of a failure, or 0 */
+   struct writer_job   *next;       /* in the list of completed jobs */
+} writer_job;
+
+static pthread_t        writer_thread;
+static pthread_mutex_t  writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   writer_wake  = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t   writer_room  = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t   writer_idle  = PTHREAD_COND_INITIALIZER;
+static bool             writer_running = false;
+static bool             writer_stopping;
+static bool             writer_busy;             /* a job is being written */
+static writer_job      *writer_queue[WRITER_QUEUE_SIZE];
+static int              writer_nqueued;
+static writer_job      *writer_done;             /* most recent first */
+static int              writer_pipe[2] = { -1, -1 };
+
+
+static void
+writer_job_free(writer_job *job)
+{
+   if (job->is_db)
+      medialib_db_snapshot_free(&(job->snap));
+   free(job->filename);
+   free(job->files);
+   free(job);
+}
+
+static void
+writer_job_run(writer_job *job)
+{
+   int ret;
+
+   if (job->is_db)
+      ret = medialib_db_snapshot_write(&(job->snap));
+   else
+      ret = playlist_write(job->filename, job->files, job->nfiles);
+
+   job->error = (ret == -1 ? errno : 0);
+}
+
+/* report a job on the main thread, and free it */
+static void
+writer_job_report(writer_job *job)
+{
+   int i;
+
+   if (job->error == 0) {
+      if (!job->is_db)
+         paint_message("\"%s\" %d songs written", job->filename, job->nfiles);
+
+   } else if (job->is_db) {
+      paint_error("failed to save the library: %s", strerror(job->error));
+
+   } else {
+      paint_error("failed to write \"%s\": %s", job->filename,
+         strerror(job->error));
+
+      /* so it's not lost silently */
+      for (i = 0; i < mdb.nplaylists; i++) {
+         if (mdb.playlists[i]->filename != NULL
+         &&  strcmp(mdb.playlists[i]->filename, job->filename) == 0) {
+            mdb.playlists[i]->needs_saving = true;
+            paint_library();
+         }
+      }
+   }
+
+   writer_job_free(job);
+}
+
+/* merge a new job into one still queued, returning false if it can't be */
+static bool
+writer_job_merge(writer_job *job)
+{
+   writer_job *queued;
+   char       *data;
+   int         i, n;
+
+   /* a newer snapshot of a playlist replaces the queued one */
+   if (!job->is_db) {
+      for (i = 0; i < writer_nqueued; i++) {
+         queued = writer_queue[i];
+         if (!queued->is_db && strcmp(queued->filename, job->filename) == 0) {
+            free(queued->files);
+            queued->files = job->files;
+            queued->nfiles = job->nfiles;
+            job->files = NULL;
+            return true;
+         }
+      }
+      return false;
+   }
+
+   /* a whole database makes anything queued for it useless */
+   if (job->snap.rewrite) {
+      for (i = n = 0; i < writer_nqueued; i++) {
+         if (writer_queue[i]->is_db)
+            writer_job_free(writer_queue[i]);
+         else
+            writer_queue[n++] = writer_queue[i];
+      }
+      writer_nqueued = n;
+      return false;
+   }
+
+   /* journal entries are added to those of the last one queued */
+   for (i = writer_nqueued - 1; i >= 0; i--) {
+      queued = writer_queue[i];
+      if (!queued->is_db)
+         continue;
+      if (queued->snap.rewrite)
+         return false;
+
+      data = realloc(queued->snap.data, queued->snap.len + job->snap.len);
+      if (data == NULL)
+         err(1, "writer_job_merge: realloc failed");
+
+      memcpy(data + queued->snap.len, job->snap.data, job->snap.len);
+      queued->snap.data = data;
+      queued->snap.len += job->snap.len;
+      return true;
+   }
+
+   return false;
+}
+
+static void *
+writer_main(void *arg)
+{
+   writer_job *job;
+
+   (void) arg;
+   pthread_mutex_lock(&writer_mutex);
+   for (;;) {
+      while (writer_nqueued == 0 && !writer_stopping)
+         pthread_cond_wait(&writer_wake, &writer_mutex);
+      if (writer_nqueued == 0)
+         break;
+
+      job = writer_queue[0];
+      writer_nqueued--;
+      memmove(writer_queue, writer_queue + 1,
+         writer_nqueued * sizeof(writer_job*));
+      writer_busy = true;
+      pthread_cond_signal(&writer_room);
+      pthread_mutex_unlock(&writer_mutex);
+
+      writer_job_run(job);
+
+      pthread_mutex_lock(&writer_mutex);
+      job->next = writer_done;
+      writer_done = job;
+      writer_busy = false;
+      if (write(writer_pipe[1], "", 1) == -1 && errno != EAGAIN)
+         warn("writer: failed to signal completion");
+      pthread_cond_broadcast(&writer_idle);
+   }
+   pthread_mutex_unlock(&writer_mutex);
+
+   return NULL;
+}
+
+/* queue a job, or write it right away if the thread isn't running */
+static void
+writer_enqueue(writer_job *job)
+{
+   if (!writer_running) {
+      writer_job_run(job);
+      writer_job_report(job);
+      return;
+   }
+
+   pthread_mutex_lock(&writer_mutex);
+   if (writer_job_merge(job)) {
+      writer_job_free(job);
+   } else {
+      while (writer_nqueued == WRITER_QUEUE_SIZE)
+         pthread_cond_wait(&writer_room, &writer_mutex);
+
+      writer_queue[writer_nqueued++] = job;
+      pthread_cond_signal(&writer_wake);
+   }
+   pthread_mutex_unlock(&writer_mutex);
+}
+
+
+/*****************************************************************************
+ * The public interface
+ ****************************************************************************/
+
+void
+writer_start(void)
+{
+   int i;
+
+   if (writer_running)
+      return;
+
+   if (pipe(writer_pipe) == -1)
+      err(1, "writer_start: pipe failed");
+   for (i = 0; i < 2; i++) {
+      if (fcntl(writer_pipe[i], F_SETFL, O_NONBLOCK) == -1
+      ||  fcntl(writer_pipe[i], F_SETFD, FD_CLOEXEC) == -1)
+         err(1, "writer_start: fcntl failed");
+   }
+
+   writer_stopping = false;
+   if ((errno = pthread_create(&writer_thread, NULL, writer_main, NULL)) != 0)
+      err(1, "writer_start: pthread_create failed");
+
+   writer_running = true;
+}
+
+void
+writer_stop(void)
+{
+   writer_job *job;
+
+   if (!writer_running)
+      return;
+
+   pthread_mutex_lock(&writer_mutex);
+   writer_stopping = true;
+   pthread_cond_signal(&writer_wake);
+   pthread_mutex_unlock(&writer_mutex);
+   pthread_join(writer_thread, NULL);
+   writer_running = false;
+
+   /* the user interface may be gone, so only failures are reported */
+   while ((job = writer_done) != NULL) {
+      writer_done = job->next;
+      if (job->error != 0)
+         warnx("failed to write \"%s\": %s",
+            job->is_db ? job->snap.db_file : job->filename,
+            strerror(job->error));
+      writer_job_free(job);
+   }
+
+   close(writer_pipe[0]);
+   close(writer_pipe[1]);
+   writer_pipe[0] = writer_pipe[1] = -1;
+}
+
+void
+writer_wait(void)
+{
+   if (!writer_running)
+      return;
+
+   pthread_mutex_lock(&writer_mutex);
+   while (writer_nqueued > 0 || writer_busy)
+      pthread_cond_wait(&writer_idle, &writer_mutex);
+   pthread_mutex_unlock(&writer_mutex);
+}
+
+void
+writer_save_playlist(const playlist *p)
+{
+   writer_job *job;
+
+   if ((job = calloc(1, sizeof(writer_job))) == NULL)
+      err(1, "writer_save_playlist: calloc failed");
+
+   job->filename = strdup(p->filename);
+   job->files = calloc(p->nfiles + 1, sizeof(meta_info*));
+   if (job->filename == NULL || job->files == NULL)
+      err(1, "writer_save_playlist: failed to snapshot playlist");
+
+   memcpy(job->files, p->files, p->nfiles * sizeof(meta_info*));
+   job->nfiles = p->nfiles;
+   writer_enqueue(job);
+}
+
+void
+writer_save_db(void)
+{
+   writer_job *job;
+
+   if ((job = calloc(1, sizeof(writer_job))) == NULL)
+      err(1, "writer_save_db: calloc failed");
+
+   job->is_db = true;
+   if (!medialib_db_snapshot(mdb.db_file, &(job->snap))) {
+      free(job);
+      return;
+   }
+   writer_enqueue(job);
+}
+
+int
+writer_fd(void)
+{
+   return writer_pipe[0];
+}
+
+void
+writer_process(void)
+{
+   writer_job *done, *job, *prev;
+   char        buf[64];
+
+   while (read(writer_pipe[0], buf, sizeof(buf)) > 0)
+      continue;
+
+   pthread_mutex_lock(&writer_mutex);
+   done = writer_done;
+   writer_done = NULL;
+   pthread_mutex_unlock(&writer_mutex);
+
+   /* report in the order they were written */
+   prev = NULL;
+   while (done != NULL) {
+      job = done->next;
+      done->next = prev;
+      prev = done;
+      done = job;
+   }
+
+   while ((job = prev) != NULL) {
+      prev = job->next;
+      writer_job_report(job);
+   }
+}
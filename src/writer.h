@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Saving playlists and the database in the background, so a slow disk
+ * doesn't freeze the user interface (or the player monitor).
+ *
+ * Saving takes a snapshot of what's to be written right away: the array of
+ * files of a playlist, or the encoded database/journal entries and the
+ * files they were encoded from (see medialib_db_snapshot()).  The records
+ * themselves never change once they're in the library (a file that changes
+ * gets a new record, see medialib_file_replace()), and are only free'd by
+ * medialib_reclaim(), which the e-commands use without a writer, or by
+ * medialib_destroy() after writer_wait() or writer_stop().  A thread then writes the snapshots in order,
+ * each through a temporary file that is rename(2)'d in place, or appended
+ * to the journal.  Saving a playlist (or the database) that is still queued
+ * just replaces (or adds to) what's queued for it.  If the queue is full,
+ * saving waits for room.
+ *
+ * Completions are reported on the main thread, through paint_message() and
+ * paint_error(), when writer_process() is called after writer_fd() becomes
+ * readable.
+ */
+
+#ifndef WRITER_H
+#define WRITER_H
+
+#include "compat/compat.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "medialib.h"
+#include "paint.h"
+#include "playlist.h"
+
+/* most snapshots queued at once */
+#define WRITER_QUEUE_SIZE  16
+
+/*
+ * Start/stop the writer thread.  Stopping writes all that's still queued
+ * first.  While the thread isn't running, saving is done right away.
+ */
+void writer_start(void);
+void writer_stop(void);
+
+/* wait until all that's queued is written (but not yet reported) */
+void writer_wait(void);
+
+/* queue a playlist, or the unsaved changes of the library, to be saved */
+void writer_save_playlist(const playlist *p);
+void writer_save_db(void);
+
+/* descriptor to select(2) on for completions, -1 if not running */
+int  writer_fd(void);
+
+/* report all completed saves */
+void writer_process(void);
+
+#endif